@@ -73,6 +73,14 @@ typedef struct {
 
 typedef unsigned int nfdfiltersize_t;
 
+#ifdef _WIN32
+typedef unsigned long nfdpathsetsize_t;
+#elif __APPLE__
+typedef unsigned long nfdpathsetsize_t;
+#else
+typedef unsigned int nfdpathsetsize_t;
+#endif  // _WIN32, __APPLE__
+
 typedef enum {
     NFD_ERROR, /**< Programmatic error */
     NFD_OKAY,  /**< User pressed okay, or successful return */
@@ -117,11 +125,27 @@ typedef struct {
 
 typedef size_t nfdversion_t;
 
+// The timeoutMs field of the argument structs below limits how long (in milliseconds) the dialog
+// may take, including the time that the user spends in it.  When it expires, the dialog is closed
+// and NFD_ERROR is returned with an error that starts with "Timed out".  It is currently only
+// supported by the portal implementation; the other implementations ignore it.
+
+// The pathFormat field of the argument structs below selects what the dialog returns.
+enum {
+    // Filesystem paths (the default).
+    NFD_PATH_FORMAT_PATH = 0,
+    // URIs (e.g. "file:///home/user/My%20File.txt"), exactly as the file chooser reports them.
+    // Only supported by the portal and GTK implementations; the others return NFD_ERROR.
+    NFD_PATH_FORMAT_URI = 1,
+};
+
 typedef struct {
     const nfdu8filteritem_t* filterList;
     nfdfiltersize_t filterCount;
     const nfdu8char_t* defaultPath;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdopendialogu8args_t;
 
 #ifdef _WIN32
@@ -130,6 +154,8 @@ typedef struct {
     nfdfiltersize_t filterCount;
     const nfdnchar_t* defaultPath;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdopendialognargs_t;
 #else
 typedef nfdopendialogu8args_t nfdopendialognargs_t;
@@ -141,6 +167,8 @@ typedef struct {
     const nfdu8char_t* defaultPath;
     const nfdu8char_t* defaultName;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdsavedialogu8args_t;
 
 #ifdef _WIN32
@@ -150,20 +178,48 @@ typedef struct {
     const nfdnchar_t* defaultPath;
     const nfdnchar_t* defaultName;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdsavedialognargs_t;
 #else
 typedef nfdsavedialogu8args_t nfdsavedialognargs_t;
 #endif  // _WIN32
 
+typedef struct {
+    const nfdu8char_t* const* fileNames;
+    nfdpathsetsize_t fileCount;
+    const nfdu8char_t* defaultPath;
+    nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
+} nfdsavedialogmultipleu8args_t;
+
+#ifdef _WIN32
+typedef struct {
+    const nfdnchar_t* const* fileNames;
+    nfdpathsetsize_t fileCount;
+    const nfdnchar_t* defaultPath;
+    nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
+} nfdsavedialogmultiplenargs_t;
+#else
+typedef nfdsavedialogmultipleu8args_t nfdsavedialogmultiplenargs_t;
+#endif  // _WIN32
+
 typedef struct {
     const nfdu8char_t* defaultPath;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdpickfolderu8args_t;
 
 #ifdef _WIN32
 typedef struct {
     const nfdnchar_t* defaultPath;
     nfdwindowhandle_t parentWindow;
+    unsigned int timeoutMs;  // 0 means no timeout
+    size_t pathFormat;       // one of the NFD_PATH_FORMAT_* values
 } nfdpickfoldernargs_t;
 #else
 typedef nfdpickfolderu8args_t nfdpickfoldernargs_t;
@@ -172,7 +228,7 @@ typedef nfdpickfolderu8args_t nfdpickfoldernargs_t;
 // This is a unique identifier tagged to all the NFD_*With() function calls, for backward
 // compatibility purposes.  There is usually no need to use this directly, unless you want to use
 // NFD differently depending on the version you're building with.
-#define NFD_INTERFACE_VERSION 1
+#define NFD_INTERFACE_VERSION 3
 
 /** Free a file path that was returned by the dialogs.
  *
@@ -191,11 +247,45 @@ NFD_API nfdresult_t NFD_Init(void);
 /** Call this to de-initialize NFD, if NFD_Init returned NFD_OKAY. */
 NFD_API void NFD_Quit(void);
 
+/** Processes work that NFD has deferred so that dialog functions can return sooner, and handles
+ *  the dialogs started by the NFD_GTK_Start*() functions. This never blocks for long, so it can be
+ *  called from your event loop. With GTK 3, it finishes a deferred teardown (when built with
+ *  NFD_GTK_DEFERRED_TEARDOWN) and then runs at most one pending iteration of the default GLib main
+ *  context, unless NFD is built with NFD_GTK_UI_THREAD (where the GTK thread runs its own main
+ *  loop and this does nothing). With GTK 4, it always runs one non-blocking iteration of the
+ *  default GLib main context. It does nothing with the other implementations. */
+NFD_API void NFD_PumpEvents(void);
+
 struct wl_display;
 /** Sets or updates the Wayland display used by your application. Use NULL to remove an existing
  * display. Only defined on Linux. */
 NFD_API nfdresult_t NFD_SetWaylandDisplay(struct wl_display*);
 
+struct wl_surface;
+/** Releases the resources that NFD keeps for a wl_surface that was used as a parent window. Once
+ * this has been called, NFD keeps the resources of parent windows after their dialogs are closed,
+ * so it must then be called before destroying any surface that was used as a parent window. Only
+ * defined on Linux. */
+NFD_API nfdresult_t NFD_ReleaseWaylandSurface(struct wl_surface*);
+
+#ifdef NFD_PORTAL
+/** Returns the number of messages that were not meant for NFD, but were dispatched by NFD while it
+ * was waiting for the portal since NFD_Init. Only defined with the portal implementation. */
+NFD_API size_t NFD_Portal_GetForeignMessageCount(void);
+#endif
+
+#if !defined(_WIN32) && !defined(__APPLE__) && !defined(NFD_PORTAL)
+/** Sets whether dialogs are kept hidden after they are closed, and reused by the next dialog of the
+ * same kind (disabled by default). A reused dialog that is opened without a default path starts in
+ * the folder that the previous dialog was in. Disabling it also destroys the dialogs that are kept.
+ * Only defined with the GTK implementation. */
+NFD_API void NFD_GTK_SetDialogPoolEnabled(int enabled);
+
+/** Destroys the dialogs that are kept for reuse, to free their memory. Only defined with the GTK
+ * implementation. */
+NFD_API void NFD_GTK_TrimDialogPool(void);
+#endif
+
 /** Single file open dialog
  *
  *  It's the caller's responsibility to free `outPath` via NFD_FreePathN() if this function returns
@@ -358,6 +448,70 @@ NFD_INLINE nfdresult_t NFD_SaveDialogU8_With(nfdu8char_t** outPath,
     return NFD_SaveDialogU8_With_Impl(NFD_INTERFACE_VERSION, outPath, args);
 }
 
+/** Multiple file save dialog
+ *
+ *  Asks the user for a single folder to save all the given files into.  On success, `outPaths`
+ *  contains the path of each file, in the same order as `fileNames`.  The portal may change the
+ *  names, e.g. to avoid overwriting existing files.  GTK does not check whether the files already
+ *  exist, so the returned paths may name existing files.  Currently only supported on Linux.
+ *  It is the caller's responsibility to free `outPaths` via NFD_PathSet_Free() if this function
+ *  returns NFD_OKAY.
+ *  @param[out] outPaths
+ *  @param fileNames The names of the files to save, which must not be empty.  Each name must not
+ *  be empty, "." or "..", and must not contain '/'; otherwise NFD_ERROR is returned.
+ *  @param defaultPath If null, the operating system will decide. */
+NFD_API nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                            const nfdnchar_t* const* fileNames,
+                                            nfdpathsetsize_t fileCount,
+                                            const nfdnchar_t* defaultPath);
+
+/** Multiple file save dialog
+ *
+ *  Asks the user for a single folder to save all the given files into.  On success, `outPaths`
+ *  contains the path of each file, in the same order as `fileNames`.  The portal may change the
+ *  names, e.g. to avoid overwriting existing files.  GTK does not check whether the files already
+ *  exist, so the returned paths may name existing files.  Currently only supported on Linux.
+ *  It is the caller's responsibility to free `outPaths` via NFD_PathSet_Free() if this function
+ *  returns NFD_OKAY.
+ *  @param[out] outPaths
+ *  @param fileNames The names of the files to save, which must not be empty.  Each name must not
+ *  be empty, "." or "..", and must not contain '/'; otherwise NFD_ERROR is returned.
+ *  @param defaultPath If null, the operating system will decide. */
+NFD_API nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                             const nfdu8char_t* const* fileNames,
+                                             nfdpathsetsize_t fileCount,
+                                             const nfdu8char_t* defaultPath);
+
+/** This function is a library implementation detail.  Please use NFD_SaveDialogMultipleN_With()
+ * instead. */
+NFD_API nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                                      const nfdpathset_t** outPaths,
+                                                      const nfdsavedialogmultiplenargs_t* args);
+
+/** Multiple file save dialog, with additional parameters.
+ *
+ *  It is the caller's responsibility to free `outPaths` via NFD_PathSet_Free() if this function
+ *  returns NFD_OKAY.  See documentation of nfdsavedialogmultiplenargs_t for details. */
+NFD_INLINE nfdresult_t NFD_SaveDialogMultipleN_With(const nfdpathset_t** outPaths,
+                                                    const nfdsavedialogmultiplenargs_t* args) {
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, args);
+}
+
+/** This function is a library implementation detail.  Please use NFD_SaveDialogMultipleU8_With()
+ * instead. */
+NFD_API nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                                       const nfdpathset_t** outPaths,
+                                                       const nfdsavedialogmultipleu8args_t* args);
+
+/** Multiple file save dialog, with additional parameters.
+ *
+ *  It is the caller's responsibility to free `outPaths` via NFD_PathSet_Free() if this function
+ *  returns NFD_OKAY.  See documentation of nfdsavedialogmultipleu8args_t for details. */
+NFD_INLINE nfdresult_t NFD_SaveDialogMultipleU8_With(const nfdpathset_t** outPaths,
+                                                     const nfdsavedialogmultipleu8args_t* args) {
+    return NFD_SaveDialogMultipleU8_With_Impl(NFD_INTERFACE_VERSION, outPaths, args);
+}
+
 /** Select single folder dialog
  *
  *  It is the caller's responsibility to free `outPath` via NFD_FreePathN() if this function returns
@@ -452,6 +606,142 @@ NFD_INLINE nfdresult_t NFD_PickFolderMultipleU8_With(const nfdpathset_t** outPat
     return NFD_PickFolderMultipleU8_With_Impl(NFD_INTERFACE_VERSION, outPaths, args);
 }
 
+#if !defined(_WIN32) && !defined(__APPLE__) && !defined(NFD_PORTAL)
+/* Dialog requests (only defined with the GTK implementation)
+ *
+ * The NFD_GTK_Start*() functions show the same dialog as the corresponding NFD_*N_With()
+ * function, but without waiting for the user, and give a request for its result in `outRequest`
+ * if they return NFD_OKAY.  The dialog is not modal, so any number of dialogs can be open at the
+ * same time.  Unless NFD is built with NFD_GTK_UI_THREAD (where the GTK thread does this), the
+ * dialogs are only handled while the default GLib main context is iterated, e.g. by the
+ * application's GTK main loop, by NFD_PumpEvents(), or by NFD_GTK_FinishRequest*().  `args` and
+ * everything it points to must stay valid until the request is done, which is when the user
+ * closes the dialog.  When it is done, `callback(userData)` is called if `callback` is not null
+ * (from the main loop that handles the dialog); the callback must not call any NFD function
+ * except NFD_GTK_IsRequestDone() and the NFD_GTK_FinishRequest*() functions.  Every request must
+ * be finished exactly once with NFD_GTK_FinishRequest() (for dialogs that return one path) or
+ * NFD_GTK_FinishRequestMultiple() (for dialogs that return a path set), before NFD_Quit(). */
+
+typedef void nfdgtkrequest_t;
+
+/** This function is a library implementation detail.  Please use NFD_GTK_StartOpenDialog()
+ * instead. */
+NFD_API nfdresult_t NFD_GTK_StartOpenDialog_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdopendialognargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData);
+
+/** Starts a single file open dialog.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartOpenDialog(nfdgtkrequest_t** outRequest,
+                                               const nfdopendialognargs_t* args,
+                                               void (*callback)(void*),
+                                               void* userData) {
+    return NFD_GTK_StartOpenDialog_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** This function is a library implementation detail.  Please use
+ * NFD_GTK_StartOpenDialogMultiple() instead. */
+NFD_API nfdresult_t NFD_GTK_StartOpenDialogMultiple_Impl(nfdversion_t version,
+                                                         nfdgtkrequest_t** outRequest,
+                                                         const nfdopendialognargs_t* args,
+                                                         void (*callback)(void*),
+                                                         void* userData);
+
+/** Starts a multiple file open dialog.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartOpenDialogMultiple(nfdgtkrequest_t** outRequest,
+                                                       const nfdopendialognargs_t* args,
+                                                       void (*callback)(void*),
+                                                       void* userData) {
+    return NFD_GTK_StartOpenDialogMultiple_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** This function is a library implementation detail.  Please use NFD_GTK_StartSaveDialog()
+ * instead. */
+NFD_API nfdresult_t NFD_GTK_StartSaveDialog_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdsavedialognargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData);
+
+/** Starts a save dialog.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartSaveDialog(nfdgtkrequest_t** outRequest,
+                                               const nfdsavedialognargs_t* args,
+                                               void (*callback)(void*),
+                                               void* userData) {
+    return NFD_GTK_StartSaveDialog_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** This function is a library implementation detail.  Please use
+ * NFD_GTK_StartSaveDialogMultiple() instead. */
+NFD_API nfdresult_t NFD_GTK_StartSaveDialogMultiple_Impl(nfdversion_t version,
+                                                         nfdgtkrequest_t** outRequest,
+                                                         const nfdsavedialogmultiplenargs_t* args,
+                                                         void (*callback)(void*),
+                                                         void* userData);
+
+/** Starts a dialog for saving multiple files.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartSaveDialogMultiple(nfdgtkrequest_t** outRequest,
+                                                       const nfdsavedialogmultiplenargs_t* args,
+                                                       void (*callback)(void*),
+                                                       void* userData) {
+    return NFD_GTK_StartSaveDialogMultiple_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** This function is a library implementation detail.  Please use NFD_GTK_StartPickFolder()
+ * instead. */
+NFD_API nfdresult_t NFD_GTK_StartPickFolder_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdpickfoldernargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData);
+
+/** Starts a select folder dialog.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartPickFolder(nfdgtkrequest_t** outRequest,
+                                               const nfdpickfoldernargs_t* args,
+                                               void (*callback)(void*),
+                                               void* userData) {
+    return NFD_GTK_StartPickFolder_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** This function is a library implementation detail.  Please use
+ * NFD_GTK_StartPickFolderMultiple() instead. */
+NFD_API nfdresult_t NFD_GTK_StartPickFolderMultiple_Impl(nfdversion_t version,
+                                                         nfdgtkrequest_t** outRequest,
+                                                         const nfdpickfoldernargs_t* args,
+                                                         void (*callback)(void*),
+                                                         void* userData);
+
+/** Starts a select multiple folders dialog.  See "Dialog requests" above. */
+NFD_INLINE nfdresult_t NFD_GTK_StartPickFolderMultiple(nfdgtkrequest_t** outRequest,
+                                                       const nfdpickfoldernargs_t* args,
+                                                       void (*callback)(void*),
+                                                       void* userData) {
+    return NFD_GTK_StartPickFolderMultiple_Impl(
+        NFD_INTERFACE_VERSION, outRequest, args, callback, userData);
+}
+
+/** Returns nonzero if the request is done, i.e. NFD_GTK_FinishRequest() or
+ * NFD_GTK_FinishRequestMultiple() will not wait. */
+NFD_API int NFD_GTK_IsRequestDone(const nfdgtkrequest_t* request);
+
+/** Waits for a request for a single path to be done (running the main loop if needed), and frees
+ * the request.  Returns the result of the dialog, in the same way as the corresponding
+ * NFD_*N_With() function. */
+NFD_API nfdresult_t NFD_GTK_FinishRequest(nfdgtkrequest_t* request, nfdnchar_t** outPath);
+
+/** Waits for a request for a path set to be done (running the main loop if needed), and frees the
+ * request.  Returns the result of the dialog, in the same way as the corresponding NFD_*N_With()
+ * function. */
+NFD_API nfdresult_t NFD_GTK_FinishRequestMultiple(nfdgtkrequest_t* request,
+                                                  const nfdpathset_t** outPaths);
+#endif
+
 /** Get the last error
  *
  *  This is set when a function returns NFD_ERROR.
@@ -465,13 +755,6 @@ NFD_API const char* NFD_GetError(void);
 NFD_API void NFD_ClearError(void);
 
 /* path set operations */
-#ifdef _WIN32
-typedef unsigned long nfdpathsetsize_t;
-#elif __APPLE__
-typedef unsigned long nfdpathsetsize_t;
-#else
-typedef unsigned int nfdpathsetsize_t;
-#endif  // _WIN32, __APPLE__
 
 /** Get the number of entries stored in pathSet.
  *
@@ -543,6 +826,7 @@ typedef nfdnfilteritem_t nfdfilteritem_t;
 #define NFD_OpenDialog NFD_OpenDialogN
 #define NFD_OpenDialogMultiple NFD_OpenDialogMultipleN
 #define NFD_SaveDialog NFD_SaveDialogN
+#define NFD_SaveDialogMultiple NFD_SaveDialogMultipleN
 #define NFD_PickFolder NFD_PickFolderN
 #define NFD_PickFolderMultiple NFD_PickFolderMultipleN
 #define NFD_PathSet_GetPath NFD_PathSet_GetPathN
@@ -555,6 +839,7 @@ typedef nfdu8filteritem_t nfdfilteritem_t;
 #define NFD_OpenDialog NFD_OpenDialogU8
 #define NFD_OpenDialogMultiple NFD_OpenDialogMultipleU8
 #define NFD_SaveDialog NFD_SaveDialogU8
+#define NFD_SaveDialogMultiple NFD_SaveDialogMultipleU8
 #define NFD_PickFolder NFD_PickFolderU8
 #define NFD_PickFolderMultiple NFD_PickFolderMultipleU8
 #define NFD_PathSet_GetPath NFD_PathSet_GetPathU8
@@ -30,6 +30,10 @@ inline void Quit() noexcept {
     ::NFD_Quit();
 }
 
+inline void PumpEvents() noexcept {
+    ::NFD_PumpEvents();
+}
+
 inline void FreePath(nfdnchar_t* outPath) noexcept {
     ::NFD_FreePathN(outPath);
 }
@@ -39,7 +43,8 @@ inline nfdresult_t OpenDialog(nfdnchar_t*& outPath,
                               nfdfiltersize_t filterCount = 0,
                               const nfdnchar_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdopendialognargs_t args{filterList, filterCount, defaultPath, parentWindow};
+    const nfdopendialognargs_t args{
+        filterList, filterCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_OpenDialogN_With(&outPath, &args);
 }
 
@@ -48,7 +53,8 @@ inline nfdresult_t OpenDialogMultiple(const nfdpathset_t*& outPaths,
                                       nfdfiltersize_t filterCount = 0,
                                       const nfdnchar_t* defaultPath = nullptr,
                                       nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdopendialognargs_t args{filterList, filterCount, defaultPath, parentWindow};
+    const nfdopendialognargs_t args{
+        filterList, filterCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_OpenDialogMultipleN_With(&outPaths, &args);
 }
 
@@ -59,21 +65,31 @@ inline nfdresult_t SaveDialog(nfdnchar_t*& outPath,
                               const nfdnchar_t* defaultName = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
     const nfdsavedialognargs_t args{
-        filterList, filterCount, defaultPath, defaultName, parentWindow};
+        filterList, filterCount, defaultPath, defaultName, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_SaveDialogN_With(&outPath, &args);
 }
 
+inline nfdresult_t SaveDialogMultiple(const nfdpathset_t*& outPaths,
+                                      const nfdnchar_t* const* fileNames,
+                                      nfdpathsetsize_t fileCount,
+                                      const nfdnchar_t* defaultPath = nullptr,
+                                      nfdwindowhandle_t parentWindow = {}) noexcept {
+    const nfdsavedialogmultiplenargs_t args{
+        fileNames, fileCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
+    return ::NFD_SaveDialogMultipleN_With(&outPaths, &args);
+}
+
 inline nfdresult_t PickFolder(nfdnchar_t*& outPath,
                               const nfdnchar_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdpickfoldernargs_t args{defaultPath, parentWindow};
+    const nfdpickfoldernargs_t args{defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_PickFolderN_With(&outPath, &args);
 }
 
 inline nfdresult_t PickFolderMultiple(const nfdpathset_t*& outPaths,
                                       const nfdnchar_t* defaultPath = nullptr,
                                       nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdpickfoldernargs_t args{defaultPath, parentWindow};
+    const nfdpickfoldernargs_t args{defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_PickFolderMultipleN_With(&outPaths, &args);
 }
 
@@ -118,7 +134,8 @@ inline nfdresult_t OpenDialog(nfdu8char_t*& outPath,
                               nfdfiltersize_t filterCount = 0,
                               const nfdu8char_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdopendialogu8args_t args{filterList, filterCount, defaultPath, parentWindow};
+    const nfdopendialogu8args_t args{
+        filterList, filterCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_OpenDialogU8_With(&outPath, &args);
 }
 
@@ -127,7 +144,8 @@ inline nfdresult_t OpenDialogMultiple(const nfdpathset_t*& outPaths,
                                       nfdfiltersize_t filterCount = 0,
                                       const nfdu8char_t* defaultPath = nullptr,
                                       nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdopendialogu8args_t args{filterList, filterCount, defaultPath, parentWindow};
+    const nfdopendialogu8args_t args{
+        filterList, filterCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_OpenDialogMultipleU8_With(&outPaths, &args);
 }
 
@@ -138,21 +156,31 @@ inline nfdresult_t SaveDialog(nfdu8char_t*& outPath,
                               const nfdu8char_t* defaultName = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
     const nfdsavedialogu8args_t args{
-        filterList, filterCount, defaultPath, defaultName, parentWindow};
+        filterList, filterCount, defaultPath, defaultName, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_SaveDialogU8_With(&outPath, &args);
 }
 
+inline nfdresult_t SaveDialogMultiple(const nfdpathset_t*& outPaths,
+                                      const nfdu8char_t* const* fileNames,
+                                      nfdpathsetsize_t fileCount,
+                                      const nfdu8char_t* defaultPath = nullptr,
+                                      nfdwindowhandle_t parentWindow = {}) noexcept {
+    const nfdsavedialogmultipleu8args_t args{
+        fileNames, fileCount, defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
+    return ::NFD_SaveDialogMultipleU8_With(&outPaths, &args);
+}
+
 inline nfdresult_t PickFolder(nfdu8char_t*& outPath,
                               const nfdu8char_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdpickfolderu8args_t args{defaultPath, parentWindow};
+    const nfdpickfolderu8args_t args{defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_PickFolderU8_With(&outPath, &args);
 }
 
 inline nfdresult_t PickFolderMultiple(const nfdpathset_t*& outPaths,
                                       const nfdu8char_t* defaultPath = nullptr,
                                       nfdwindowhandle_t parentWindow = {}) noexcept {
-    const nfdpickfolderu8args_t args{defaultPath, parentWindow};
+    const nfdpickfolderu8args_t args{defaultPath, parentWindow, 0, NFD_PATH_FORMAT_PATH};
     return ::NFD_PickFolderMultipleU8_With(&outPaths, &args);
 }
 
@@ -255,6 +283,19 @@ inline nfdresult_t SaveDialog(UniquePathN& outPath,
     return res;
 }
 
+inline nfdresult_t SaveDialogMultiple(UniquePathSet& outPaths,
+                                      const nfdnchar_t* const* fileNames,
+                                      nfdpathsetsize_t fileCount,
+                                      const nfdnchar_t* defaultPath = nullptr,
+                                      nfdwindowhandle_t parentWindow = {}) noexcept {
+    const nfdpathset_t* out;
+    nfdresult_t res = SaveDialogMultiple(out, fileNames, fileCount, defaultPath, parentWindow);
+    if (res == NFD_OKAY) {
+        outPaths.reset(out);
+    }
+    return res;
+}
+
 inline nfdresult_t PickFolder(UniquePathN& outPath,
                               const nfdnchar_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
@@ -319,6 +360,19 @@ inline nfdresult_t SaveDialog(UniquePathU8& outPath,
     return res;
 }
 
+inline nfdresult_t SaveDialogMultiple(UniquePathSet& outPaths,
+                                      const nfdu8char_t* const* fileNames,
+                                      nfdpathsetsize_t fileCount,
+                                      const nfdu8char_t* defaultPath = nullptr,
+                                      nfdwindowhandle_t parentWindow = {}) noexcept {
+    const nfdpathset_t* out;
+    nfdresult_t res = SaveDialogMultiple(out, fileNames, fileCount, defaultPath, parentWindow);
+    if (res == NFD_OKAY) {
+        outPaths.reset(out);
+    }
+    return res;
+}
+
 inline nfdresult_t PickFolder(UniquePathU8& outPath,
                               const nfdu8char_t* defaultPath = nullptr,
                               nfdwindowhandle_t parentWindow = {}) noexcept {
@@ -181,6 +181,17 @@ static NSWindow* GetNativeWindowHandle(const nfdwindowhandle_t* parentWindow) {
     return (NSWindow*)parentWindow->handle;
 }
 
+// Only NFD_PATH_FORMAT_PATH is supported here, so this returns NFD_ERROR (and sets the error) for
+// anything else.  pathFormat was added in version 3 of the interface, so only call this if the
+// caller of the *_With() function passed a version of at least 3.
+static nfdresult_t CheckPathFormat(size_t pathFormat) {
+    if (pathFormat != NFD_PATH_FORMAT_PATH) {
+        NFDi_SetError("Returning URIs is not supported on macOS.");
+        return NFD_ERROR;
+    }
+    return NFD_OKAY;
+}
+
 /* public */
 
 const char* NFD_GetError(void) {
@@ -218,6 +229,10 @@ void NFD_Quit(void) {
     [[NSApplication sharedApplication] setActivationPolicy:old_app_policy];
 }
 
+void NFD_PumpEvents(void) {
+    // nothing is deferred here
+}
+
 nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
                             const nfdnfilteritem_t* filterList,
                             nfdfiltersize_t filterCount,
@@ -232,8 +247,9 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (version >= 3 && CheckPathFormat(args->pathFormat) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
 
     nfdresult_t result = NFD_CANCEL;
     @autoreleasepool {
@@ -292,8 +308,9 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
 nfdresult_t NFD_OpenDialogMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (version >= 3 && CheckPathFormat(args->pathFormat) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
 
     nfdresult_t result = NFD_CANCEL;
     @autoreleasepool {
@@ -359,8 +376,9 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdsavedialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (version >= 3 && CheckPathFormat(args->pathFormat) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
 
     nfdresult_t result = NFD_CANCEL;
     @autoreleasepool {
@@ -412,6 +430,40 @@ nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
     return NFD_SaveDialogN_With_Impl(version, outPath, args);
 }
 
+nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnchar_t* const* fileNames,
+                                    nfdpathsetsize_t fileCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdsavedialogmultiplenargs_t args = {0};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdsavedialogmultiplenargs_t* args) {
+    (void)version;
+    (void)outPaths;
+    (void)args;
+    NFDi_SetError("Saving multiple files is not supported on macOS.");
+    return NFD_ERROR;
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8char_t* const* fileNames,
+                                     nfdpathsetsize_t fileCount,
+                                     const nfdu8char_t* defaultPath) {
+    return NFD_SaveDialogMultipleN(outPaths, fileNames, fileCount, defaultPath);
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdsavedialogmultipleu8args_t* args) {
+    return NFD_SaveDialogMultipleN_With_Impl(version, outPaths, args);
+}
+
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
     nfdpickfoldernargs_t args = {0};
     args.defaultPath = defaultPath;
@@ -421,8 +473,9 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
 nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (version >= 3 && CheckPathFormat(args->pathFormat) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
 
     nfdresult_t result = NFD_CANCEL;
     @autoreleasepool {
@@ -473,8 +526,9 @@ nfdresult_t NFD_PickFolderMultipleN(const nfdpathset_t** outPaths, const nfdncha
 nfdresult_t NFD_PickFolderMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (version >= 3 && CheckPathFormat(args->pathFormat) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
 
     nfdresult_t result = NFD_CANCEL;
     @autoreleasepool {
@@ -0,0 +1,144 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+  Authors: Bernard Teo
+
+  This is the file extension matching of the GTK implementation, in its own header so that it can
+  be tested without GTK.  It must be included after nfd_linux_shared.hpp.
+*/
+
+#include <string.h>
+
+namespace {
+
+// The set of plain file extensions of a filter, matched against file names by
+// MatchExtensionTable instead of by one glob per extension (GTK's glob matching is slow, especially
+// for the case-insensitive bracket globs).  It lives in a single allocation: this struct, then the
+// open-addressing slots, and then the (case-folded) characters of the extensions.
+struct ExtensionTable {
+    size_t mask;       // number of slots - 1
+    size_t maxLength;  // length of the longest extension
+};
+
+struct ExtensionTableSlot {
+    size_t hash;
+    const nfdnchar_t* begin;  // null if the slot is empty
+    size_t length;
+};
+
+constexpr size_t EXTENSION_HASH_BASIS = static_cast<size_t>(14695981039346656037ULL);
+constexpr size_t EXTENSION_HASH_PRIME = static_cast<size_t>(1099511628211ULL);
+
+nfdnchar_t FoldExtensionChar(nfdnchar_t c) {
+#ifdef NFD_CASE_SENSITIVE_FILTER
+    return c;
+#else
+    // only regular Latin characters are case-insensitive, as in emit_case_insensitive_glob
+    return (c >= 'A' && c <= 'Z') ? static_cast<nfdnchar_t>(c ^ 0x20) : c;
+#endif
+}
+
+// Extensions are hashed from the last character to the first, so that the hashes of all the
+// suffixes of a file name are computed in one pass.
+size_t HashExtension(const nfdnchar_t* begin, const nfdnchar_t* end) {
+    size_t hash = EXTENSION_HASH_BASIS;
+    while (end != begin) {
+        hash = (hash ^ static_cast<unsigned char>(FoldExtensionChar(*--end))) *
+               EXTENSION_HASH_PRIME;
+    }
+    return hash;
+}
+
+// Returns true if the filter spec item [begin, end) is a plain file extension, which can be put
+// in an ExtensionTable (i.e. it is neither a MIME type nor contains glob characters).
+bool IsPlainExtensionItem(const nfdnchar_t* begin, const nfdnchar_t* end) {
+    for (; begin != end; ++begin) {
+        if (*begin == '/' || *begin == '*' || *begin == '?' || *begin == '[') return false;
+    }
+    return true;
+}
+
+bool ExtensionTableContains(const ExtensionTable* table,
+                            size_t hash,
+                            const nfdnchar_t* begin,
+                            size_t length) {
+    const ExtensionTableSlot* slots = reinterpret_cast<const ExtensionTableSlot*>(table + 1);
+    for (size_t i = hash & table->mask; slots[i].begin; i = (i + 1) & table->mask) {
+        if (slots[i].hash != hash || slots[i].length != length) continue;
+        size_t k = 0;
+        while (k != length && FoldExtensionChar(begin[k]) == slots[i].begin[k]) ++k;
+        if (k == length) return true;
+    }
+    return false;
+}
+
+// Builds the table for the plain file extensions in spec, or returns nullptr if there are none.
+ExtensionTable* BuildExtensionTable(const nfdnchar_t* spec) {
+    size_t count = 0;
+    size_t chars = 0;
+    for (const nfdnchar_t *p_extensionStart = spec, *p_spec = spec; true; ++p_spec) {
+        if (*p_spec == ',' || !*p_spec) {
+            if (IsPlainExtensionItem(p_extensionStart, p_spec)) {
+                ++count;
+                chars += p_spec - p_extensionStart;
+            }
+            if (!*p_spec) break;
+            p_extensionStart = p_spec + 1;
+        }
+    }
+    if (!count) return nullptr;
+
+    // keep the load factor at most 1/2
+    size_t slotCount = 2;
+    while (slotCount < count * 2) slotCount *= 2;
+    char* arena = NFDi_Malloc<char>(sizeof(ExtensionTable) +
+                                    sizeof(ExtensionTableSlot) * slotCount +
+                                    sizeof(nfdnchar_t) * chars);
+    ExtensionTable* table = reinterpret_cast<ExtensionTable*>(arena);
+    ExtensionTableSlot* slots = reinterpret_cast<ExtensionTableSlot*>(table + 1);
+    nfdnchar_t* p_chars = reinterpret_cast<nfdnchar_t*>(slots + slotCount);
+    table->mask = slotCount - 1;
+    table->maxLength = 0;
+    for (size_t i = 0; i != slotCount; ++i) slots[i].begin = nullptr;
+
+    for (const nfdnchar_t *p_extensionStart = spec, *p_spec = spec; true; ++p_spec) {
+        if (*p_spec == ',' || !*p_spec) {
+            const size_t length = p_spec - p_extensionStart;
+            const size_t hash = HashExtension(p_extensionStart, p_spec);
+            if (IsPlainExtensionItem(p_extensionStart, p_spec) &&
+                !ExtensionTableContains(table, hash, p_extensionStart, length)) {
+                size_t i = hash & table->mask;
+                while (slots[i].begin) i = (i + 1) & table->mask;
+                slots[i].hash = hash;
+                slots[i].begin = p_chars;
+                slots[i].length = length;
+                for (const nfdnchar_t* p = p_extensionStart; p != p_spec; ++p) {
+                    *p_chars++ = FoldExtensionChar(*p);
+                }
+                if (length > table->maxLength) table->maxLength = length;
+            }
+            if (!*p_spec) break;
+            p_extensionStart = p_spec + 1;
+        }
+    }
+    return table;
+}
+
+// Returns true if the file name ends with '.' followed by an extension in the table, like the
+// "*.ext" globs would match.
+bool ExtensionTableMatches(const ExtensionTable* table, const char* name) {
+    // walk backwards from the end of the name, looking up the suffix after every '.'
+    const char* p = name + strlen(name);
+    size_t hash = EXTENSION_HASH_BASIS;
+    size_t length = 0;
+    while (p != name && length <= table->maxLength) {
+        const char c = *--p;
+        if (c == '.' && ExtensionTableContains(table, hash, p + 1, length)) return true;
+        hash = (hash ^ static_cast<unsigned char>(FoldExtensionChar(c))) * EXTENSION_HASH_PRIME;
+        ++length;
+    }
+    return false;
+}
+
+}  // namespace
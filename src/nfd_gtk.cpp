@@ -41,9 +41,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(NFD_GTK_UI_THREAD) || defined(NFD_GTK_PREFETCH)
+#include <pthread.h>
+#endif
+#if defined(NFD_GTK_PREFETCH)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 #include "nfd.h"
 
 #include "nfd_linux_shared.hpp"
+#include "nfd_extension_table.hpp"
 
 /*
 Define NFD_CASE_SENSITIVE_FILTER if you want file filters to be case-sensitive.  The default
@@ -55,12 +68,20 @@ filters to be case-insensitive.
 namespace {
 
 /* current error */
-const char* g_errorstr = nullptr;
+thread_local const char* g_errorstr = nullptr;
 
 void NFDi_SetError(const char* msg) {
     g_errorstr = msg;
 }
 
+#if defined(NFD_GTK_UI_THREAD) || defined(NFD_GTK_PREFETCH)
+struct Mutex_Guard {
+    pthread_mutex_t* data;
+    Mutex_Guard(pthread_mutex_t* mutex) noexcept : data(mutex) { pthread_mutex_lock(data); }
+    ~Mutex_Guard() { pthread_mutex_unlock(data); }
+};
+#endif
+
 // Does not own the filter and extension.
 struct Pair_GtkFileFilter_FileExtension {
     GtkFileFilter* filter;
@@ -69,237 +90,412 @@ struct Pair_GtkFileFilter_FileExtension {
 };
 
 struct ButtonClickedArgs {
-    Pair_GtkFileFilter_FileExtension* map;
+    const Pair_GtkFileFilter_FileExtension* map;
     GtkFileChooser* chooser;
 };
 
-void AddFiltersToDialog(GtkFileChooser* chooser,
-                        const nfdnfilteritem_t* filterList,
-                        nfdfiltersize_t filterCount) {
-    if (filterCount) {
-        assert(filterList);
-
-        // we have filters to add ... format and add them
+// A filter list that has been turned into GtkFileFilters.  It lives in a single allocation: this
+// struct, then the map (with a trailing entry whose .filter is null), then a copy of the filter
+// list ("name\0spec\0" for each item), which the map and the cache lookup point into, and then a
+// buffer for building the names and patterns.
+struct CompiledFilterList {
+    size_t hash;
+    nfdfiltersize_t filterCount;
+    size_t keyLength;  // number of characters in key
+    const nfdnchar_t* key;
+    Pair_GtkFileFilter_FileExtension* map;
+    GtkFileFilter* allFilesFilter;
+    size_t useCount;  // number of dialogs that use it
+    bool evicted;     // whether it has been removed from the cache (and is freed when unused)
+};
 
-        for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
-            GtkFileFilter* filter = gtk_file_filter_new();
+constexpr size_t FILTER_CACHE_SIZE = 8;
+/* compiled filter lists, most recently used first; their filters hold a reference each, so that
+ * they can be added to any number of dialogs */
+CompiledFilterList* filter_cache[FILTER_CACHE_SIZE];
+size_t filter_cache_count;
+
+// Adds the string to the FNV-1a hash, including the '\0', so that the boundary between strings is
+// hashed too.  Adds the number of characters hashed to `length`.
+void HashFilterString(const nfdnchar_t* str, size_t& hash, size_t& length) {
+    do {
+        hash = (hash ^ static_cast<unsigned char>(*str)) * static_cast<size_t>(1099511628211ULL);
+        ++length;
+    } while (*str++);
+}
 
-            // count number of file extensions
-            size_t sep = 1;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
-                if (*p_spec == ',') {
-                    ++sep;
-                }
-            }
+// Hashes the contents of the filter list, and gets the length of its copy in a
+// CompiledFilterList.
+size_t HashFilterList(const nfdnfilteritem_t* filterList,
+                      nfdfiltersize_t filterCount,
+                      size_t& outKeyLength) {
+    size_t hash = static_cast<size_t>(14695981039346656037ULL);
+    size_t length = 0;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        HashFilterString(filterList[index].name, hash, length);
+        HashFilterString(filterList[index].spec, hash, length);
+    }
+    outKeyLength = length;
+    return hash;
+}
 
-            // friendly name conversions: "png,jpg" -> "Image files
-            // (png, jpg)"
+// Compares the string (including its '\0') with the characters at p_key, advancing p_key past
+// them if they are equal.
+bool MatchFilterString(const nfdnchar_t*& p_key, const nfdnchar_t* str) {
+    do {
+        if (*p_key++ != *str) return false;
+    } while (*str++);
+    return true;
+}
 
-            // calculate space needed (including the trailing '\0')
-            size_t nameSize =
-                sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+bool FilterListEquals(const CompiledFilterList* compiled,
+                      const nfdnfilteritem_t* filterList,
+                      nfdfiltersize_t filterCount) {
+    if (compiled->filterCount != filterCount) return false;
+    const nfdnchar_t* p_key = compiled->key;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        if (!MatchFilterString(p_key, filterList[index].name) ||
+            !MatchFilterString(p_key, filterList[index].spec)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            // malloc the required memory
-            nfdnchar_t* nameBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * nameSize);
+void FreeExtensionTable(gpointer data) {
+    NFDi_Free(static_cast<ExtensionTable*>(data));
+}
 
-            nfdnchar_t* p_nameBuf = nameBuf;
-            for (const nfdnchar_t* p_filterName = filterList[index].name; *p_filterName;
-                 ++p_filterName) {
-                *p_nameBuf++ = *p_filterName;
-            }
-            *p_nameBuf++ = ' ';
-            *p_nameBuf++ = '(';
-            const nfdnchar_t* p_extensionStart = filterList[index].spec;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; true; ++p_spec) {
-                if (*p_spec == ',' || !*p_spec) {
-                    if (*p_spec == ',') {
-                        *p_nameBuf++ = ',';
-                        *p_nameBuf++ = ' ';
-                    }
+// GtkFileFilterFunc that matches the file names that end with '.' followed by an extension in the
+// table, like the "*.ext" globs would.
+gboolean MatchExtensionTable(const GtkFileFilterInfo* filter_info, gpointer data) {
+    const char* name = filter_info->display_name;
+    return name && ExtensionTableMatches(static_cast<const ExtensionTable*>(data), name);
+}
 
+// Adds the filter spec item [begin, end) to the filter, using buf (which must have space for
+// (end - begin) * 4 + 3 characters) to build the pattern.  Plain file extensions are skipped,
+// because they are matched by the filter's ExtensionTable.  Returns true if it is a file extension,
+// or false if it is a MIME type.
+bool AddFilterSpecItem(GtkFileFilter* filter,
+                       const nfdnchar_t* begin,
+                       const nfdnchar_t* end,
+                       nfdnchar_t* buf) {
+    if (IsMimeTypeFilterItem(begin, end)) {
+        *copy(begin, end, buf) = '\0';
+        gtk_file_filter_add_mime_type(filter, buf);
+        return false;
+    }
+    if (IsPlainExtensionItem(begin, end)) return true;
+    nfdnchar_t* p_bufEnd = buf;
+    *p_bufEnd++ = '*';
+    *p_bufEnd++ = '.';
 #ifdef NFD_CASE_SENSITIVE_FILTER
-                    // +1 for the trailing '\0'
-                    nfdnchar_t* extnBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) *
-                                                                  (p_spec - p_extensionStart + 3));
-                    nfdnchar_t* p_extnBufEnd = extnBuf;
-                    *p_extnBufEnd++ = '*';
-                    *p_extnBufEnd++ = '.';
-                    p_extnBufEnd = copy(p_extensionStart, p_spec, p_extnBufEnd);
-                    *p_extnBufEnd++ = '\0';
-                    gtk_file_filter_add_pattern(filter, extnBuf);
-                    NFDi_Free(extnBuf);
+    p_bufEnd = copy(begin, end, p_bufEnd);
 #else
-                    // Each character in the Latin alphabet is converted into 4 characters.  E.g.
-                    // 'a' is converted into "[Aa]".  Other characters are preserved.  Then we +1
-                    // for the trailing '\0'.
-                    nfdnchar_t* extnBuf = NFDi_Malloc<nfdnchar_t>(
-                        sizeof(nfdnchar_t) * ((p_spec - p_extensionStart) * 4 + 3));
-                    nfdnchar_t* p_extnBufEnd = extnBuf;
-                    *p_extnBufEnd++ = '*';
-                    *p_extnBufEnd++ = '.';
-                    p_extnBufEnd =
-                        emit_case_insensitive_glob(p_extensionStart, p_spec, p_extnBufEnd);
-                    *p_extnBufEnd++ = '\0';
-                    gtk_file_filter_add_pattern(filter, extnBuf);
-                    NFDi_Free(extnBuf);
+    // Each character in the Latin alphabet is converted into 4 characters.  E.g. 'a' is converted
+    // into "[Aa]".  Other characters are preserved.
+    p_bufEnd = emit_case_insensitive_glob(begin, end, p_bufEnd);
 #endif
+    *p_bufEnd++ = '\0';
+    gtk_file_filter_add_pattern(filter, buf);
+    return true;
+}
 
-                    if (*p_spec) {
-                        // update the extension start point
-                        p_extensionStart = p_spec + 1;
-                    } else {
-                        // reached the '\0' character
-                        break;
-                    }
-                } else {
-                    *p_nameBuf++ = *p_spec;
-                }
+CompiledFilterList* CompileFilterList(const nfdnfilteritem_t* filterList,
+                                      nfdfiltersize_t filterCount,
+                                      size_t hash,
+                                      size_t keyLength) {
+    // the buffer for building the names and patterns must fit the longest of them
+    size_t bufLength = 0;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        size_t sep = 1;
+        size_t itemLength = 0;
+        size_t maxItemLength = 0;
+        for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
+            if (*p_spec == ',') {
+                ++sep;
+                itemLength = 0;
+            } else if (++itemLength > maxItemLength) {
+                maxItemLength = itemLength;
             }
-            *p_nameBuf++ = ')';
-            *p_nameBuf++ = '\0';
-            assert((size_t)(p_nameBuf - nameBuf) == sizeof(nfdnchar_t) * nameSize);
+        }
+        // friendly name conversions: "png,jpg" -> "Image files (png, jpg)" (including the
+        // trailing '\0')
+        const size_t nameSize =
+            sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+        if (nameSize > bufLength) bufLength = nameSize;
+        if (maxItemLength * 4 + 3 > bufLength) bufLength = maxItemLength * 4 + 3;
+    }
+
+    const size_t mapSize = sizeof(Pair_GtkFileFilter_FileExtension) * (filterCount + 1);
+    char* arena = NFDi_Malloc<char>(sizeof(CompiledFilterList) + mapSize +
+                                    sizeof(nfdnchar_t) * (keyLength + bufLength));
+    CompiledFilterList* compiled = reinterpret_cast<CompiledFilterList*>(arena);
+    Pair_GtkFileFilter_FileExtension* map =
+        reinterpret_cast<Pair_GtkFileFilter_FileExtension*>(arena + sizeof(CompiledFilterList));
+    nfdnchar_t* key =
+        reinterpret_cast<nfdnchar_t*>(arena + sizeof(CompiledFilterList) + mapSize);
+    nfdnchar_t* buf = key + keyLength;
+
+    compiled->hash = hash;
+    compiled->filterCount = filterCount;
+    compiled->keyLength = keyLength;
+    compiled->key = key;
+    compiled->map = map;
+    compiled->useCount = 0;
+    compiled->evicted = false;
+
+    nfdnchar_t* p_key = key;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        const nfdnchar_t* name = filterList[index].name;
+        p_key = copy(name, name + strlen(name) + 1, p_key);
+        const nfdnchar_t* spec = p_key;
+        p_key = copy(filterList[index].spec,
+                     filterList[index].spec + strlen(filterList[index].spec) + 1,
+                     p_key);
+
+        GtkFileFilter* filter = gtk_file_filter_new();
+        g_object_ref_sink(filter);
+
+        // store filter in map
+        map[index].filter = filter;
+        map[index].extensionBegin = nullptr;
+        map[index].extensionEnd = nullptr;
+
+        const nfdnchar_t* p_extensionStart = spec;
+        for (const nfdnchar_t* p_spec = spec; true; ++p_spec) {
+            if (*p_spec == ',' || !*p_spec) {
+                // store the first extension in the map (MIME types have no extension to append to
+                // the file name)
+                if (AddFilterSpecItem(filter, p_extensionStart, p_spec, buf) &&
+                    map[index].extensionEnd == nullptr) {
+                    map[index].extensionBegin = p_extensionStart;
+                    map[index].extensionEnd = p_spec;
+                }
 
-            // add to the filter
-            gtk_file_filter_set_name(filter, nameBuf);
+                if (!*p_spec) break;  // reached the '\0' character
+                // update the extension start point
+                p_extensionStart = p_spec + 1;
+            }
+        }
 
-            // free the memory
-            NFDi_Free(nameBuf);
+        ExtensionTable* table = BuildExtensionTable(spec);
+        if (table) {
+            gtk_file_filter_add_custom(filter,
+                                       GTK_FILE_FILTER_DISPLAY_NAME,
+                                       &MatchExtensionTable,
+                                       table,
+                                       &FreeExtensionTable);
+        }
 
-            // add filter to chooser
-            gtk_file_chooser_add_filter(chooser, filter);
+        nfdnchar_t* p_nameBuf = copy(name, name + strlen(name), buf);
+        *p_nameBuf++ = ' ';
+        *p_nameBuf++ = '(';
+        for (const nfdnchar_t* p_spec = spec; *p_spec; ++p_spec) {
+            if (*p_spec == ',') {
+                *p_nameBuf++ = ',';
+                *p_nameBuf++ = ' ';
+            } else {
+                *p_nameBuf++ = *p_spec;
+            }
         }
+        *p_nameBuf++ = ')';
+        *p_nameBuf++ = '\0';
+        assert(static_cast<size_t>(p_nameBuf - buf) <= bufLength);
+
+        gtk_file_filter_set_name(filter, buf);
     }
+    assert(static_cast<size_t>(p_key - key) == keyLength);
+    // set trailing map index to null
+    map[filterCount].filter = nullptr;
 
     /* always append a wildcard option to the end*/
+    compiled->allFilesFilter = gtk_file_filter_new();
+    g_object_ref_sink(compiled->allFilesFilter);
+    gtk_file_filter_set_name(compiled->allFilesFilter, "All files");
+    gtk_file_filter_add_pattern(compiled->allFilesFilter, "*");
 
-    GtkFileFilter* filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "All files");
-    gtk_file_filter_add_pattern(filter, "*");
-    gtk_file_chooser_add_filter(chooser, filter);
+    return compiled;
 }
 
-// returns null-terminated map (trailing .filter is null)
-Pair_GtkFileFilter_FileExtension* AddFiltersToDialogWithMap(GtkFileChooser* chooser,
-                                                            const nfdnfilteritem_t* filterList,
-                                                            nfdfiltersize_t filterCount) {
-    Pair_GtkFileFilter_FileExtension* map = NFDi_Malloc<Pair_GtkFileFilter_FileExtension>(
-        sizeof(Pair_GtkFileFilter_FileExtension) * (filterCount + 1));
-
-    if (filterCount) {
-        assert(filterList);
+void FreeCompiledFilterList(CompiledFilterList* compiled) {
+    for (nfdfiltersize_t index = 0; index != compiled->filterCount; ++index) {
+        g_object_unref(compiled->map[index].filter);
+    }
+    g_object_unref(compiled->allFilesFilter);
+    NFDi_Free(compiled);
+}
 
-        // we have filters to add ... format and add them
+// Removes the filter list from the cache, freeing it unless a dialog still uses it.
+void EvictCompiledFilterList(CompiledFilterList* compiled) {
+    if (compiled->useCount) {
+        compiled->evicted = true;
+    } else {
+        FreeCompiledFilterList(compiled);
+    }
+}
 
-        for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
-            GtkFileFilter* filter = gtk_file_filter_new();
+// Gives back a filter list that was returned by AddFiltersToDialog.
+void ReleaseCompiledFilterList(CompiledFilterList* compiled) {
+    if (--compiled->useCount == 0 && compiled->evicted) FreeCompiledFilterList(compiled);
+}
 
-            // store filter in map
-            map[index].filter = filter;
-            map[index].extensionBegin = filterList[index].spec;
-            map[index].extensionEnd = nullptr;
+void ClearFilterCache() {
+    for (size_t i = 0; i != filter_cache_count; ++i) {
+        EvictCompiledFilterList(filter_cache[i]);
+    }
+    filter_cache_count = 0;
+}
 
-            // count number of file extensions
-            size_t sep = 1;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
-                if (*p_spec == ',') {
-                    ++sep;
-                }
-            }
+// Gets the compiled form of the filter list, compiling it only if it is not in the cache.  The
+// result stays valid until another filter list is compiled, unless a dialog uses it.
+CompiledFilterList* GetCompiledFilterList(const nfdnfilteritem_t* filterList,
+                                          nfdfiltersize_t filterCount) {
+    if (filterCount) assert(filterList);
+
+    size_t keyLength;
+    const size_t hash = HashFilterList(filterList, filterCount, keyLength);
+    for (size_t i = 0; i != filter_cache_count; ++i) {
+        CompiledFilterList* compiled = filter_cache[i];
+        if (compiled->hash == hash && compiled->keyLength == keyLength &&
+            FilterListEquals(compiled, filterList, filterCount)) {
+            memmove(filter_cache + 1, filter_cache, sizeof(CompiledFilterList*) * i);
+            filter_cache[0] = compiled;
+            return compiled;
+        }
+    }
 
-            // friendly name conversions: "png,jpg" -> "Image files
-            // (png, jpg)"
+    if (filter_cache_count == FILTER_CACHE_SIZE) {
+        // evict the least recently used filter list
+        --filter_cache_count;
+        EvictCompiledFilterList(filter_cache[filter_cache_count]);
+    }
+    memmove(filter_cache + 1, filter_cache, sizeof(CompiledFilterList*) * filter_cache_count);
+    ++filter_cache_count;
+    filter_cache[0] = CompileFilterList(filterList, filterCount, hash, keyLength);
+    return filter_cache[0];
+}
 
-            // calculate space needed (including the trailing '\0')
-            size_t nameSize =
-                sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+// Adds the filters (and "All files") to the dialog.  Returns the compiled filter list, whose map
+// from filter to the extension to append stays valid until it is given back with
+// ReleaseCompiledFilterList.
+CompiledFilterList* AddFiltersToDialog(GtkFileChooser* chooser,
+                                       const nfdnfilteritem_t* filterList,
+                                       nfdfiltersize_t filterCount) {
+    CompiledFilterList* compiled = GetCompiledFilterList(filterList, filterCount);
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        gtk_file_chooser_add_filter(chooser, compiled->map[index].filter);
+    }
+    gtk_file_chooser_add_filter(chooser, compiled->allFilesFilter);
+    ++compiled->useCount;
+    return compiled;
+}
 
-            // malloc the required memory
-            nfdnchar_t* nameBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * nameSize);
+#if defined(NFD_GTK_PREFETCH)
+// With NFD_GTK_PREFETCH, a few worker threads sweep the default folder of a dialog (reading its
+// entries with getdents64 and calling statx on each of them) while GTK sets up the dialog, so that
+// the kernel's dentry and inode caches are warm by the time GIO enumerates the folder.  The sweep
+// is only a hint: errors are ignored, it stops after PREFETCH_MAX_ENTRIES entries or
+// PREFETCH_MAX_NSEC nanoseconds, and dialogs never wait for it.  At most one sweep runs at a time.
+
+constexpr int PREFETCH_THREAD_COUNT = 4;
+constexpr size_t PREFETCH_MAX_ENTRIES = 100000;
+constexpr long long PREFETCH_MAX_NSEC = 2000000000LL;
+constexpr size_t PREFETCH_BUFFER_SIZE = 32768;
+
+struct PrefetchSweep {
+    int dirfd;
+    pthread_mutex_t readMutex;  // serializes the getdents64 calls on dirfd
+    long long deadline;         // on CLOCK_MONOTONIC, in nanoseconds
+    size_t entryCount;          // accessed atomically
+    int threadCount;            // accessed atomically; the last thread to leave frees the sweep
+};
 
-            nfdnchar_t* p_nameBuf = nameBuf;
-            for (const nfdnchar_t* p_filterName = filterList[index].name; *p_filterName;
-                 ++p_filterName) {
-                *p_nameBuf++ = *p_filterName;
-            }
-            *p_nameBuf++ = ' ';
-            *p_nameBuf++ = '(';
-            const nfdnchar_t* p_extensionStart = filterList[index].spec;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; true; ++p_spec) {
-                if (*p_spec == ',' || !*p_spec) {
-                    if (*p_spec == ',') {
-                        *p_nameBuf++ = ',';
-                        *p_nameBuf++ = ' ';
-                    }
+/* whether a sweep is running (accessed atomically) */
+bool prefetch_running;
 
-#ifdef NFD_CASE_SENSITIVE_FILTER
-                    // +1 for the trailing '\0'
-                    nfdnchar_t* extnBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) *
-                                                                  (p_spec - p_extensionStart + 3));
-                    nfdnchar_t* p_extnBufEnd = extnBuf;
-                    *p_extnBufEnd++ = '*';
-                    *p_extnBufEnd++ = '.';
-                    p_extnBufEnd = copy(p_extensionStart, p_spec, p_extnBufEnd);
-                    *p_extnBufEnd++ = '\0';
-                    gtk_file_filter_add_pattern(filter, extnBuf);
-                    NFDi_Free(extnBuf);
-#else
-                    // Each character in the Latin alphabet is converted into 4 characters.  E.g.
-                    // 'a' is converted into "[Aa]".  Other characters are preserved.  Then we +1
-                    // for the trailing '\0'.
-                    nfdnchar_t* extnBuf = NFDi_Malloc<nfdnchar_t>(
-                        sizeof(nfdnchar_t) * ((p_spec - p_extensionStart) * 4 + 3));
-                    nfdnchar_t* p_extnBufEnd = extnBuf;
-                    *p_extnBufEnd++ = '*';
-                    *p_extnBufEnd++ = '.';
-                    p_extnBufEnd =
-                        emit_case_insensitive_glob(p_extensionStart, p_spec, p_extnBufEnd);
-                    *p_extnBufEnd++ = '\0';
-                    gtk_file_filter_add_pattern(filter, extnBuf);
-                    NFDi_Free(extnBuf);
-#endif
+long long PrefetchNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
 
-                    // store current pointer in map (if it's
-                    // the first one)
-                    if (map[index].extensionEnd == nullptr) {
-                        map[index].extensionEnd = p_spec;
-                    }
+// Called by each thread that was meant to take part in the sweep when it is done with it.
+void LeavePrefetchSweep(PrefetchSweep* sweep) {
+    if (__atomic_sub_fetch(&sweep->threadCount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    close(sweep->dirfd);
+    pthread_mutex_destroy(&sweep->readMutex);
+    NFDi_Free(sweep);
+    __atomic_store_n(&prefetch_running, false, __ATOMIC_RELEASE);
+}
 
-                    if (*p_spec) {
-                        // update the extension start point
-                        p_extensionStart = p_spec + 1;
-                    } else {
-                        // reached the '\0' character
-                        break;
-                    }
-                } else {
-                    *p_nameBuf++ = *p_spec;
-                }
+void* PrefetchThreadMain(void* context) {
+    PrefetchSweep* sweep = static_cast<PrefetchSweep*>(context);
+    char* buf = NFDi_Malloc<char>(PREFETCH_BUFFER_SIZE);
+    bool stop = false;
+    while (!stop) {
+        // each call gives the next batch of entries, so the threads split the folder between them
+        long length;
+        {
+            Mutex_Guard lock(&sweep->readMutex);
+            length = syscall(SYS_getdents64, sweep->dirfd, buf, PREFETCH_BUFFER_SIZE);
+        }
+        if (length <= 0) break;
+        for (long offset = 0; offset < length && !stop;) {
+            const struct dirent64* entry = reinterpret_cast<const struct dirent64*>(buf + offset);
+            offset += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
             }
-            *p_nameBuf++ = ')';
-            *p_nameBuf++ = '\0';
-            assert((size_t)(p_nameBuf - nameBuf) == sizeof(nfdnchar_t) * nameSize);
-
-            // add to the filter
-            gtk_file_filter_set_name(filter, nameBuf);
-
-            // free the memory
-            NFDi_Free(nameBuf);
-
-            // add filter to chooser
-            gtk_file_chooser_add_filter(chooser, filter);
+            struct statx stx;
+            statx(sweep->dirfd,
+                  name,
+                  AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  STATX_BASIC_STATS,
+                  &stx);
+            stop = __atomic_add_fetch(&sweep->entryCount, 1, __ATOMIC_RELAXED) >=
+                       PREFETCH_MAX_ENTRIES ||
+                   PrefetchNow() >= sweep->deadline;
         }
     }
-    // set trailing map index to null
-    map[filterCount].filter = nullptr;
+    NFDi_Free(buf);
+    LeavePrefetchSweep(sweep);
+    return nullptr;
+}
 
-    /* always append a wildcard option to the end*/
-    GtkFileFilter* filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "All files");
-    gtk_file_filter_add_pattern(filter, "*");
-    gtk_file_chooser_add_filter(chooser, filter);
+// Starts sweeping the folder on worker threads, unless a sweep is already running.
+void StartPrefetch(const char* folder) {
+    if (!folder || !*folder) return;
+    if (__atomic_exchange_n(&prefetch_running, true, __ATOMIC_ACQ_REL)) return;
+    const int dirfd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        __atomic_store_n(&prefetch_running, false, __ATOMIC_RELEASE);
+        return;
+    }
 
-    return map;
+    PrefetchSweep* sweep = NFDi_Malloc<PrefetchSweep>(sizeof(PrefetchSweep));
+    sweep->dirfd = dirfd;
+    pthread_mutex_init(&sweep->readMutex, nullptr);
+    sweep->deadline = PrefetchNow() + PREFETCH_MAX_NSEC;
+    sweep->entryCount = 0;
+    sweep->threadCount = PREFETCH_THREAD_COUNT;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int index = 0; index != PREFETCH_THREAD_COUNT; ++index) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, &PrefetchThreadMain, sweep) != 0) {
+            // leave on behalf of the threads that could not be started
+            for (; index != PREFETCH_THREAD_COUNT; ++index) LeavePrefetchSweep(sweep);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
 }
+#endif
 
 void SetDefaultPath(GtkFileChooser* chooser, const char* defaultPath) {
     if (!defaultPath || !*defaultPath) return;
@@ -322,13 +518,250 @@ void WaitForCleanup() {
     while (gtk_events_pending()) gtk_main_iteration();
 }
 
-struct Widget_Guard {
+// The kinds of dialogs that are pooled.  Dialogs of the same kind only differ in things that are
+// reset whenever the dialog is reused.
+enum DialogKind {
+    DIALOG_KIND_OPEN,
+    DIALOG_KIND_SAVE,
+    DIALOG_KIND_SELECT_FOLDER,
+    DIALOG_KIND_COUNT
+};
+
+/* hidden dialogs that are kept after use, so that the next dialog of the same kind does not need to
+ * build and realize a new GtkFileChooserDialog; they outlive NFD_Quit, because GTK cannot be
+ * de-initialized anyway */
+GtkWidget* dialog_pool[DIALOG_KIND_COUNT];
+/* whether dialogs are put into dialog_pool after use; off by default, because a reused dialog keeps
+ * the folder of the previous one and the pooled dialogs are kept until the process exits */
+bool dialog_pool_enabled = false;
+
+#if defined(NFD_GTK_DEFERRED_TEARDOWN)
+// With NFD_GTK_DEFERRED_TEARDOWN, Dialog_Guard only hides the dialog, and leaves the rest of the
+// teardown (processing the events and destroying the dialog) to the next dialog function,
+// NFD_PumpEvents or NFD_Quit, so that dialog functions return without waiting for it.
+
+/* whether Dialog_Guard has left work for FinishTeardown */
+bool teardown_pending;
+
+gboolean DestroyWidgetCallback(gpointer widget) {
+    gtk_widget_destroy(GTK_WIDGET(widget));
+    return G_SOURCE_REMOVE;
+}
+
+// Processes the work left by Dialog_Guard, if any.
+void FinishTeardown() {
+    if (teardown_pending) {
+        teardown_pending = false;
+        WaitForCleanup();
+    }
+}
+#endif
+
+GtkWidget* CreateDialog(DialogKind kind) {
+    switch (kind) {
+        case DIALOG_KIND_OPEN:
+            return gtk_file_chooser_dialog_new(nullptr,
+                                               nullptr,
+                                               GTK_FILE_CHOOSER_ACTION_OPEN,
+                                               "_Cancel",
+                                               GTK_RESPONSE_CANCEL,
+                                               "_Open",
+                                               GTK_RESPONSE_ACCEPT,
+                                               nullptr);
+        case DIALOG_KIND_SAVE: {
+            GtkWidget* widget = gtk_file_chooser_dialog_new(nullptr,
+                                                            nullptr,
+                                                            GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                            "_Cancel",
+                                                            GTK_RESPONSE_CANCEL,
+                                                            "_Save",
+                                                            GTK_RESPONSE_ACCEPT,
+                                                            nullptr);
+            // Prompt on overwrite
+            gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(widget), TRUE);
+            return widget;
+        }
+        default:
+            return gtk_file_chooser_dialog_new(nullptr,
+                                               nullptr,
+                                               GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+                                               "_Cancel",
+                                               GTK_RESPONSE_CANCEL,
+                                               "_Select",
+                                               GTK_RESPONSE_ACCEPT,
+                                               nullptr);
+    }
+}
+
+#if defined(NFD_GTK_PREWARM)
+// The first file chooser in a process is much slower than later ones, because it loads the icon
+// theme, connects the GVFS volume monitors, and reads the bookmarks to populate the places sidebar.
+// With NFD_GTK_PREWARM, NFD_Init builds a throwaway GtkFileChooserWidget in an offscreen window and
+// loads the icons that the chooser uses, one step per idle callback, so that the caches are warm
+// when the first real dialog is opened.  Opening a dialog cancels the steps that have not run yet.
+
+/* idle source that runs the next pre-warm step, or 0 if there is none */
+guint prewarm_source_id;
+/* the next pre-warm step to run */
+size_t prewarm_step;
+/* offscreen window that holds the throwaway file chooser */
+GtkWidget* prewarm_window;
+
+// Icons shown by the places sidebar and the file list.
+constexpr const char* prewarm_icon_names[] = {"folder",
+                                              "text-x-generic",
+                                              "user-home-symbolic",
+                                              "user-desktop-symbolic",
+                                              "folder-documents-symbolic",
+                                              "folder-download-symbolic",
+                                              "folder-music-symbolic",
+                                              "folder-pictures-symbolic",
+                                              "folder-videos-symbolic",
+                                              "document-open-recent-symbolic",
+                                              "starred-symbolic",
+                                              "drive-harddisk-symbolic",
+                                              "user-trash-symbolic",
+                                              "list-add-symbolic"};
+
+gboolean PrewarmStep(gpointer) {
+    constexpr size_t iconCount = sizeof(prewarm_icon_names) / sizeof(prewarm_icon_names[0]);
+    if (prewarm_step == 0) {
+        prewarm_window = gtk_offscreen_window_new();
+        gtk_container_add(GTK_CONTAINER(prewarm_window),
+                          gtk_file_chooser_widget_new(GTK_FILE_CHOOSER_ACTION_OPEN));
+    } else if (prewarm_step == 1) {
+        // realizing and mapping the chooser populates the places sidebar
+        gtk_widget_show_all(prewarm_window);
+    } else if (prewarm_step - 2 < iconCount) {
+        GdkPixbuf* pixbuf = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(),
+                                                     prewarm_icon_names[prewarm_step - 2],
+                                                     16,
+                                                     static_cast<GtkIconLookupFlags>(0),
+                                                     nullptr);
+        if (pixbuf) g_object_unref(pixbuf);
+    } else {
+        gtk_widget_destroy(prewarm_window);
+        prewarm_window = nullptr;
+        prewarm_source_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    ++prewarm_step;
+    return G_SOURCE_CONTINUE;
+}
+
+void StartPrewarm() {
+    // only warm up once per process, since the caches stay warm
+    static bool started = false;
+    if (started) return;
+    started = true;
+    prewarm_source_id = g_idle_add_full(G_PRIORITY_LOW, PrewarmStep, nullptr, nullptr);
+}
+
+void CancelPrewarm() {
+    if (prewarm_source_id) {
+        g_source_remove(prewarm_source_id);
+        prewarm_source_id = 0;
+    }
+    if (prewarm_window) {
+        gtk_widget_destroy(prewarm_window);
+        prewarm_window = nullptr;
+    }
+}
+#endif
+
+// Gets a dialog of the given kind, reusing the pooled one if there is one, and sets its title and
+// the label of its accept button.  Use Dialog_Guard to give it back.
+GtkWidget* AcquireDialog(DialogKind kind, const char* title, const char* acceptLabel) {
+#if defined(NFD_GTK_PREWARM)
+    // the dialog does the remaining work itself
+    CancelPrewarm();
+#endif
+#if defined(NFD_GTK_DEFERRED_TEARDOWN)
+    FinishTeardown();
+#endif
+    GtkWidget* widget = dialog_pool[kind];
+    if (widget) {
+        dialog_pool[kind] = nullptr;
+
+        // undo what the previous dialog function has set
+        GtkFileChooser* chooser = GTK_FILE_CHOOSER(widget);
+        GSList* filters = gtk_file_chooser_list_filters(chooser);
+        for (GSList* node = filters; node; node = node->next) {
+            gtk_file_chooser_remove_filter(chooser, GTK_FILE_FILTER(node->data));
+        }
+        g_slist_free(filters);
+        gtk_file_chooser_set_select_multiple(chooser, FALSE);
+        gtk_file_chooser_unselect_all(chooser);
+        if (kind == DIALOG_KIND_SAVE) gtk_file_chooser_set_current_name(chooser, "");
+    } else {
+        widget = CreateDialog(kind);
+    }
+
+    gtk_window_set_title(GTK_WINDOW(widget), title);
+    gtk_button_set_label(
+        GTK_BUTTON(gtk_dialog_get_widget_for_response(GTK_DIALOG(widget), GTK_RESPONSE_ACCEPT)),
+        acceptLabel);
+    return widget;
+}
+
+// Destroys the pooled dialogs.  Does not use GTK if there are none, so that it can be called before
+// GTK is initialized.
+void TrimDialogPool() {
+    bool destroyed = false;
+    for (GtkWidget*& widget : dialog_pool) {
+        if (widget) {
+            gtk_widget_destroy(widget);
+            widget = nullptr;
+            destroyed = true;
+        }
+    }
+    if (destroyed) WaitForCleanup();
+}
+
+// Hides a dialog that has been closed and puts it into the pool, or destroys it if the pool is
+// disabled or already has a dialog of this kind.  `parented` is whether NativeWindowParenter has
+// given it a transient parent.
+void ReleaseDialog(GtkWidget* widget, DialogKind kind, bool parented) {
+    gtk_widget_hide(widget);
+    if (dialog_pool_enabled && !dialog_pool[kind]) {
+        // The GdkWindow has the caller's window as its transient parent, so drop it; the next
+        // call realizes the dialog again.
+        if (parented) gtk_widget_unrealize(widget);
+        dialog_pool[kind] = widget;
+    } else {
+        gtk_widget_destroy(widget);
+    }
+}
+
+// This is an RAII class that gives the dialog back with ReleaseDialog when returning from a dialog
+// function.
+struct Dialog_Guard {
     GtkWidget* data;
-    Widget_Guard(GtkWidget* widget) : data(widget) {}
-    ~Widget_Guard() {
+    DialogKind kind;
+    bool parented;
+    Dialog_Guard(GtkWidget* widget, DialogKind dialogKind)
+        : data(widget), kind(dialogKind), parented(false) {}
+    ~Dialog_Guard() {
+#if defined(NFD_GTK_DEFERRED_TEARDOWN)
+        const bool pool = dialog_pool_enabled && !dialog_pool[kind];
+        gtk_widget_hide(data);
+        if (pool) {
+            // The GdkWindow has the caller's window as its transient parent, so drop it; the next
+            // call realizes the dialog again.
+            if (parented) gtk_widget_unrealize(data);
+            dialog_pool[kind] = data;
+        } else {
+            g_idle_add_full(G_PRIORITY_LOW, &DestroyWidgetCallback, data, nullptr);
+        }
+        // make sure that the dialog disappears from the screen even if nothing processes the
+        // events for a while
+        gdk_display_flush(gtk_widget_get_display(data));
+        teardown_pending = true;
+#else
         WaitForCleanup();
-        gtk_widget_destroy(data);
+        ReleaseDialog(data, kind, parented);
         WaitForCleanup();
+#endif
     }
 };
 
@@ -349,15 +782,14 @@ void FileActivatedSignalHandler(GtkButton* saveButton, void* userdata) {
         }
 
         if (!*p_period) {  // there is no '.', so append the default extension
-            Pair_GtkFileFilter_FileExtension* filterMap =
-                static_cast<Pair_GtkFileFilter_FileExtension*>(args->map);
+            const Pair_GtkFileFilter_FileExtension* filterMap = args->map;
             GtkFileFilter* currentFilter = gtk_file_chooser_get_filter(chooser);
             if (currentFilter) {
                 for (; filterMap->filter; ++filterMap) {
                     if (filterMap->filter == currentFilter) break;
                 }
             }
-            if (filterMap->filter) {
+            if (filterMap->filter && filterMap->extensionEnd) {
                 // memory for appended string (including '.' and
                 // trailing '\0')
                 char* appendedFileName = NFDi_Malloc<char>(
@@ -385,12 +817,12 @@ void FileActivatedSignalHandler(GtkButton* saveButton, void* userdata) {
     g_free(currentFileName);
 }
 
-// wrapper for gtk_dialog_run() that brings the dialog to the front
+// shows the dialog and brings it to the front
 // see issues at:
 // https://github.com/btzy/nativefiledialog-extended/issues/31
 // https://github.com/mlabbe/nativefiledialog/pull/92
 // https://github.com/guillaumechereau/noc/pull/11
-gint RunDialogWithFocus(GtkDialog* dialog) {
+void ShowDialogWithFocus(GtkDialog* dialog) {
 #if defined(NFD_X11)
     gtk_widget_show_all(GTK_WIDGET(dialog));  // show the dialog so that it gets a display
     if (GDK_IS_X11_DISPLAY(gtk_widget_get_display(GTK_WIDGET(dialog)))) {
@@ -401,24 +833,15 @@ gint RunDialogWithFocus(GtkDialog* dialog) {
         gtk_window_present_with_time(GTK_WINDOW(dialog), gdk_x11_get_server_time(window));
     }
 #endif
-    return gtk_dialog_run(dialog);
-}
-
-#if defined(NFD_WAYLAND)
-void DestroyXdgExported(void* context) {
-    zxdg_exported_v1_destroy(static_cast<struct zxdg_exported_v1*>(context));
+    gtk_widget_show(GTK_WIDGET(dialog));
 }
 
-void zxdg_exported_v1_handle(void* context, struct zxdg_exported_v1*, const char* handle) {
-    GdkWindow* childWindow = static_cast<GdkWindow*>(context);
-    // GDK doesn't modify the string, even though it takes char*, so we can cast away the constness
-    gdk_wayland_window_set_transient_for_exported(childWindow, const_cast<char*>(handle));
+// wrapper for gtk_dialog_run() that brings the dialog to the front
+gint RunDialogWithFocus(GtkDialog* dialog) {
+    ShowDialogWithFocus(dialog);
+    return gtk_dialog_run(dialog);
 }
 
-constexpr struct zxdg_exported_v1_listener wayland_xdg_exported_v1_listener{
-    &zxdg_exported_v1_handle};
-#endif
-
 // This is an RAII class that wraps the parenting of a GtkWidget (the file dialog).
 // To parent a window on GTK, the child GdkWindow needs to be on the same screen as the parent.
 // Before the GtkWidget is realized (i.e. the GdkWindow is created for it), we need to tell it the
@@ -435,6 +858,9 @@ struct NativeWindowParenter {
         if (gdk_screen && realized_handler) {
             widget = w;
 
+            // a pooled dialog may already be realized, so unrealize it to get the signal below
+            if (gtk_widget_get_realized(w)) gtk_widget_unrealize(w);
+
             parentWindowHandle = parentHandle.handle;
 
             // make the dialog window use a GtkScreen with the same display server as the parent (so
@@ -456,6 +882,17 @@ struct NativeWindowParenter {
         // No need to call destroy.fn because it is destroyed in the destructor of DestroyFunc.
     }
 
+    // Whether the dialog will be given a transient parent when it is realized.
+    bool IsParenting() const { return widget != nullptr; }
+
+    // Takes over the cleanup that would otherwise be done on destruction, for a dialog that stays
+    // open after this is destroyed (the dialog must have been realized by then).
+    void TakeDestroy(void (*&outFn)(void*), void*& outContext) {
+        outFn = destroy.fn;
+        outContext = destroy.context;
+        destroy.fn = &EmptyFn;
+    }
+
     static void GetScreenAndHandler(size_t parentWindowType,
                                     GdkScreen*& outScreen,
                                     void (*&outHandler)(GtkWidget*, void*)) {
@@ -618,20 +1055,15 @@ struct NativeWindowParenter {
 
 #if defined(NFD_WAYLAND)
     void SetParentWayland(GdkWindow* childWindow) {
-        if (wayland_display && wayland_xdg_exporter_v1) {
-            struct zxdg_exported_v1* exported = zxdg_exporter_v1_export(
-                wayland_xdg_exporter_v1, static_cast<struct wl_surface*>(parentWindowHandle));
-            if (!exported) {
-                // if we fail to export the wl_surface, act as if the window has no parent
-                return;
-            }
-            zxdg_exported_v1_add_listener(
-                exported, &wayland_xdg_exported_v1_listener, static_cast<void*>(childWindow));
-            wl_display_roundtrip(wayland_display);
-            zxdg_exported_v1_set_user_data(exported, nullptr);
-            destroy.fn = &DestroyXdgExported;
-            destroy.context = static_cast<void*>(exported);
+        const char* handle = NFD_Wayland_AcquireExportedHandle(
+            static_cast<struct wl_surface*>(parentWindowHandle), destroy);
+        if (!handle) {
+            // if we fail to export the wl_surface, act as if the window has no parent
+            return;
         }
+        // GDK doesn't modify the string, even though it takes char*, so we can cast away the
+        // constness
+        gdk_wayland_window_set_transient_for_exported(childWindow, const_cast<char*>(handle));
     }
 #endif
 
@@ -655,6 +1087,602 @@ GdkScreen* NativeWindowParenter::x11_gdk_screen = nullptr;
 GdkScreen* NativeWindowParenter::wayland_gdk_screen = nullptr;
 #endif
 
+// Gets the selected file of `chooser`, as a URI if `uri` is true.
+gchar* GetChooserFile(GtkFileChooser* chooser, bool uri) {
+    return uri ? gtk_file_chooser_get_uri(chooser) : gtk_file_chooser_get_filename(chooser);
+}
+
+// Gets the selected files of `chooser`, as URIs if `uris` is true.
+GSList* GetChooserFiles(GtkFileChooser* chooser, bool uris) {
+    return uris ? gtk_file_chooser_get_uris(chooser) : gtk_file_chooser_get_filenames(chooser);
+}
+
+// The dialog functions, which are run by RunDialog and by dialog requests.
+enum DialogFunction {
+    DIALOG_FUNCTION_OPEN,
+    DIALOG_FUNCTION_OPEN_MULTIPLE,
+    DIALOG_FUNCTION_SAVE,
+    DIALOG_FUNCTION_SAVE_MULTIPLE,
+    DIALOG_FUNCTION_PICK_FOLDER,
+    DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE
+};
+
+bool ReturnsPathSet(DialogFunction function) {
+    return function == DIALOG_FUNCTION_OPEN_MULTIPLE || function == DIALOG_FUNCTION_SAVE_MULTIPLE ||
+           function == DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE;
+}
+
+// What SetUpDialog has done to the dialog of a dialog function.  It must not move until it is
+// given to FinishDialogSetup, because the save button's handler points to buttonClickedArgs.
+struct DialogSetup {
+    GtkWidget* widget;
+    DialogKind kind;
+    const nfdwindowhandle_t* parentWindow;
+    bool uris;                             // whether the caller asked for URIs
+    CompiledFilterList* filters;           // null if the dialog has no filters
+    GtkWidget* saveButton;                 // null if the dialog is not a save dialog
+    gulong saveHandlerID;                  // the handler that adds the file extension
+    ButtonClickedArgs buttonClickedArgs;
+};
+
+#if defined(NFD_GTK_PREFETCH)
+// Gets the default path in the arguments of a dialog function.
+const char* GetDefaultPath(DialogFunction function, const void* args) {
+    switch (function) {
+        case DIALOG_FUNCTION_OPEN:
+        case DIALOG_FUNCTION_OPEN_MULTIPLE:
+            return static_cast<const nfdopendialognargs_t*>(args)->defaultPath;
+        case DIALOG_FUNCTION_SAVE:
+            return static_cast<const nfdsavedialognargs_t*>(args)->defaultPath;
+        case DIALOG_FUNCTION_SAVE_MULTIPLE:
+            return static_cast<const nfdsavedialogmultiplenargs_t*>(args)->defaultPath;
+        case DIALOG_FUNCTION_PICK_FOLDER:
+        case DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE:
+            return static_cast<const nfdpickfoldernargs_t*>(args)->defaultPath;
+    }
+    return nullptr;
+}
+#endif
+
+// Gets a dialog for the dialog function, and sets it up according to `args`, except for parenting
+// it.  Returns false (and sets the error) if `args` is invalid.
+bool SetUpDialog(DialogFunction function,
+                 nfdversion_t version,
+                 const void* args,
+                 DialogSetup& setup) {
+#if defined(NFD_GTK_PREFETCH)
+    // start as early as possible, so that the sweep can run while the dialog is being set up
+    StartPrefetch(GetDefaultPath(function, args));
+#endif
+    setup.filters = nullptr;
+    setup.saveButton = nullptr;
+    switch (function) {
+        case DIALOG_FUNCTION_OPEN:
+        case DIALOG_FUNCTION_OPEN_MULTIPLE: {
+            const nfdopendialognargs_t* openArgs = static_cast<const nfdopendialognargs_t*>(args);
+            const bool multiple = function == DIALOG_FUNCTION_OPEN_MULTIPLE;
+            setup.kind = DIALOG_KIND_OPEN;
+            setup.widget =
+                AcquireDialog(DIALOG_KIND_OPEN, multiple ? "Open Files" : "Open File", "_Open");
+            setup.parentWindow = &openArgs->parentWindow;
+            setup.uris = WantsUris(version, openArgs);
+            GtkFileChooser* chooser = GTK_FILE_CHOOSER(setup.widget);
+
+            // set select multiple
+            if (multiple) gtk_file_chooser_set_select_multiple(chooser, TRUE);
+
+            /* Build the filter list */
+            setup.filters =
+                AddFiltersToDialog(chooser, openArgs->filterList, openArgs->filterCount);
+
+            /* Set the default path */
+            SetDefaultPath(chooser, openArgs->defaultPath);
+            return true;
+        }
+        case DIALOG_FUNCTION_SAVE: {
+            const nfdsavedialognargs_t* saveArgs = static_cast<const nfdsavedialognargs_t*>(args);
+            setup.kind = DIALOG_KIND_SAVE;
+            setup.widget = AcquireDialog(DIALOG_KIND_SAVE, "Save File", "_Save");
+            setup.parentWindow = &saveArgs->parentWindow;
+            setup.uris = WantsUris(version, saveArgs);
+            GtkFileChooser* chooser = GTK_FILE_CHOOSER(setup.widget);
+
+            /* Build the filter list */
+            setup.filters =
+                AddFiltersToDialog(chooser, saveArgs->filterList, saveArgs->filterCount);
+            setup.buttonClickedArgs.chooser = chooser;
+            setup.buttonClickedArgs.map = setup.filters->map;
+
+            /* Set the default path */
+            SetDefaultPath(chooser, saveArgs->defaultPath);
+
+            /* Set the default file name */
+            SetDefaultName(chooser, saveArgs->defaultName);
+
+            /* set the handler to add file extension */
+            setup.saveButton =
+                gtk_dialog_get_widget_for_response(GTK_DIALOG(setup.widget), GTK_RESPONSE_ACCEPT);
+            setup.saveHandlerID = g_signal_connect(G_OBJECT(setup.saveButton),
+                                                   "pressed",
+                                                   G_CALLBACK(FileActivatedSignalHandler),
+                                                   static_cast<void*>(&setup.buttonClickedArgs));
+            return true;
+        }
+        case DIALOG_FUNCTION_SAVE_MULTIPLE: {
+            const nfdsavedialogmultiplenargs_t* saveArgs =
+                static_cast<const nfdsavedialogmultiplenargs_t*>(args);
+            const char* fileNamesError =
+                CheckSaveFileNames(saveArgs->fileNames, saveArgs->fileCount);
+            if (fileNamesError) {
+                NFDi_SetError(fileNamesError);
+                return false;
+            }
+
+            // GTK has no dialog for saving multiple files, so we ask for the folder to save them
+            // into.
+            setup.kind = DIALOG_KIND_SELECT_FOLDER;
+            setup.widget = AcquireDialog(DIALOG_KIND_SELECT_FOLDER, "Save Files", "_Save");
+            setup.parentWindow = &saveArgs->parentWindow;
+            setup.uris = WantsUris(version, saveArgs);
+
+            /* Set the default path */
+            SetDefaultPath(GTK_FILE_CHOOSER(setup.widget), saveArgs->defaultPath);
+            return true;
+        }
+        case DIALOG_FUNCTION_PICK_FOLDER:
+        case DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE: {
+            const nfdpickfoldernargs_t* pickArgs = static_cast<const nfdpickfoldernargs_t*>(args);
+            const bool multiple = function == DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE;
+            setup.kind = DIALOG_KIND_SELECT_FOLDER;
+            setup.widget = AcquireDialog(DIALOG_KIND_SELECT_FOLDER,
+                                         multiple ? "Select Folders" : "Select Folder",
+                                         "_Select");
+            setup.parentWindow = &pickArgs->parentWindow;
+            setup.uris = WantsUris(version, pickArgs);
+
+            /* Set the default path */
+            SetDefaultPath(GTK_FILE_CHOOSER(setup.widget), pickArgs->defaultPath);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Undoes what SetUpDialog has done, except for getting the dialog, which is given back with
+// ReleaseDialog.
+void FinishDialogSetup(DialogSetup& setup) {
+    /* unset the handler */
+    if (setup.saveButton) {
+        g_signal_handler_disconnect(G_OBJECT(setup.saveButton), setup.saveHandlerID);
+    }
+    if (setup.filters) ReleaseCompiledFilterList(setup.filters);
+}
+
+// Gets the result of a dialog that the user has accepted, in the same way as the dialog function.
+nfdresult_t GetDialogResult(DialogFunction function,
+                            const void* args,
+                            const DialogSetup& setup,
+                            nfdnchar_t** outPath,
+                            const nfdpathset_t** outPaths) {
+    GtkFileChooser* chooser = GTK_FILE_CHOOSER(setup.widget);
+    switch (function) {
+        case DIALOG_FUNCTION_SAVE_MULTIPLE: {
+            const nfdsavedialogmultiplenargs_t* saveArgs =
+                static_cast<const nfdsavedialogmultiplenargs_t*>(args);
+            gchar* folder = gtk_file_chooser_get_filename(chooser);
+            if (!folder) {
+                // e.g. a remote location that GVfs cannot mount locally
+                NFDi_SetError("GTK returned a folder that has no local path.");
+                return NFD_ERROR;
+            }
+            // join each file name to the selected folder, building the list from the back so that
+            // it ends up in the same order as fileNames
+            GSList* fileList = nullptr;
+            for (nfdpathsetsize_t i = saveArgs->fileCount; i != 0; --i) {
+                gchar* path = g_build_filename(folder, saveArgs->fileNames[i - 1], nullptr);
+                if (setup.uris) {
+                    gchar* uri = g_filename_to_uri(path, nullptr, nullptr);
+                    g_free(path);
+                    if (!uri) {
+                        g_slist_free_full(fileList, &g_free);
+                        g_free(folder);
+                        NFDi_SetError("Failed to convert a file path to a URI.");
+                        return NFD_ERROR;
+                    }
+                    path = uri;
+                }
+                fileList = g_slist_prepend(fileList, path);
+            }
+            g_free(folder);
+
+            *outPaths = AllocPathSet(fileList);
+            return NFD_OKAY;
+        }
+        case DIALOG_FUNCTION_OPEN_MULTIPLE:
+        case DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE:
+            // write out the file names
+            *outPaths = AllocPathSet(GetChooserFiles(chooser, setup.uris));
+            return NFD_OKAY;
+        default:
+            // write out the file name
+            *outPath = GetChooserFile(chooser, setup.uris);
+            return NFD_OKAY;
+    }
+}
+
+// Something to be run by GTK: either a call to a function, or a dialog request (for which it is the
+// first member, so that the two can be converted to each other).  It is done when it has been
+// given to CompleteGtkTask, which need not happen before `fn` returns.
+struct GtkTask {
+    GtkTask* next;
+    void (*fn)(GtkTask*);
+    void (*callback)(void*);  // called (on the GTK thread) when the task is done, if not null
+    void* userData;
+    int done;  // accessed atomically
+};
+
+#if defined(NFD_GTK_UI_THREAD)
+// With NFD_GTK_UI_THREAD, GTK is owned by a thread that NFD_Init starts, and everything that uses
+// GTK runs there as a GtkTask, so that the application's threads never enter GTK.  Any thread may
+// push tasks onto a lock-free stack; the GTK thread takes the whole stack at once and runs the
+// tasks in the order they were pushed.  Tasks never block (dialogs are shown without waiting for
+// them, and complete their task when they are closed), so any number of dialogs can be open at
+// once.  The GTK thread is never stopped, because GTK cannot be de-initialized and must stay on
+// the thread that initialized it.
+
+/* protects init_count and the starting of the GTK thread */
+pthread_mutex_t nfd_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* number of successful NFD_Init calls that have not been matched by NFD_Quit */
+size_t init_count;
+/* used with task_cond to wait for the GTK thread to initialize and for tasks to be done */
+pthread_mutex_t task_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t task_cond = PTHREAD_COND_INITIALIZER;
+/* the GTK thread, if gtk_thread_started (which is accessed atomically) */
+pthread_t gtk_thread;
+bool gtk_thread_started;
+/* whether the GTK thread has called gtk_init_check, and whether it succeeded (which is accessed
+ * atomically, because dialog functions check it without locking) */
+bool gtk_thread_initialized;
+bool gtk_thread_ok;
+/* tasks pushed by other threads, most recently pushed first */
+GtkTask* task_stack;
+
+bool OnGtkThread() {
+    return __atomic_load_n(&gtk_thread_started, __ATOMIC_ACQUIRE) &&
+           pthread_equal(pthread_self(), gtk_thread);
+}
+#endif
+
+// Marks the task as done, and then calls its callback.  The task may be freed by its owner as soon
+// as it is marked as done.
+void CompleteGtkTask(GtkTask* task) {
+    void (*callback)(void*) = task->callback;
+    void* userData = task->userData;
+#if defined(NFD_GTK_UI_THREAD)
+    {
+        Mutex_Guard lock(&task_mutex);
+        __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&task_cond);
+    }
+#else
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+#endif
+    if (callback) callback(userData);
+}
+
+// A dialog request, which is what an nfdgtkrequest_t points to.  Its dialog is shown without
+// waiting for it, and the request is done when the dialog is closed.
+struct DialogRequest {
+    GtkTask task;
+    DialogFunction function;
+    nfdversion_t version;
+    const void* args;
+    DialogSetup setup;
+    bool parented;                    // whether the dialog has a transient parent
+    void (*parentDestroyFn)(void*);  // the cleanup of NativeWindowParenter
+    void* parentDestroyContext;
+    gulong responseHandlerID;
+    nfdresult_t result;
+    nfdnchar_t* path;            // for dialogs that return one path
+    const nfdpathset_t* paths;   // for dialogs that return a path set
+    const char* error;           // if result is NFD_ERROR
+};
+
+void ResponseSignalHandler(GtkDialog* dialog, gint response, gpointer userdata) {
+    DialogRequest* request = static_cast<DialogRequest*>(userdata);
+    g_signal_handler_disconnect(G_OBJECT(dialog), request->responseHandlerID);
+    FinishDialogSetup(request->setup);
+    if (response == GTK_RESPONSE_ACCEPT) {
+        request->result = GetDialogResult(
+            request->function, request->args, request->setup, &request->path, &request->paths);
+        if (request->result == NFD_ERROR) request->error = g_errorstr;
+    } else {
+        request->result = NFD_CANCEL;
+    }
+    // the rest of the teardown is done by the main loop that called this
+    ReleaseDialog(request->setup.widget, request->setup.kind, request->parented);
+    request->parentDestroyFn(request->parentDestroyContext);
+    CompleteGtkTask(&request->task);
+}
+
+// Shows the dialog of a request; ResponseSignalHandler completes the request when it is closed.
+void StartDialogRequestTask(GtkTask* task) {
+    DialogRequest* request = reinterpret_cast<DialogRequest*>(task);
+    if (!SetUpDialog(request->function, request->version, request->args, request->setup)) {
+        request->result = NFD_ERROR;
+        request->error = g_errorstr;
+        CompleteGtkTask(task);
+        return;
+    }
+    GtkWidget* widget = request->setup.widget;
+    request->responseHandlerID = g_signal_connect(G_OBJECT(widget),
+                                                  "response",
+                                                  G_CALLBACK(ResponseSignalHandler),
+                                                  static_cast<void*>(request));
+
+    /* Parent the window properly (GTK realizes the dialog while showing it, which is the only time
+     * that the parenter is needed) */
+    NativeWindowParenter nativeWindowParenter(widget, *request->setup.parentWindow);
+    request->parented = nativeWindowParenter.IsParenting();
+    ShowDialogWithFocus(GTK_DIALOG(widget));
+    nativeWindowParenter.TakeDestroy(request->parentDestroyFn, request->parentDestroyContext);
+}
+
+// Gives the result of a finished request to the caller, in the same way as the dialog function.
+nfdresult_t TakeDialogRequestResult(const DialogRequest* request,
+                                    nfdnchar_t** outPath,
+                                    const nfdpathset_t** outPaths) {
+    if (request->result == NFD_OKAY) {
+        if (outPath) *outPath = request->path;
+        if (outPaths) *outPaths = request->paths;
+    } else if (request->result == NFD_ERROR) {
+        NFDi_SetError(request->error);
+    }
+    return request->result;
+}
+
+#if defined(NFD_GTK_UI_THREAD)
+gboolean RunGtkTasks(gpointer) {
+    // take the whole stack, and run the tasks in the order they were pushed
+    GtkTask* stack = __atomic_exchange_n(&task_stack, nullptr, __ATOMIC_ACQUIRE);
+    GtkTask* tasks = nullptr;
+    while (stack) {
+        GtkTask* next = stack->next;
+        stack->next = tasks;
+        tasks = stack;
+        stack = next;
+    }
+    while (tasks) {
+        // the task may be freed by its owner as soon as it is done
+        GtkTask* task = tasks;
+        tasks = task->next;
+        task->fn(task);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void PostGtkTask(GtkTask* task) {
+    task->done = 0;
+    GtkTask* head = __atomic_load_n(&task_stack, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(
+        &task_stack, &head, task, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // the GTK thread takes the whole stack at once, so it only needs to be woken up if the stack
+    // was empty (g_idle_add is thread-safe)
+    if (!head) g_idle_add(&RunGtkTasks, nullptr);
+}
+
+void WaitForGtkTask(GtkTask* task) {
+    Mutex_Guard lock(&task_mutex);
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&task_cond, &task_mutex);
+    }
+}
+
+struct FunctionTask {
+    GtkTask task;
+    void (*function)(void*);
+    void* context;
+};
+
+void RunFunctionTask(GtkTask* task) {
+    FunctionTask* functionTask = reinterpret_cast<FunctionTask*>(task);
+    functionTask->function(functionTask->context);
+    CompleteGtkTask(task);
+}
+
+// Calls function(context) on the GTK thread, and waits for it to return.
+void RunOnGtkThread(void (*function)(void*), void* context) {
+    if (OnGtkThread()) {
+        function(context);
+        return;
+    }
+    FunctionTask functionTask;
+    functionTask.task.fn = &RunFunctionTask;
+    functionTask.task.callback = nullptr;
+    functionTask.task.userData = nullptr;
+    functionTask.function = function;
+    functionTask.context = context;
+    PostGtkTask(&functionTask.task);
+    WaitForGtkTask(&functionTask.task);
+}
+
+void* GtkThreadMain(void*) {
+    const bool ok = gtk_init_check(nullptr, nullptr);
+    {
+        Mutex_Guard lock(&task_mutex);
+        __atomic_store_n(&gtk_thread_ok, ok, __ATOMIC_RELEASE);
+        gtk_thread_initialized = true;
+        pthread_cond_broadcast(&task_cond);
+    }
+    if (ok) g_main_loop_run(g_main_loop_new(nullptr, FALSE));  // never returns
+    return nullptr;
+}
+
+// Starts the GTK thread if it has not been started, and waits for it to initialize GTK.  Returns
+// false if GTK could not be initialized.  Must be called with nfd_mutex held.
+bool StartGtkThread() {
+    if (!gtk_thread_started) {
+        if (pthread_create(&gtk_thread, nullptr, &GtkThreadMain, nullptr) != 0) return false;
+        pthread_detach(gtk_thread);
+        __atomic_store_n(&gtk_thread_started, true, __ATOMIC_RELEASE);
+    }
+    Mutex_Guard lock(&task_mutex);
+    while (!gtk_thread_initialized) pthread_cond_wait(&task_cond, &task_mutex);
+    return gtk_thread_ok;
+}
+
+// Runs a dialog function on the GTK thread for a caller on another thread, and waits for it.
+nfdresult_t RunDialogOnGtkThread(DialogFunction function,
+                                 nfdversion_t version,
+                                 const void* args,
+                                 nfdnchar_t** outPath,
+                                 const nfdpathset_t** outPaths) {
+    if (!__atomic_load_n(&gtk_thread_ok, __ATOMIC_ACQUIRE)) {
+        NFDi_SetError("NFD_Init must be called before any dialog function.");
+        return NFD_ERROR;
+    }
+    DialogRequest request;
+    request.task.fn = &StartDialogRequestTask;
+    request.task.callback = nullptr;
+    request.task.userData = nullptr;
+    request.function = function;
+    request.version = version;
+    request.args = args;
+    PostGtkTask(&request.task);
+    WaitForGtkTask(&request.task);
+    return TakeDialogRequestResult(&request, outPath, outPaths);
+}
+#endif
+
+// Runs the dialog of a dialog function, and waits for the user to close it.
+nfdresult_t RunDialog(DialogFunction function,
+                      nfdversion_t version,
+                      const void* args,
+                      nfdnchar_t** outPath,
+                      const nfdpathset_t** outPaths) {
+#if defined(NFD_GTK_UI_THREAD)
+    if (!OnGtkThread()) {
+        return RunDialogOnGtkThread(function, version, args, outPath, outPaths);
+    }
+#endif
+
+    DialogSetup setup;
+    if (!SetUpDialog(function, version, args, setup)) return NFD_ERROR;
+
+    // guard to give the widget back to the pool when returning from this function
+    Dialog_Guard dialogGuard(setup.widget, setup.kind);
+
+    gint result;
+    {
+        /* Parent the window properly */
+        NativeWindowParenter nativeWindowParenter(setup.widget, *setup.parentWindow);
+        dialogGuard.parented = nativeWindowParenter.IsParenting();
+
+        /* invoke the dialog (blocks until dialog is closed) */
+        result = RunDialogWithFocus(GTK_DIALOG(setup.widget));
+    }
+
+    FinishDialogSetup(setup);
+
+    if (result == GTK_RESPONSE_ACCEPT) {
+        return GetDialogResult(function, args, setup, outPath, outPaths);
+    } else {
+        return NFD_CANCEL;
+    }
+}
+
+// Starts a dialog request.  With NFD_GTK_UI_THREAD, the dialog is shown by the GTK thread;
+// otherwise, it is shown right away.
+nfdresult_t StartDialogRequest(DialogFunction function,
+                               nfdversion_t version,
+                               const void* args,
+                               void (*callback)(void*),
+                               void* userData,
+                               nfdgtkrequest_t** outRequest) {
+    DialogRequest* request = NFDi_Malloc<DialogRequest>(sizeof(DialogRequest));
+    request->task.fn = &StartDialogRequestTask;
+    request->task.callback = callback;
+    request->task.userData = userData;
+    request->task.done = 0;
+    request->function = function;
+    request->version = version;
+    request->args = args;
+    *outRequest = static_cast<nfdgtkrequest_t*>(request);
+#if defined(NFD_GTK_UI_THREAD)
+    if (!OnGtkThread()) {
+        if (!__atomic_load_n(&gtk_thread_ok, __ATOMIC_ACQUIRE)) {
+            NFDi_Free(request);
+            NFDi_SetError("NFD_Init must be called before any dialog function.");
+            return NFD_ERROR;
+        }
+        PostGtkTask(&request->task);
+        return NFD_OKAY;
+    }
+#endif
+    StartDialogRequestTask(&request->task);
+    return NFD_OKAY;
+}
+
+// Waits for the request to be done, gives its result to the caller, and frees it.
+nfdresult_t FinishDialogRequest(nfdgtkrequest_t* handle,
+                                nfdnchar_t** outPath,
+                                const nfdpathset_t** outPaths) {
+    assert(handle);
+    DialogRequest* request = static_cast<DialogRequest*>(handle);
+    assert(ReturnsPathSet(request->function) == (outPaths != nullptr));
+#if defined(NFD_GTK_UI_THREAD)
+    if (!OnGtkThread()) {
+        WaitForGtkTask(&request->task);
+    }
+#endif
+    // on the thread that runs GTK, the dialog can only be closed if we run the main loop
+    while (!__atomic_load_n(&request->task.done, __ATOMIC_ACQUIRE)) gtk_main_iteration();
+    const nfdresult_t result = TakeDialogRequestResult(request, outPath, outPaths);
+    NFDi_Free(request);
+    return result;
+}
+
+// Runs a function that uses the state of dialogs (e.g. the dialog pool or the Wayland state).  With
+// NFD_GTK_UI_THREAD, dialogs use that state on the GTK thread, so the function runs there too,
+// unless there is no running GTK thread (before NFD_Init, or if GTK could not be initialized), in
+// which case nothing else can be using the state and nothing would run the function there.
+void RunWithDialogState(void (*function)(void*), void* context) {
+#if defined(NFD_GTK_UI_THREAD)
+    if (__atomic_load_n(&gtk_thread_ok, __ATOMIC_ACQUIRE)) {
+        RunOnGtkThread(function, context);
+        return;
+    }
+#endif
+    function(context);
+}
+
+// The parts of NFD_Init and NFD_Quit that need GTK.
+void InitGtkState(void*) {
+#if defined(NFD_WAYLAND)
+    NFD_Wayland_Init();
+#endif
+#if defined(NFD_GTK_PREWARM)
+    StartPrewarm();
+#endif
+}
+
+void QuitGtkState(void*) {
+#if defined(NFD_GTK_PREWARM)
+    CancelPrewarm();
+#endif
+#if defined(NFD_WAYLAND)
+    NFD_Wayland_Quit();
+#endif
+    ClearFilterCache();
+#if defined(NFD_GTK_DEFERRED_TEARDOWN)
+    FinishTeardown();
+#endif
+    // do nothing about GTK since it cannot be de-initialized, and keep the pooled dialogs for the
+    // next NFD_Init
+}
+
 }  // namespace
 
 const char* NFD_GetError(void) {
@@ -668,22 +1696,160 @@ void NFD_ClearError(void) {
 /* public */
 
 nfdresult_t NFD_Init(void) {
+#if defined(NFD_GTK_UI_THREAD)
+    Mutex_Guard lock(&nfd_mutex);
+    if (init_count != 0) {
+        // another thread has already set everything up
+        ++init_count;
+        return NFD_OKAY;
+    }
+    if (!StartGtkThread()) {
+        NFDi_SetError("Failed to initialize GTK+ with gtk_init_check on the GTK thread.");
+        return NFD_ERROR;
+    }
+    RunOnGtkThread(&InitGtkState, nullptr);
+    init_count = 1;
+#else
     // Init GTK
     if (!gtk_init_check(NULL, NULL)) {
         NFDi_SetError("Failed to initialize GTK+ with gtk_init_check.");
         return NFD_ERROR;
     }
-#if defined(NFD_WAYLAND)
-    NFD_Wayland_Init();
+    InitGtkState(nullptr);
 #endif
     return NFD_OKAY;
 }
 
 void NFD_Quit(void) {
+#if defined(NFD_GTK_UI_THREAD)
+    Mutex_Guard lock(&nfd_mutex);
+    if (--init_count != 0) return;
+    RunOnGtkThread(&QuitGtkState, nullptr);
+#else
+    QuitGtkState(nullptr);
+#endif
+}
+
+void NFD_PumpEvents(void) {
+#if defined(NFD_GTK_UI_THREAD)
+    // nothing to do, because the GTK thread runs its own main loop
+#else
+#if defined(NFD_GTK_DEFERRED_TEARDOWN)
+    FinishTeardown();
+#endif
+    // run at most one more thing (e.g. a pre-warm step), so that this never blocks for long
+    if (gtk_events_pending()) gtk_main_iteration_do(FALSE);
+#endif
+}
+
+nfdresult_t NFD_SetWaylandDisplay(struct wl_display* display) {
 #if defined(NFD_WAYLAND)
-    NFD_Wayland_Quit();
+    RunWithDialogState(
+        [](void* context) { NFD_Wayland_SetDisplay(static_cast<struct wl_display*>(context)); },
+        static_cast<void*>(display));
+#else
+    (void)display;
 #endif
-    // do nothing about GTK since it cannot be de-initialized
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_ReleaseWaylandSurface(struct wl_surface* surface) {
+#if defined(NFD_WAYLAND)
+    RunWithDialogState(
+        [](void* context) { NFD_Wayland_ReleaseSurface(static_cast<struct wl_surface*>(context)); },
+        static_cast<void*>(surface));
+#else
+    (void)surface;
+#endif
+    return NFD_OKAY;
+}
+
+void NFD_GTK_SetDialogPoolEnabled(int enabled) {
+    auto setEnabled = [](void* context) {
+        dialog_pool_enabled = *static_cast<int*>(context) != 0;
+        if (!dialog_pool_enabled) TrimDialogPool();
+    };
+    RunWithDialogState(setEnabled, &enabled);
+}
+
+void NFD_GTK_TrimDialogPool(void) {
+    RunWithDialogState([](void*) { TrimDialogPool(); }, nullptr);
+}
+
+nfdresult_t NFD_GTK_StartOpenDialog_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdopendialognargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_OPEN, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartOpenDialogMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdopendialognargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_OPEN_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartSaveDialog_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdsavedialognargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_SAVE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartSaveDialogMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdsavedialogmultiplenargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    // check the names here, so that bad names fail the request before it starts (as they do in the
+    // GTK 4 implementation), instead of when the GTK thread sets up the dialog
+    const char* fileNamesError = CheckSaveFileNames(args->fileNames, args->fileCount);
+    if (fileNamesError) {
+        NFDi_SetError(fileNamesError);
+        return NFD_ERROR;
+    }
+    return StartDialogRequest(
+        DIALOG_FUNCTION_SAVE_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartPickFolder_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdpickfoldernargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_PICK_FOLDER, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartPickFolderMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdpickfoldernargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+int NFD_GTK_IsRequestDone(const nfdgtkrequest_t* request) {
+    assert(request);
+    const DialogRequest* dialogRequest = static_cast<const DialogRequest*>(request);
+    return __atomic_load_n(&dialogRequest->task.done, __ATOMIC_ACQUIRE);
+}
+
+nfdresult_t NFD_GTK_FinishRequest(nfdgtkrequest_t* request, nfdnchar_t** outPath) {
+    return FinishDialogRequest(request, outPath, nullptr);
+}
+
+nfdresult_t NFD_GTK_FinishRequestMultiple(nfdgtkrequest_t* request,
+                                          const nfdpathset_t** outPaths) {
+    return FinishDialogRequest(request, nullptr, outPaths);
 }
 
 void NFD_FreePathN(nfdnchar_t* filePath) {
@@ -707,44 +1873,7 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
-
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Open File",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_OPEN,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Open",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
-
-    /* Build the filter list */
-    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), args->filterList, args->filterCount);
-
-    /* Set the default path */
-    SetDefaultPath(GTK_FILE_CHOOSER(widget), args->defaultPath);
-
-    gint result;
-    {
-        /* Parent the window properly */
-        NativeWindowParenter nativeWindowParenter(widget, args->parentWindow);
-
-        /* invoke the dialog (blocks until dialog is closed) */
-        result = RunDialogWithFocus(GTK_DIALOG(widget));
-    }
-
-    if (result == GTK_RESPONSE_ACCEPT) {
-        // write out the file name
-        *outPath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(widget));
-
-        return NFD_OKAY;
-    } else {
-        return NFD_CANCEL;
-    }
+    return RunDialog(DIALOG_FUNCTION_OPEN, version, args, outPath, nullptr);
 }
 
 nfdresult_t NFD_OpenDialogU8(nfdu8char_t** outPath,
@@ -772,48 +1901,7 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
 nfdresult_t NFD_OpenDialogMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
-
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Open Files",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_OPEN,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Open",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
-
-    // set select multiple
-    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(widget), TRUE);
-
-    /* Build the filter list */
-    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), args->filterList, args->filterCount);
-
-    /* Set the default path */
-    SetDefaultPath(GTK_FILE_CHOOSER(widget), args->defaultPath);
-
-    gint result;
-    {
-        /* Parent the window properly */
-        NativeWindowParenter nativeWindowParenter(widget, args->parentWindow);
-
-        /* invoke the dialog (blocks until dialog is closed) */
-        result = RunDialogWithFocus(GTK_DIALOG(widget));
-    }
-
-    if (result == GTK_RESPONSE_ACCEPT) {
-        // write out the file name
-        GSList* fileList = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(widget));
-
-        *outPaths = static_cast<void*>(fileList);
-        return NFD_OKAY;
-    } else {
-        return NFD_CANCEL;
-    }
+    return RunDialog(DIALOG_FUNCTION_OPEN_MULTIPLE, version, args, nullptr, outPaths);
 }
 
 nfdresult_t NFD_OpenDialogMultipleU8(const nfdpathset_t** outPaths,
@@ -843,65 +1931,7 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdsavedialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
-
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Save File",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_SAVE,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
-
-    GtkWidget* saveButton = gtk_dialog_add_button(GTK_DIALOG(widget), "_Save", GTK_RESPONSE_ACCEPT);
-
-    // Prompt on overwrite
-    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(widget), TRUE);
-
-    /* Build the filter list */
-    ButtonClickedArgs buttonClickedArgs;
-    buttonClickedArgs.chooser = GTK_FILE_CHOOSER(widget);
-    buttonClickedArgs.map =
-        AddFiltersToDialogWithMap(GTK_FILE_CHOOSER(widget), args->filterList, args->filterCount);
-
-    /* Set the default path */
-    SetDefaultPath(GTK_FILE_CHOOSER(widget), args->defaultPath);
-
-    /* Set the default file name */
-    SetDefaultName(GTK_FILE_CHOOSER(widget), args->defaultName);
-
-    /* set the handler to add file extension */
-    gulong handlerID = g_signal_connect(G_OBJECT(saveButton),
-                                        "pressed",
-                                        G_CALLBACK(FileActivatedSignalHandler),
-                                        static_cast<void*>(&buttonClickedArgs));
-
-    gint result;
-    {
-        /* Parent the window properly */
-        NativeWindowParenter nativeWindowParenter(widget, args->parentWindow);
-
-        /* invoke the dialog (blocks until dialog is closed) */
-        result = RunDialogWithFocus(GTK_DIALOG(widget));
-    }
-
-    /* unset the handler */
-    g_signal_handler_disconnect(G_OBJECT(saveButton), handlerID);
-
-    /* free the filter map */
-    NFDi_Free(buttonClickedArgs.map);
-
-    if (result == GTK_RESPONSE_ACCEPT) {
-        // write out the file name
-        *outPath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(widget));
-
-        return NFD_OKAY;
-    } else {
-        return NFD_CANCEL;
-    }
+    return RunDialog(DIALOG_FUNCTION_SAVE, version, args, outPath, nullptr);
 }
 
 nfdresult_t NFD_SaveDialogU8(nfdu8char_t** outPath,
@@ -916,6 +1946,34 @@ nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
                                        const nfdsavedialogu8args_t* args)
     __attribute__((alias("NFD_SaveDialogN_With_Impl")));
 
+nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnchar_t* const* fileNames,
+                                    nfdpathsetsize_t fileCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdsavedialogmultiplenargs_t args{};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdsavedialogmultiplenargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_SAVE_MULTIPLE, version, args, nullptr, outPaths);
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8char_t* const* fileNames,
+                                     nfdpathsetsize_t fileCount,
+                                     const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_SaveDialogMultipleN")));
+
+nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdsavedialogmultipleu8args_t* args)
+    __attribute__((alias("NFD_SaveDialogMultipleN_With_Impl")));
+
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
     nfdpickfoldernargs_t args{};
     args.defaultPath = defaultPath;
@@ -925,41 +1983,7 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
 nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
-
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Select Folder",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Select",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
-
-    /* Set the default path */
-    SetDefaultPath(GTK_FILE_CHOOSER(widget), args->defaultPath);
-
-    gint result;
-    {
-        /* Parent the window properly */
-        NativeWindowParenter nativeWindowParenter(widget, args->parentWindow);
-
-        /* invoke the dialog (blocks until dialog is closed) */
-        result = RunDialogWithFocus(GTK_DIALOG(widget));
-    }
-
-    if (result == GTK_RESPONSE_ACCEPT) {
-        // write out the file name
-        *outPath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(widget));
-
-        return NFD_OKAY;
-    } else {
-        return NFD_CANCEL;
-    }
+    return RunDialog(DIALOG_FUNCTION_PICK_FOLDER, version, args, outPath, nullptr);
 }
 
 nfdresult_t NFD_PickFolderU8(nfdu8char_t** outPath, const nfdu8char_t* defaultPath)
@@ -979,42 +2003,7 @@ nfdresult_t NFD_PickFolderMultipleN(const nfdpathset_t** outPaths, const nfdncha
 nfdresult_t NFD_PickFolderMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
-
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Select Folders",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Select",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
-
-    /* Set the default path */
-    SetDefaultPath(GTK_FILE_CHOOSER(widget), args->defaultPath);
-
-    gint result;
-    {
-        /* Parent the window properly */
-        NativeWindowParenter nativeWindowParenter(widget, args->parentWindow);
-
-        /* invoke the dialog (blocks until dialog is closed) */
-        result = RunDialogWithFocus(GTK_DIALOG(widget));
-    }
-
-    if (result == GTK_RESPONSE_ACCEPT) {
-        // write out the file name
-        GSList* fileList = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(widget));
-
-        *outPaths = static_cast<void*>(fileList);
-        return NFD_OKAY;
-    } else {
-        return NFD_CANCEL;
-    }
+    return RunDialog(DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE, version, args, nullptr, outPaths);
 }
 
 nfdresult_t NFD_PickFolderMultipleU8(const nfdpathset_t** outPaths, const nfdu8char_t* defaultPath)
@@ -1024,84 +2013,3 @@ nfdresult_t NFD_PickFolderMultipleU8_With_Impl(nfdversion_t version,
                                                const nfdpathset_t** outPaths,
                                                const nfdpickfolderu8args_t* args)
     __attribute__((alias("NFD_PickFolderMultipleN_With_Impl")));
-
-nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
-    assert(pathSet);
-    // const_cast because methods on GSList aren't const, but it should act
-    // like const to the caller
-    GSList* fileList = const_cast<GSList*>(static_cast<const GSList*>(pathSet));
-
-    *count = g_slist_length(fileList);
-    return NFD_OKAY;
-}
-
-nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
-                                 nfdpathsetsize_t index,
-                                 nfdnchar_t** outPath) {
-    assert(pathSet);
-    // const_cast because methods on GSList aren't const, but it should act
-    // like const to the caller
-    GSList* fileList = const_cast<GSList*>(static_cast<const GSList*>(pathSet));
-
-    // Note: this takes linear time... but should be good enough
-    *outPath = static_cast<nfdnchar_t*>(g_slist_nth_data(fileList, index));
-
-    return NFD_OKAY;
-}
-
-nfdresult_t NFD_PathSet_GetPathU8(const nfdpathset_t* pathSet,
-                                  nfdpathsetsize_t index,
-                                  nfdu8char_t** outPath)
-    __attribute__((alias("NFD_PathSet_GetPathN")));
-
-void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
-    assert(filePath);
-    (void)filePath;  // prevent warning in release build
-    // no-op, because NFD_PathSet_Free does the freeing for us
-}
-
-void NFD_PathSet_FreePathU8(const nfdu8char_t* filePath)
-    __attribute__((alias("NFD_PathSet_FreePathN")));
-
-void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
-    assert(pathSet);
-    // const_cast because methods on GSList aren't const, but it should act
-    // like const to the caller
-    GSList* fileList = const_cast<GSList*>(static_cast<const GSList*>(pathSet));
-
-    // free all the nodes
-    for (GSList* node = fileList; node; node = node->next) {
-        assert(node->data);
-        g_free(node->data);
-    }
-
-    // free the path set memory
-    g_slist_free(fileList);
-}
-
-nfdresult_t NFD_PathSet_GetEnum(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator) {
-    // The pathset (GSList) is already a linked list, so the enumeration is itself
-    outEnumerator->ptr = const_cast<void*>(pathSet);
-
-    return NFD_OKAY;
-}
-
-void NFD_PathSet_FreeEnum(nfdpathsetenum_t*) {
-    // Do nothing, because the enumeration is the pathset itself
-}
-
-nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath) {
-    const GSList* fileList = static_cast<const GSList*>(enumerator->ptr);
-
-    if (fileList) {
-        *outPath = static_cast<nfdnchar_t*>(fileList->data);
-        enumerator->ptr = static_cast<void*>(fileList->next);
-    } else {
-        *outPath = nullptr;
-    }
-
-    return NFD_OKAY;
-}
-
-nfdresult_t NFD_PathSet_EnumNextU8(nfdpathsetenum_t* enumerator, nfdu8char_t** outPath)
-    __attribute__((alias("NFD_PathSet_EnumNextN")));
@@ -0,0 +1,846 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+  Authors: Bernard Teo, Michael Labbe
+
+  This is the GTK 4 implementation, which uses GtkFileDialog (GTK 4.10 or later).
+
+  Note: We do not check for malloc failure on Linux - Linux overcommits memory!
+*/
+
+#include <gtk/gtk.h>
+
+#if defined(NFD_X11)
+#if !defined(GDK_WINDOWING_X11)
+#if defined(__GNUC__)
+#pragma GCC warning \
+    "NFD is built with X11 but GTK does not support X11, so window parenting will not work."
+#endif
+#undef NFD_X11
+#endif
+#endif
+#if defined(NFD_WAYLAND)
+#if defined(GDK_WINDOWING_WAYLAND)
+// GTK 4 can only parent dialogs to its own windows, which are found by their wl_surface, so the
+// xdg-foreign exports in nfd_linux_shared.hpp are not needed.
+#define NFD_GTK4_WAYLAND
+#elif defined(__GNUC__)
+#pragma GCC warning \
+    "NFD is built with Wayland but GTK does not support Wayland, so window parenting will not work."
+#endif
+#undef NFD_WAYLAND
+#endif
+
+#if defined(NFD_X11)
+#include <gdk/x11/gdkx.h>
+#endif
+#if defined(NFD_GTK4_WAYLAND)
+#include <gdk/wayland/gdkwayland.h>
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfd.h"
+
+#include "nfd_linux_shared.hpp"
+
+/*
+Define NFD_CASE_SENSITIVE_FILTER if you want file filters to be case-sensitive.  The default
+is case-insensitive.  While Linux uses a case-sensitive filesystem and is designed for
+case-sensitive file extensions, perhaps in the vast majority of cases users actually expect the file
+filters to be case-insensitive.
+*/
+
+namespace {
+
+/* current error */
+thread_local const char* g_errorstr = nullptr;
+
+void NFDi_SetError(const char* msg) {
+    g_errorstr = msg;
+}
+
+#ifndef NFD_CASE_SENSITIVE_FILTER
+// Returns true if the filter spec item [begin, end) is a plain file extension (i.e. it is neither a
+// MIME type nor contains glob characters).
+bool IsPlainExtensionItem(const nfdnchar_t* begin, const nfdnchar_t* end) {
+    for (; begin != end; ++begin) {
+        if (*begin == '/' || *begin == '*' || *begin == '?' || *begin == '[') return false;
+    }
+    return true;
+}
+#endif
+
+// Adds the filter spec item [begin, end) (a file extension or a MIME type) to the filter, using
+// `buf` (which must have space for (end - begin) * 4 + 3 characters) to build the pattern.
+void AddFilterSpecItem(GtkFileFilter* filter,
+                       const nfdnchar_t* begin,
+                       const nfdnchar_t* end,
+                       nfdnchar_t* buf) {
+    if (IsMimeTypeFilterItem(begin, end)) {
+        *copy(begin, end, buf) = '\0';
+        gtk_file_filter_add_mime_type(filter, buf);
+        return;
+    }
+#ifndef NFD_CASE_SENSITIVE_FILTER
+    if (IsPlainExtensionItem(begin, end)) {
+        // GTK always matches suffixes case-insensitively
+        *copy(begin, end, buf) = '\0';
+        gtk_file_filter_add_suffix(filter, buf);
+        return;
+    }
+#endif
+    nfdnchar_t* p_bufEnd = buf;
+    *p_bufEnd++ = '*';
+    *p_bufEnd++ = '.';
+#ifdef NFD_CASE_SENSITIVE_FILTER
+    p_bufEnd = copy(begin, end, p_bufEnd);
+#else
+    // Each character in the Latin alphabet is converted into 4 characters.  E.g. 'a' is converted
+    // into "[Aa]".  Other characters are preserved.
+    p_bufEnd = emit_case_insensitive_glob(begin, end, p_bufEnd);
+#endif
+    *p_bufEnd++ = '\0';
+    gtk_file_filter_add_pattern(filter, buf);
+}
+
+// Sets the filters (and "All files") of the dialog.
+void SetFilters(GtkFileDialog* dialog,
+                const nfdnfilteritem_t* filterList,
+                nfdfiltersize_t filterCount) {
+    if (!filterCount) return;
+
+    // the buffer for building the names and patterns must fit the longest of them
+    size_t bufLength = 0;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        size_t sep = 1;
+        size_t itemLength = 0;
+        size_t maxItemLength = 0;
+        for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
+            if (*p_spec == ',') {
+                ++sep;
+                itemLength = 0;
+            } else if (++itemLength > maxItemLength) {
+                maxItemLength = itemLength;
+            }
+        }
+        // friendly name conversions: "png,jpg" -> "Image files (png, jpg)" (including the
+        // trailing '\0')
+        const size_t nameSize =
+            sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+        if (nameSize > bufLength) bufLength = nameSize;
+        if (maxItemLength * 4 + 3 > bufLength) bufLength = maxItemLength * 4 + 3;
+    }
+    nfdnchar_t* buf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * bufLength);
+    Free_Guard<nfdnchar_t> bufGuard(buf);
+
+    GListStore* filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        const nfdnchar_t* name = filterList[index].name;
+        const nfdnchar_t* spec = filterList[index].spec;
+
+        GtkFileFilter* filter = gtk_file_filter_new();
+
+        const nfdnchar_t* p_extensionStart = spec;
+        for (const nfdnchar_t* p_spec = spec; true; ++p_spec) {
+            if (*p_spec == ',' || !*p_spec) {
+                AddFilterSpecItem(filter, p_extensionStart, p_spec, buf);
+
+                if (!*p_spec) break;  // reached the '\0' character
+                // update the extension start point
+                p_extensionStart = p_spec + 1;
+            }
+        }
+
+        nfdnchar_t* p_nameBuf = copy(name, name + strlen(name), buf);
+        *p_nameBuf++ = ' ';
+        *p_nameBuf++ = '(';
+        for (const nfdnchar_t* p_spec = spec; *p_spec; ++p_spec) {
+            if (*p_spec == ',') {
+                *p_nameBuf++ = ',';
+                *p_nameBuf++ = ' ';
+            } else {
+                *p_nameBuf++ = *p_spec;
+            }
+        }
+        *p_nameBuf++ = ')';
+        *p_nameBuf++ = '\0';
+        assert(static_cast<size_t>(p_nameBuf - buf) <= bufLength);
+
+        gtk_file_filter_set_name(filter, buf);
+        g_list_store_append(filters, filter);
+        if (index == 0) gtk_file_dialog_set_default_filter(dialog, filter);
+        g_object_unref(filter);
+    }
+
+    /* always append a wildcard option to the end*/
+    GtkFileFilter* allFilesFilter = gtk_file_filter_new();
+    gtk_file_filter_set_name(allFilesFilter, "All files");
+    gtk_file_filter_add_pattern(allFilesFilter, "*");
+    g_list_store_append(filters, allFilesFilter);
+    g_object_unref(allFilesFilter);
+
+    gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+    g_object_unref(filters);
+}
+
+void SetDefaultPath(GtkFileDialog* dialog, const char* defaultPath) {
+    if (!defaultPath || !*defaultPath) return;
+
+    /* GTK+ manual recommends not specifically setting the default path.
+    We do it anyway in order to be consistent across platforms.
+
+    If consistency with the native OS is preferred, this is the line
+    to comment out. -ml */
+    GFile* folder = g_file_new_for_path(defaultPath);
+    gtk_file_dialog_set_initial_folder(dialog, folder);
+    g_object_unref(folder);
+}
+
+void SetDefaultName(GtkFileDialog* dialog, const char* defaultName) {
+    if (!defaultName || !*defaultName) return;
+
+    gtk_file_dialog_set_initial_name(dialog, defaultName);
+}
+
+// Returns true if the GTK window is the native window that `parentWindow` refers to.
+bool IsParentWindow(GtkWindow* window, const nfdwindowhandle_t& parentWindow) {
+    GdkSurface* surface = gtk_native_get_surface(GTK_NATIVE(window));
+    if (!surface) return false;  // the window is not realized
+    switch (parentWindow.type) {
+#if defined(NFD_X11)
+        case NFD_WINDOW_HANDLE_TYPE_X11:
+            return GDK_IS_X11_SURFACE(surface) &&
+                   gdk_x11_surface_get_xid(surface) ==
+                       reinterpret_cast<Window>(parentWindow.handle);
+#endif
+#if defined(NFD_GTK4_WAYLAND)
+        case NFD_WINDOW_HANDLE_TYPE_WAYLAND:
+            return GDK_IS_WAYLAND_SURFACE(surface) &&
+                   gdk_wayland_surface_get_wl_surface(surface) ==
+                       static_cast<struct wl_surface*>(parentWindow.handle);
+#endif
+        default:
+            return false;
+    }
+}
+
+// Finds the parent window among the application's own GTK windows, because GtkFileDialog can only
+// be parented to a GtkWindow.  Returns null if the handle is unset or is not a GTK window (e.g. if
+// the application does not use GTK for its windows), in which case the dialog has no parent.
+GtkWindow* FindParentWindow(const nfdwindowhandle_t& parentWindow) {
+    if (parentWindow.type == NFD_WINDOW_HANDLE_TYPE_UNSET) return nullptr;
+    GListModel* toplevels = gtk_window_get_toplevels();
+    for (guint index = 0, count = g_list_model_get_n_items(toplevels); index != count; ++index) {
+        GtkWindow* window = GTK_WINDOW(g_list_model_get_item(toplevels, index));
+        // the window is kept alive by GTK, so we don't need our reference
+        g_object_unref(window);
+        if (IsParentWindow(window, parentWindow)) return window;
+    }
+    return nullptr;
+}
+
+// Gets the path of `file` (or its URI if `uri` is true), to be freed with g_free.  Returns null
+// (and sets the error) if the file has no path.
+gchar* GetFileString(GFile* file, bool uri) {
+    if (uri) return g_file_get_uri(file);
+    gchar* path = g_file_get_path(file);
+    if (!path) NFDi_SetError("GTK returned a file that has no local path.");
+    return path;
+}
+
+// Copies the paths of the files in `files` (a GListModel of GFile, as returned by GtkFileDialog)
+// into a new path set.
+nfdresult_t GetPathSet(GListModel* files, bool uris, const nfdpathset_t** outPaths) {
+    // build the list from the back, so that it ends up in the same order as `files`
+    GSList* fileList = nullptr;
+    for (guint index = g_list_model_get_n_items(files); index != 0; --index) {
+        GFile* file = G_FILE(g_list_model_get_item(files, index - 1));
+        gchar* path = GetFileString(file, uris);
+        g_object_unref(file);
+        if (!path) {
+            g_slist_free_full(fileList, &g_free);
+            return NFD_ERROR;
+        }
+        fileList = g_slist_prepend(fileList, path);
+    }
+
+    *outPaths = AllocPathSet(fileList);
+    return NFD_OKAY;
+}
+
+// The dialog functions, which are run by RunDialog and by dialog requests.
+enum DialogFunction {
+    DIALOG_FUNCTION_OPEN,
+    DIALOG_FUNCTION_OPEN_MULTIPLE,
+    DIALOG_FUNCTION_SAVE,
+    DIALOG_FUNCTION_SAVE_MULTIPLE,
+    DIALOG_FUNCTION_PICK_FOLDER,
+    DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE
+};
+
+// A dialog that has been started with StartDialog, which is what an nfdgtkrequest_t points to.  The
+// request is done when GtkFileDialog calls DialogFinishedCallback.
+struct DialogRequest {
+    DialogFunction function;
+    const void* args;
+    bool uris;                // whether the caller asked for URIs
+    void (*callback)(void*);  // called when the request is done, if not null
+    void* userData;
+    bool done;
+    nfdresult_t result;
+    nfdnchar_t* path;           // for dialogs that return one path
+    const nfdpathset_t* paths;  // for dialogs that return a path set
+    const char* error;          // if result is NFD_ERROR
+};
+
+// Gets the result of a GtkFileDialog call that has finished, in the same way as the dialog
+// function.
+nfdresult_t GetDialogResult(DialogRequest* request, GtkFileDialog* dialog, GAsyncResult* result) {
+    GError* error = nullptr;
+    nfdresult_t res = NFD_OKAY;
+    switch (request->function) {
+        case DIALOG_FUNCTION_OPEN:
+        case DIALOG_FUNCTION_SAVE:
+        case DIALOG_FUNCTION_PICK_FOLDER: {
+            GFile* file;
+            if (request->function == DIALOG_FUNCTION_OPEN) {
+                file = gtk_file_dialog_open_finish(dialog, result, &error);
+            } else if (request->function == DIALOG_FUNCTION_SAVE) {
+                // NFD_APPEND_EXTENSION is not supported: GtkFileDialog has already confirmed
+                // overwriting the file that the user chose, not the one with the extension appended
+                file = gtk_file_dialog_save_finish(dialog, result, &error);
+            } else {
+                file = gtk_file_dialog_select_folder_finish(dialog, result, &error);
+            }
+            if (!file) break;
+            // write out the file name
+            request->path = GetFileString(file, request->uris);
+            if (!request->path) res = NFD_ERROR;
+            g_object_unref(file);
+            break;
+        }
+        case DIALOG_FUNCTION_SAVE_MULTIPLE: {
+            GFile* folder = gtk_file_dialog_select_folder_finish(dialog, result, &error);
+            if (!folder) break;
+            const nfdsavedialogmultiplenargs_t* saveArgs =
+                static_cast<const nfdsavedialogmultiplenargs_t*>(request->args);
+            // join each file name to the selected folder, building the list from the back so that
+            // it ends up in the same order as fileNames
+            GSList* fileList = nullptr;
+            for (nfdpathsetsize_t i = saveArgs->fileCount; i != 0; --i) {
+                GFile* file = g_file_get_child(folder, saveArgs->fileNames[i - 1]);
+                gchar* path = GetFileString(file, request->uris);
+                g_object_unref(file);
+                if (!path) {
+                    g_slist_free_full(fileList, &g_free);
+                    fileList = nullptr;
+                    res = NFD_ERROR;
+                    break;
+                }
+                fileList = g_slist_prepend(fileList, path);
+            }
+            g_object_unref(folder);
+
+            if (res == NFD_OKAY) request->paths = AllocPathSet(fileList);
+            break;
+        }
+        case DIALOG_FUNCTION_OPEN_MULTIPLE:
+        case DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE: {
+            GListModel* files =
+                request->function == DIALOG_FUNCTION_OPEN_MULTIPLE
+                    ? gtk_file_dialog_open_multiple_finish(dialog, result, &error)
+                    : gtk_file_dialog_select_multiple_folders_finish(dialog, result, &error);
+            if (!files) break;
+            // write out the file names
+            res = GetPathSet(files, request->uris, &request->paths);
+            g_object_unref(files);
+            break;
+        }
+    }
+
+    if (error) {
+        // the user closing the dialog is reported as an error too
+        if (g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_DISMISSED) ||
+            g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_CANCELLED)) {
+            res = NFD_CANCEL;
+        } else {
+            NFDi_SetError("GTK failed to show the file dialog.");
+            res = NFD_ERROR;
+        }
+        g_error_free(error);
+    }
+    return res;
+}
+
+void DialogFinishedCallback(GObject* source, GAsyncResult* result, gpointer userdata) {
+    DialogRequest* request = static_cast<DialogRequest*>(userdata);
+    GtkFileDialog* dialog = GTK_FILE_DIALOG(source);
+    request->result = GetDialogResult(request, dialog, result);
+    if (request->result == NFD_ERROR) request->error = g_errorstr;
+    g_object_unref(dialog);
+
+    void (*callback)(void*) = request->callback;
+    void* userData = request->userData;
+    // the request may be freed by its owner as soon as it is marked as done
+    request->done = true;
+    if (callback) callback(userData);
+}
+
+// Sets up a GtkFileDialog according to the request's arguments, and starts it.  The dialog is
+// modal (to the parent window, if any) if `modal` is true.  Returns NFD_ERROR (and sets the error)
+// if the arguments are invalid.
+nfdresult_t StartDialog(DialogRequest* request, nfdversion_t version, bool modal) {
+    request->done = false;
+    request->path = nullptr;
+    request->paths = nullptr;
+
+    GtkFileDialog* dialog = gtk_file_dialog_new();
+    gtk_file_dialog_set_modal(dialog, modal);
+    switch (request->function) {
+        case DIALOG_FUNCTION_OPEN:
+        case DIALOG_FUNCTION_OPEN_MULTIPLE: {
+            const nfdopendialognargs_t* openArgs =
+                static_cast<const nfdopendialognargs_t*>(request->args);
+            const bool multiple = request->function == DIALOG_FUNCTION_OPEN_MULTIPLE;
+            request->uris = WantsUris(version, openArgs);
+            gtk_file_dialog_set_title(dialog, multiple ? "Open Files" : "Open File");
+            gtk_file_dialog_set_accept_label(dialog, "_Open");
+
+            /* Build the filter list */
+            SetFilters(dialog, openArgs->filterList, openArgs->filterCount);
+
+            /* Set the default path */
+            SetDefaultPath(dialog, openArgs->defaultPath);
+
+            GtkWindow* parent = FindParentWindow(openArgs->parentWindow);
+            if (multiple) {
+                gtk_file_dialog_open_multiple(
+                    dialog, parent, nullptr, &DialogFinishedCallback, request);
+            } else {
+                gtk_file_dialog_open(dialog, parent, nullptr, &DialogFinishedCallback, request);
+            }
+            return NFD_OKAY;
+        }
+        case DIALOG_FUNCTION_SAVE: {
+            const nfdsavedialognargs_t* saveArgs =
+                static_cast<const nfdsavedialognargs_t*>(request->args);
+            request->uris = WantsUris(version, saveArgs);
+            gtk_file_dialog_set_title(dialog, "Save File");
+            gtk_file_dialog_set_accept_label(dialog, "_Save");
+
+            /* Build the filter list */
+            SetFilters(dialog, saveArgs->filterList, saveArgs->filterCount);
+
+            /* Set the default path */
+            SetDefaultPath(dialog, saveArgs->defaultPath);
+
+            /* Set the default file name */
+            SetDefaultName(dialog, saveArgs->defaultName);
+
+            gtk_file_dialog_save(dialog,
+                                 FindParentWindow(saveArgs->parentWindow),
+                                 nullptr,
+                                 &DialogFinishedCallback,
+                                 request);
+            return NFD_OKAY;
+        }
+        case DIALOG_FUNCTION_SAVE_MULTIPLE: {
+            const nfdsavedialogmultiplenargs_t* saveArgs =
+                static_cast<const nfdsavedialogmultiplenargs_t*>(request->args);
+            const char* fileNamesError =
+                CheckSaveFileNames(saveArgs->fileNames, saveArgs->fileCount);
+            if (fileNamesError) {
+                g_object_unref(dialog);
+                NFDi_SetError(fileNamesError);
+                return NFD_ERROR;
+            }
+            request->uris = WantsUris(version, saveArgs);
+
+            // GTK has no dialog for saving multiple files, so we ask for the folder to save them
+            // into.
+            gtk_file_dialog_set_title(dialog, "Save Files");
+            gtk_file_dialog_set_accept_label(dialog, "_Save");
+
+            /* Set the default path */
+            SetDefaultPath(dialog, saveArgs->defaultPath);
+
+            gtk_file_dialog_select_folder(dialog,
+                                          FindParentWindow(saveArgs->parentWindow),
+                                          nullptr,
+                                          &DialogFinishedCallback,
+                                          request);
+            return NFD_OKAY;
+        }
+        case DIALOG_FUNCTION_PICK_FOLDER:
+        case DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE: {
+            const nfdpickfoldernargs_t* pickArgs =
+                static_cast<const nfdpickfoldernargs_t*>(request->args);
+            const bool multiple = request->function == DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE;
+            request->uris = WantsUris(version, pickArgs);
+            gtk_file_dialog_set_title(dialog, multiple ? "Select Folders" : "Select Folder");
+            gtk_file_dialog_set_accept_label(dialog, "_Select");
+
+            /* Set the default path */
+            SetDefaultPath(dialog, pickArgs->defaultPath);
+
+            GtkWindow* parent = FindParentWindow(pickArgs->parentWindow);
+            if (multiple) {
+                gtk_file_dialog_select_multiple_folders(
+                    dialog, parent, nullptr, &DialogFinishedCallback, request);
+            } else {
+                gtk_file_dialog_select_folder(
+                    dialog, parent, nullptr, &DialogFinishedCallback, request);
+            }
+            return NFD_OKAY;
+        }
+    }
+    g_object_unref(dialog);
+    return NFD_ERROR;
+}
+
+// Iterates the default main context until the request is done (GtkFileDialog only reports the
+// result from there), and gives its result to the caller, in the same way as the dialog function.
+nfdresult_t WaitForDialog(DialogRequest* request,
+                          nfdnchar_t** outPath,
+                          const nfdpathset_t** outPaths) {
+    while (!request->done) g_main_context_iteration(nullptr, TRUE);
+    if (request->result == NFD_OKAY) {
+        if (outPath) *outPath = request->path;
+        if (outPaths) *outPaths = request->paths;
+    } else if (request->result == NFD_ERROR) {
+        NFDi_SetError(request->error);
+    }
+    return request->result;
+}
+
+// Runs the dialog of a dialog function, and waits for the user to close it.
+nfdresult_t RunDialog(DialogFunction function,
+                      nfdversion_t version,
+                      const void* args,
+                      nfdnchar_t** outPath,
+                      const nfdpathset_t** outPaths) {
+    DialogRequest request;
+    request.function = function;
+    request.args = args;
+    request.callback = nullptr;
+    request.userData = nullptr;
+    if (StartDialog(&request, version, true) != NFD_OKAY) return NFD_ERROR;
+    return WaitForDialog(&request, outPath, outPaths);
+}
+
+// Starts a dialog request, whose dialog is not modal.
+nfdresult_t StartDialogRequest(DialogFunction function,
+                               nfdversion_t version,
+                               const void* args,
+                               void (*callback)(void*),
+                               void* userData,
+                               nfdgtkrequest_t** outRequest) {
+    DialogRequest* request = NFDi_Malloc<DialogRequest>(sizeof(DialogRequest));
+    request->function = function;
+    request->args = args;
+    request->callback = callback;
+    request->userData = userData;
+    if (StartDialog(request, version, false) != NFD_OKAY) {
+        NFDi_Free(request);
+        return NFD_ERROR;
+    }
+    *outRequest = static_cast<nfdgtkrequest_t*>(request);
+    return NFD_OKAY;
+}
+
+// Waits for the request to be done, gives its result to the caller, and frees it.
+nfdresult_t FinishDialogRequest(nfdgtkrequest_t* handle,
+                                nfdnchar_t** outPath,
+                                const nfdpathset_t** outPaths) {
+    assert(handle);
+    DialogRequest* request = static_cast<DialogRequest*>(handle);
+    const nfdresult_t result = WaitForDialog(request, outPath, outPaths);
+    NFDi_Free(request);
+    return result;
+}
+
+}  // namespace
+
+const char* NFD_GetError(void) {
+    return g_errorstr;
+}
+
+void NFD_ClearError(void) {
+    NFDi_SetError(nullptr);
+}
+
+/* public */
+
+nfdresult_t NFD_Init(void) {
+    // Init GTK
+    if (!gtk_init_check()) {
+        NFDi_SetError("Failed to initialize GTK with gtk_init_check.");
+        return NFD_ERROR;
+    }
+    return NFD_OKAY;
+}
+
+void NFD_Quit(void) {
+    // do nothing, GTK cannot be de-initialized
+}
+
+void NFD_PumpEvents(void) {
+    g_main_context_iteration(nullptr, FALSE);
+}
+
+nfdresult_t NFD_SetWaylandDisplay(struct wl_display* display) {
+    // GTK parents the dialog on its own Wayland connection, so the display is not needed
+    (void)display;
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_ReleaseWaylandSurface(struct wl_surface* surface) {
+    // nothing is exported, so there is nothing to release
+    (void)surface;
+    return NFD_OKAY;
+}
+
+void NFD_GTK_SetDialogPoolEnabled(int enabled) {
+    // GtkFileDialog creates a new dialog every time, so there is no pool
+    (void)enabled;
+}
+
+void NFD_GTK_TrimDialogPool(void) {
+    // GtkFileDialog creates a new dialog every time, so there is no pool
+}
+
+nfdresult_t NFD_GTK_StartOpenDialog_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdopendialognargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_OPEN, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartOpenDialogMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdopendialognargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_OPEN_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartSaveDialog_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdsavedialognargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_SAVE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartSaveDialogMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdsavedialogmultiplenargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_SAVE_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartPickFolder_Impl(nfdversion_t version,
+                                         nfdgtkrequest_t** outRequest,
+                                         const nfdpickfoldernargs_t* args,
+                                         void (*callback)(void*),
+                                         void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_PICK_FOLDER, version, args, callback, userData, outRequest);
+}
+
+nfdresult_t NFD_GTK_StartPickFolderMultiple_Impl(nfdversion_t version,
+                                                 nfdgtkrequest_t** outRequest,
+                                                 const nfdpickfoldernargs_t* args,
+                                                 void (*callback)(void*),
+                                                 void* userData) {
+    return StartDialogRequest(
+        DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE, version, args, callback, userData, outRequest);
+}
+
+int NFD_GTK_IsRequestDone(const nfdgtkrequest_t* request) {
+    assert(request);
+    return static_cast<const DialogRequest*>(request)->done;
+}
+
+nfdresult_t NFD_GTK_FinishRequest(nfdgtkrequest_t* request, nfdnchar_t** outPath) {
+    return FinishDialogRequest(request, outPath, nullptr);
+}
+
+nfdresult_t NFD_GTK_FinishRequestMultiple(nfdgtkrequest_t* request,
+                                          const nfdpathset_t** outPaths) {
+    return FinishDialogRequest(request, nullptr, outPaths);
+}
+
+void NFD_FreePathN(nfdnchar_t* filePath) {
+    assert(filePath);
+    g_free(filePath);
+}
+
+void NFD_FreePathU8(nfdu8char_t* filePath) __attribute__((alias("NFD_FreePathN")));
+
+nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath) {
+    nfdopendialognargs_t args{};
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    args.defaultPath = defaultPath;
+    return NFD_OpenDialogN_With_Impl(NFD_INTERFACE_VERSION, outPath, &args);
+}
+
+nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
+                                      nfdnchar_t** outPath,
+                                      const nfdopendialognargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_OPEN, version, args, outPath, nullptr);
+}
+
+nfdresult_t NFD_OpenDialogU8(nfdu8char_t** outPath,
+                             const nfdu8filteritem_t* filterList,
+                             nfdfiltersize_t filterCount,
+                             const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_OpenDialogN")));
+
+nfdresult_t NFD_OpenDialogU8_With_Impl(nfdversion_t version,
+                                       nfdu8char_t** outPath,
+                                       const nfdopendialogu8args_t* args)
+    __attribute__((alias("NFD_OpenDialogN_With_Impl")));
+
+nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnfilteritem_t* filterList,
+                                    nfdfiltersize_t filterCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdopendialognargs_t args{};
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    args.defaultPath = defaultPath;
+    return NFD_OpenDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_OpenDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdopendialognargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_OPEN_MULTIPLE, version, args, nullptr, outPaths);
+}
+
+nfdresult_t NFD_OpenDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8filteritem_t* filterList,
+                                     nfdfiltersize_t filterCount,
+                                     const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_OpenDialogMultipleN")));
+
+nfdresult_t NFD_OpenDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdopendialogu8args_t* args)
+    __attribute__((alias("NFD_OpenDialogMultipleN_With_Impl")));
+
+nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath,
+                            const nfdnchar_t* defaultName) {
+    nfdsavedialognargs_t args{};
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    args.defaultPath = defaultPath;
+    args.defaultName = defaultName;
+    return NFD_SaveDialogN_With_Impl(NFD_INTERFACE_VERSION, outPath, &args);
+}
+
+nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
+                                      nfdnchar_t** outPath,
+                                      const nfdsavedialognargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_SAVE, version, args, outPath, nullptr);
+}
+
+nfdresult_t NFD_SaveDialogU8(nfdu8char_t** outPath,
+                             const nfdu8filteritem_t* filterList,
+                             nfdfiltersize_t filterCount,
+                             const nfdu8char_t* defaultPath,
+                             const nfdu8char_t* defaultName)
+    __attribute__((alias("NFD_SaveDialogN")));
+
+nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
+                                       nfdu8char_t** outPath,
+                                       const nfdsavedialogu8args_t* args)
+    __attribute__((alias("NFD_SaveDialogN_With_Impl")));
+
+nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnchar_t* const* fileNames,
+                                    nfdpathsetsize_t fileCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdsavedialogmultiplenargs_t args{};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdsavedialogmultiplenargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_SAVE_MULTIPLE, version, args, nullptr, outPaths);
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8char_t* const* fileNames,
+                                     nfdpathsetsize_t fileCount,
+                                     const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_SaveDialogMultipleN")));
+
+nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdsavedialogmultipleu8args_t* args)
+    __attribute__((alias("NFD_SaveDialogMultipleN_With_Impl")));
+
+nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
+    nfdpickfoldernargs_t args{};
+    args.defaultPath = defaultPath;
+    return NFD_PickFolderN_With_Impl(NFD_INTERFACE_VERSION, outPath, &args);
+}
+
+nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
+                                      nfdnchar_t** outPath,
+                                      const nfdpickfoldernargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_PICK_FOLDER, version, args, outPath, nullptr);
+}
+
+nfdresult_t NFD_PickFolderU8(nfdu8char_t** outPath, const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_PickFolderN")));
+
+nfdresult_t NFD_PickFolderU8_With_Impl(nfdversion_t version,
+                                       nfdu8char_t** outPath,
+                                       const nfdpickfolderu8args_t* args)
+    __attribute__((alias("NFD_PickFolderN_With_Impl")));
+
+nfdresult_t NFD_PickFolderMultipleN(const nfdpathset_t** outPaths, const nfdnchar_t* defaultPath) {
+    nfdpickfoldernargs_t args{};
+    args.defaultPath = defaultPath;
+    return NFD_PickFolderMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_PickFolderMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdpickfoldernargs_t* args) {
+    return RunDialog(DIALOG_FUNCTION_PICK_FOLDER_MULTIPLE, version, args, nullptr, outPaths);
+}
+
+nfdresult_t NFD_PickFolderMultipleU8(const nfdpathset_t** outPaths, const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_PickFolderMultipleN")));
+
+nfdresult_t NFD_PickFolderMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdpickfolderu8args_t* args)
+    __attribute__((alias("NFD_PickFolderMultipleN_With_Impl")));
@@ -9,6 +9,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "nfd.h"
 
@@ -27,6 +28,14 @@ T* NFDi_Malloc(size_t bytes) {
     return static_cast<T*>(ptr);
 }
 
+template <typename T>
+T* NFDi_Realloc(T* ptr, size_t bytes) {
+    void* newPtr = realloc(static_cast<void*>(ptr), bytes);
+    assert(newPtr);  // Linux realloc never fails
+
+    return static_cast<T*>(newPtr);
+}
+
 template <typename T>
 void NFDi_Free(T* ptr) {
     assert(ptr);
@@ -57,6 +66,38 @@ T* copy(const T* begin, const T* end, T* out) {
     return out;
 }
 
+// Returns true if the filter spec item [begin, end) is a MIME type (e.g. "image/*") rather than a
+// file extension.  File names cannot contain '/', so no extension does.
+bool IsMimeTypeFilterItem(const nfdnchar_t* begin, const nfdnchar_t* end) {
+    for (; begin != end; ++begin) {
+        if (*begin == '/') return true;
+    }
+    return false;
+}
+
+// Checks the file names given to NFD_SaveDialogMultiple.  Each of them must name a file directly
+// inside the chosen folder, so it must not be empty, "." or "..", and must not contain '/'.
+// Returns the error message, or nullptr if all the names are valid.
+const char* CheckSaveFileNames(const nfdnchar_t* const* fileNames, nfdpathsetsize_t fileCount) {
+    if (fileCount == 0) return "At least one file name is required to save multiple files.";
+    for (nfdpathsetsize_t i = 0; i != fileCount; ++i) {
+        const nfdnchar_t* name = fileNames[i];
+        const bool isDots =
+            name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+        if (name[0] == '\0' || isDots || strchr(name, '/')) {
+            return "File names to save must not be empty, \".\" or \"..\", or contain '/'.";
+        }
+    }
+    return nullptr;
+}
+
+// Returns true if the caller of a *_With() function asked for URIs instead of paths.
+template <typename Args>
+bool WantsUris(nfdversion_t version, const Args* args) {
+    // pathFormat was added in version 3 of the interface
+    return version >= 3 && args->pathFormat == NFD_PATH_FORMAT_URI;
+}
+
 #ifndef NFD_CASE_SENSITIVE_FILTER
 nfdnchar_t* emit_case_insensitive_glob(const nfdnchar_t* begin,
                                        const nfdnchar_t* end,
@@ -80,10 +121,32 @@ nfdnchar_t* emit_case_insensitive_glob(const nfdnchar_t* begin,
 
 #ifdef NFD_WAYLAND
 struct wl_display* wayland_display;
+/* the queue of all our Wayland objects, so that our round-trips never dispatch the events of the
+ * application's objects (possibly on a thread that the application doesn't expect) */
+struct wl_event_queue* wayland_queue;
 struct wl_registry* wayland_registry;
 uint32_t wayland_xdg_exporter_v1_name;
 struct zxdg_exporter_v1* wayland_xdg_exporter_v1;
 constexpr const char* XDG_EXPORTER_V1 = "zxdg_exporter_v1";
+/* a surface that has been exported for use as a parent window, kept alive while dialogs use it, and
+ * afterwards too if wayland_export_cache_enabled, so that later dialogs with the same parent don't
+ * need to wait for the compositor */
+struct WaylandExport {
+    WaylandExport* next;
+    struct wl_surface* surface;  // null once the export has been detached from the cache
+    struct zxdg_exported_v1* exported;  // null if the exporter went away while it was in use
+    char* handle;
+    size_t useCount;  // number of open dialogs that use this export as their parent
+};
+constexpr size_t WAYLAND_EXPORT_CACHE_SIZE = 8;
+/* exports that are in use or cached, most recently used first; exports that are in use are never
+ * evicted, so there may be more than WAYLAND_EXPORT_CACHE_SIZE of them */
+WaylandExport* wayland_exports;
+/* whether exports are kept after their dialogs are closed; the surfaces are identified by their
+ * addresses and the client cannot tell when a surface is destroyed, so this is only turned on once
+ * the application calls NFD_ReleaseWaylandSurface (which shows that it releases its surfaces before
+ * destroying them), and stays on */
+bool wayland_export_cache_enabled;
 #endif
 
 void EmptyFn(void*) {}
@@ -96,6 +159,59 @@ struct DestroyFunc {
 };
 
 #ifdef NFD_WAYLAND
+void DestroyWaylandExport(WaylandExport* entry) {
+    if (entry->exported) zxdg_exported_v1_destroy(entry->exported);
+    NFDi_Free(entry->handle);
+    NFDi_Free(entry);
+}
+
+// Removes an export from the cache.  If a dialog still uses it, it is destroyed when the last such
+// dialog is closed instead.
+void DetachWaylandExport(WaylandExport* entry) {
+    if (entry->useCount == 0) {
+        DestroyWaylandExport(entry);
+        return;
+    }
+    entry->surface = nullptr;
+}
+
+void NFD_Wayland_ClearExports(void) {
+    while (wayland_exports) {
+        WaylandExport* entry = wayland_exports;
+        wayland_exports = entry->next;
+        // the exporter or the display is going away, so the proxy must not outlive this
+        if (entry->useCount != 0) {
+            zxdg_exported_v1_destroy(entry->exported);
+            entry->exported = nullptr;
+        }
+        DetachWaylandExport(entry);
+    }
+}
+
+// Removes the export of the given surface (if any) from wayland_exports, and detaches it.
+void ForgetWaylandSurface(struct wl_surface* surface) {
+    for (WaylandExport** link = &wayland_exports; *link; link = &(*link)->next) {
+        WaylandExport* entry = *link;
+        if (entry->surface == surface) {
+            *link = entry->next;
+            DetachWaylandExport(entry);
+            return;
+        }
+    }
+}
+
+// Releases an export that was acquired for a dialog by NFD_Wayland_AcquireExportedHandle.
+void NFD_Wayland_ReleaseExport(void* context) {
+    WaylandExport* entry = static_cast<WaylandExport*>(context);
+    if (--entry->useCount != 0) return;
+    if (!entry->surface) {
+        DestroyWaylandExport(entry);
+    } else if (!wayland_export_cache_enabled) {
+        // the surface may be destroyed (and its address reused) as soon as no dialog uses it
+        ForgetWaylandSurface(entry->surface);
+    }
+}
+
 void registry_handle_global(void* context,
                             struct wl_registry* registry,
                             uint32_t name,
@@ -114,6 +230,7 @@ void registry_handle_global_remove(void* context, struct wl_registry* registry,
     (void)context;
     (void)registry;
     if (wayland_xdg_exporter_v1 && name == wayland_xdg_exporter_v1_name) {
+        NFD_Wayland_ClearExports();
         zxdg_exporter_v1_destroy(wayland_xdg_exporter_v1);
         wayland_xdg_exporter_v1 = nullptr;
     }
@@ -122,34 +239,232 @@ void registry_handle_global_remove(void* context, struct wl_registry* registry,
 constexpr struct wl_registry_listener wayland_registry_listener = {&registry_handle_global,
                                                                    &registry_handle_global_remove};
 
+void zxdg_exported_v1_handle(void* context, struct zxdg_exported_v1*, const char* handle) {
+    if (!context) return;
+    char*& out = *static_cast<char**>(context);
+    if (out) NFDi_Free(out);
+    const size_t handle_len = strlen(handle);
+    out = NFDi_Malloc<char>(handle_len + 1);
+    copy(handle, handle + handle_len + 1, out);
+}
+
+constexpr struct zxdg_exported_v1_listener wayland_xdg_exported_v1_listener{
+    &zxdg_exported_v1_handle};
+
+// Gets the xdg-foreign handle of the given surface, which can be passed to another Wayland
+// connection to use the surface as a parent.  The export is shared by the dialogs that use the
+// surface at the same time (and, if wayland_export_cache_enabled, by later ones too), and is kept
+// in use until `release` is destroyed, which must happen when the dialog is closed.  Returns
+// nullptr if the surface cannot be exported.
+const char* NFD_Wayland_AcquireExportedHandle(struct wl_surface* surface, DestroyFunc& release) {
+    if (!wayland_display || !wayland_xdg_exporter_v1) return nullptr;
+    WaylandExport* entry = nullptr;
+    for (WaylandExport** link = &wayland_exports; *link; link = &(*link)->next) {
+        if ((*link)->surface == surface) {
+            // move it to the front
+            entry = *link;
+            *link = entry->next;
+            break;
+        }
+    }
+
+    if (!entry) {
+        struct zxdg_exported_v1* exported =
+            zxdg_exporter_v1_export(wayland_xdg_exporter_v1, surface);
+        if (!exported) return nullptr;
+        char* handle = nullptr;
+        zxdg_exported_v1_add_listener(
+            exported, &wayland_xdg_exported_v1_listener, static_cast<void*>(&handle));
+        wl_display_roundtrip_queue(wayland_display, wayland_queue);
+        zxdg_exported_v1_set_user_data(exported, nullptr);
+        if (!handle) {
+            zxdg_exported_v1_destroy(exported);
+            return nullptr;
+        }
+        entry = NFDi_Malloc<WaylandExport>(sizeof(WaylandExport));
+        *entry = WaylandExport{nullptr, surface, exported, handle, 0};
+    }
+    entry->next = wayland_exports;
+    wayland_exports = entry;
+
+    ++entry->useCount;
+    release.fn = &NFD_Wayland_ReleaseExport;
+    release.context = static_cast<void*>(entry);
+
+    // evict the least recently used exports that are not in use and don't fit in the cache
+    size_t count = 0;
+    for (WaylandExport** link = &wayland_exports; *link;) {
+        WaylandExport* current = *link;
+        if (count >= WAYLAND_EXPORT_CACHE_SIZE && current->useCount == 0) {
+            *link = current->next;
+            DestroyWaylandExport(current);
+        } else {
+            ++count;
+            link = &current->next;
+        }
+    }
+    return entry->handle;
+}
+
 void NFD_Wayland_Init(void) {
     wayland_display = nullptr;
+    wayland_exports = nullptr;
 }
 
 void NFD_Wayland_Quit(void) {
     if (wayland_display) {
+        NFD_Wayland_ClearExports();
         if (wayland_xdg_exporter_v1) zxdg_exporter_v1_destroy(wayland_xdg_exporter_v1);
         wl_registry_destroy(wayland_registry);
+        wl_event_queue_destroy(wayland_queue);
+        wayland_display = nullptr;
     }
 }
 
-#endif
-
-}  // namespace
-
-nfdresult_t NFD_SetWaylandDisplay(wl_display* display) {
-#ifdef NFD_WAYLAND
+// The implementation of NFD_SetWaylandDisplay.  The backend must make sure that this doesn't run
+// at the same time as anything else that uses the Wayland state.
+void NFD_Wayland_SetDisplay(struct wl_display* display) {
     NFD_Wayland_Quit();
     wayland_display = display;
     if (wayland_display) {
-        wayland_registry = wl_display_get_registry(wayland_display);
+        wayland_queue = wl_display_create_queue(wayland_display);
+        // create the registry on our queue; the exporter and the exports inherit the queue from it
+        void* display_wrapper = wl_proxy_create_wrapper(wayland_display);
+        wl_proxy_set_queue(static_cast<struct wl_proxy*>(display_wrapper), wayland_queue);
+        wayland_registry =
+            wl_display_get_registry(static_cast<struct wl_display*>(display_wrapper));
+        wl_proxy_wrapper_destroy(display_wrapper);
         wayland_xdg_exporter_v1 = nullptr;
         // seems like registry can't be null
         wl_registry_add_listener(wayland_registry, &wayland_registry_listener, nullptr);
-        wl_display_roundtrip(wayland_display);
+        wl_display_roundtrip_queue(wayland_display, wayland_queue);
+    }
+}
+
+// The implementation of NFD_ReleaseWaylandSurface, with the same requirements as
+// NFD_Wayland_SetDisplay.
+void NFD_Wayland_ReleaseSurface(struct wl_surface* surface) {
+    wayland_export_cache_enabled = true;
+    ForgetWaylandSurface(surface);
+}
+
+#endif
+
+// The path sets of the GTK implementations, which are built from lists of paths that GLib allocated
+// (the portal implementation has its own, built from the portal's response).
+#if !defined(NFD_PORTAL) && defined(GLIB_CHECK_VERSION)
+// A path set is a single allocation: this header, then the offset of each path in the data, and
+// then the data, which holds the paths (each with its null terminator) followed by an extra '\0'
+// that marks the end for the enumerator.
+struct alignas(size_t) PathSet {
+    nfdpathsetsize_t count;
+};
+
+const size_t* PathSetOffsets(const PathSet* pathSet) {
+    return reinterpret_cast<const size_t*>(pathSet + 1);
+}
+
+const char* PathSetData(const PathSet* pathSet) {
+    return reinterpret_cast<const char*>(PathSetOffsets(pathSet) + pathSet->count);
+}
+
+// Copies the paths in fileList (e.g. from gtk_file_chooser_get_filenames()) into a new path set,
+// and frees the list.
+const nfdpathset_t* AllocPathSet(GSList* fileList) {
+    nfdpathsetsize_t count = 0;
+    size_t dataSize = 1;  // for the extra '\0'
+    for (GSList* node = fileList; node; node = node->next) {
+        dataSize += strlen(static_cast<const char*>(node->data)) + 1;
+        ++count;
+    }
+
+    const size_t headerSize = sizeof(PathSet) + sizeof(size_t) * static_cast<size_t>(count);
+    PathSet* pathSet = NFDi_Malloc<PathSet>(headerSize + dataSize);
+    pathSet->count = count;
+    size_t* offsets = reinterpret_cast<size_t*>(pathSet + 1);
+    char* const data = reinterpret_cast<char*>(offsets + count);
+    char* dataEnd = data;
+    for (GSList* node = fileList; node; node = node->next) {
+        const char* path = static_cast<const char*>(node->data);
+        *offsets++ = dataEnd - data;
+        dataEnd = copy(path, path + strlen(path) + 1, dataEnd);
+        g_free(node->data);
     }
-#else
-    (void)display;
+    *dataEnd++ = '\0';
+    assert(static_cast<size_t>(dataEnd - data) == dataSize);
+    g_slist_free(fileList);
+
+    return pathSet;
+}
 #endif
+
+}  // namespace
+
+#if !defined(NFD_PORTAL) && defined(GLIB_CHECK_VERSION)
+nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
+    assert(pathSet);
+    *count = static_cast<const PathSet*>(pathSet)->count;
     return NFD_OKAY;
 }
+
+nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
+                                 nfdpathsetsize_t index,
+                                 nfdnchar_t** outPath) {
+    assert(pathSet);
+    const PathSet* set = static_cast<const PathSet*>(pathSet);
+    assert(index < set->count);
+    // const_cast because the path is owned by the path set, but the caller gets a non-const
+    // pointer
+    *outPath = const_cast<nfdnchar_t*>(PathSetData(set) + PathSetOffsets(set)[index]);
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_PathSet_GetPathU8(const nfdpathset_t* pathSet,
+                                  nfdpathsetsize_t index,
+                                  nfdu8char_t** outPath)
+    __attribute__((alias("NFD_PathSet_GetPathN")));
+
+void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
+    assert(filePath);
+    (void)filePath;  // prevent warning in release build
+    // no-op, because NFD_PathSet_Free does the freeing for us
+}
+
+void NFD_PathSet_FreePathU8(const nfdu8char_t* filePath)
+    __attribute__((alias("NFD_PathSet_FreePathN")));
+
+void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
+    assert(pathSet);
+    // the paths are in the same allocation as the path set
+    NFDi_Free(const_cast<PathSet*>(static_cast<const PathSet*>(pathSet)));
+}
+
+nfdresult_t NFD_PathSet_GetEnum(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator) {
+    assert(pathSet);
+    // The enumeration is a pointer to the next path in the data
+    outEnumerator->ptr = const_cast<char*>(PathSetData(static_cast<const PathSet*>(pathSet)));
+
+    return NFD_OKAY;
+}
+
+void NFD_PathSet_FreeEnum(nfdpathsetenum_t*) {
+    // Do nothing, because the enumeration is just a pointer into the path set
+}
+
+nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath) {
+    nfdnchar_t* path = static_cast<nfdnchar_t*>(enumerator->ptr);
+
+    // paths are never empty, so an empty string is the extra '\0' at the end of the data
+    if (*path) {
+        *outPath = path;
+        enumerator->ptr = static_cast<void*>(path + strlen(path) + 1);
+    } else {
+        *outPath = nullptr;
+    }
+
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_PathSet_EnumNextU8(nfdpathsetenum_t* enumerator, nfdu8char_t** outPath)
+    __attribute__((alias("NFD_PathSet_EnumNextN")));
+#endif
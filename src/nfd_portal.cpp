@@ -10,11 +10,15 @@
 #include <assert.h>
 #include <dbus/dbus.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>  // for access()
 
 #if !defined(__has_include) || !defined(__linux__)
@@ -29,6 +33,7 @@
 #include "nfd.h"
 
 #include "nfd_linux_shared.hpp"
+#include "nfd_uri_decode.hpp"
 
 /*
 Define NFD_APPEND_EXTENSION if you want the file extension to be appended when missing. Linux
@@ -38,6 +43,20 @@ know that we appended an extension, so they will not check or whitelist the corr
 NFD_APPEND_EXTENSION is not recommended for portals.
 */
 
+/*
+Define NFD_PORTAL_PRIVATE_CONNECTION if you want NFD to open its own connection to the session bus.
+By default, NFD uses the session connection that libdbus shares with everyone else in the process,
+and it dispatches everything that arrives while a dialog is open; other users of that connection
+will then miss messages that they meant to read themselves.
+*/
+
+/*
+Define NFD_PORTAL_HOST_PATHS if you want paths inside the document portal (which is how a sandboxed
+application sees the files that the user picked) to be replaced by the corresponding paths on the
+host, when the application is allowed to access those.  Reading a file through the document portal
+goes through its FUSE daemon, which is much slower than reading the file directly.
+*/
+
 /*
 Define NFD_CASE_SENSITIVE_FILTER if you want file filters to be case-sensitive.  The default
 is case-insensitive.  While Linux uses a case-sensitive filesystem and is designed for
@@ -53,19 +72,111 @@ struct DBusMessage_Guard {
     ~DBusMessage_Guard() { dbus_message_unref(data); }
 };
 
+struct Mutex_Guard {
+    pthread_mutex_t* data;
+    Mutex_Guard(pthread_mutex_t* mutex) noexcept : data(mutex) { pthread_mutex_lock(data); }
+    ~Mutex_Guard() { pthread_mutex_unlock(data); }
+};
+
+/* current D-Bus error of this thread */
+thread_local DBusError dbus_err;
+/* current non D-Bus error of this thread */
+constexpr size_t OWNED_ERR_LEN = 1024;
+thread_local char owned_err[OWNED_ERR_LEN]{};
+/* current error of this thread (may be a pointer to dbus_err.message, owned_err, or a pointer to
+ * some string literal) */
+thread_local const char* err_ptr = nullptr;
+/* protects all the state below, which is shared by all threads; a thread only releases it while
+ * waiting for the bus */
+pthread_mutex_t nfd_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* number of NFD_Init calls that have not been matched by NFD_Quit */
+size_t init_count;
 /* D-Bus connection handle */
 DBusConnection* dbus_conn;
-/* current D-Bus error */
-DBusError dbus_err;
-/* current non D-Bus error */
-constexpr size_t OWNED_ERR_LEN = 1024;
-char owned_err[OWNED_ERR_LEN]{};
-/* current error (may be a pointer to dbus_err.message, owned_err, or a pointer to some string
- * literal) */
-const char* err_ptr = nullptr;
+/* whether a thread is currently waiting for the connection on behalf of all waiting threads */
+bool dispatch_active;
+/* broadcast whenever that thread has dispatched some messages, or has stopped waiting; it uses
+ * CLOCK_MONOTONIC, so that it can wait until a deadline */
+pthread_cond_t dispatch_cond;
+/* eventfd that wakes that thread when another thread has queued a message to send, or when a
+ * message that it waits for has been dispatched by another thread */
+int dispatch_wake_fd;
+/* a thread waiting for a method reply or for the Response signal of a request */
+struct Waiter {
+    const char* path;          // handle of the request, when waiting for its Response signal
+    DBusPendingCall* pending;  // the method call, when waiting for its reply
+    DBusMessage* msg;          // the Response signal, set once it arrives (accessed atomically)
+    Waiter* next;
+};
+/* With a shared connection, the application may dispatch the connection on its own threads, which
+ * runs DispatchFilter and PendingCallNotify there without nfd_mutex.  So those only use the state
+ * below, and they wake the waiting thread through dispatch_wake_fd. */
+/* protects response_waiters and the paths of the Waiters in it (nfd_mutex may be held when
+ * locking this, but not the other way round) */
+pthread_mutex_t waiter_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* threads waiting for the Response signal of a request */
+Waiter* response_waiters;
+/* number of messages that were not meant for us, but were dispatched while we were waiting
+ * (accessed atomically) */
+size_t foreign_message_count;
 /* the unique name of our connection, used for the Request handle; owned by D-Bus so we don't free
  * it */
 const char* dbus_unique_name;
+/* "/org/freedesktop/portal/desktop/request/SENDER/RANDOM_", the common prefix of the handles of
+ * our requests; the random part is generated once per connection in NFD_Init */
+char* request_path_prefix;
+size_t request_path_prefix_len;
+/* length of "/org/freedesktop/portal/desktop/request/SENDER", the namespace of our handles */
+size_t request_namespace_len;
+/* number of requests made so far, which makes each handle unique */
+uintptr_t request_counter;
+/* match rule for the Response signals of all our requests */
+char* response_subscription_rule;
+/* whether response_subscription_rule has been added to the connection */
+bool response_subscribed;
+/* capabilities of the portal that owns DBUS_DESTINATION; they are fetched lazily and cached until
+ * the portal's owner changes */
+struct PortalCapabilities {
+    dbus_uint32_t fileChooserVersion;
+};
+PortalCapabilities portal_caps;
+/* whether portal_caps holds the capabilities of the current portal (accessed atomically, because
+ * DispatchFilter clears it) */
+bool portal_caps_valid;
+/* the strings sent to the portal for a filter list, formatted once and reused as long as the
+ * application passes an identical filter list; the header is followed by `count` CompiledFilters
+ * and then by the strings they refer to */
+struct CompiledFilter {
+    size_t name;       // offset of the original name
+    size_t spec;       // offset of the original spec
+    size_t label;      // offset of "name (spec)"
+    size_t globs;      // offset of the first of globCount consecutive null-terminated globs (or
+                       // MIME types, which are the ones that contain a '/')
+    size_t globCount;  // number of items in spec
+};
+struct alignas(CompiledFilter) CompiledFilters {
+    nfdfiltersize_t count;
+};
+/* the most recently used filter list, or nullptr */
+CompiledFilters* compiled_filters;
+#ifdef NFD_PORTAL_WARM_UP
+/* version query sent by NFD_Init, or nullptr if it was not sent or has already been consumed */
+DBusPendingCall* warm_up_version_call;
+/* subscription to NameOwnerChanged for DBUS_DESTINATION sent by NFD_Init, or nullptr if it was not
+ * sent or its reply has already been consumed */
+DBusPendingCall* warm_up_owner_match_call;
+#endif
+/* whether the bus has confirmed our subscription to NameOwnerChanged for DBUS_DESTINATION, which is
+ * needed before we can cache the capabilities */
+bool portal_owner_subscribed;
+#ifdef NFD_PORTAL_HOST_PATHS
+/* mount point of the document portal followed by a '/', or nullptr if there is no document portal
+ */
+char* documents_mount_point;
+size_t documents_mount_point_len;
+/* whether documents_mount_point has been looked up */
+bool documents_mount_point_valid;
+#endif
 
 void NFDi_SetError(const char* msg) {
     err_ptr = msg;
@@ -95,21 +206,6 @@ T* reverse_copy(const T* begin, const T* end, T* out) {
     return out;
 }
 
-// Returns true if ch is in [0-9A-Za-z], false otherwise.
-bool IsHex(char ch) {
-    return ('0' <= ch && ch <= '9') || ('A' <= ch && ch <= 'F') || ('a' <= ch && ch <= 'f');
-}
-
-// Returns the hexadecimal value contained in the char.  Precondition: IsHex(ch)
-char ParseHexUnchecked(char ch) {
-    if ('0' <= ch && ch <= '9') return ch - '0';
-    if ('A' <= ch && ch <= 'F') return ch - ('A' - 10);
-    if ('a' <= ch && ch <= 'f') return ch - ('a' - 10);
-#if defined(__GNUC__)
-    __builtin_unreachable();
-#endif
-}
-
 // Writes val as a hex string to out
 char* FormatUIntToHexString(char* out, uintptr_t val) {
     char tmp[sizeof(uintptr_t) * 2];
@@ -126,6 +222,7 @@ constexpr const char* STR_EMPTY = "";
 constexpr const char* STR_OPEN_FILE = "Open File";
 constexpr const char* STR_OPEN_FILES = "Open Files";
 constexpr const char* STR_SAVE_FILE = "Save File";
+constexpr const char* STR_SAVE_FILES = "Save Files";
 constexpr const char* STR_SELECT_FOLDER = "Select Folder";
 constexpr const char* STR_SELECT_FOLDERS = "Select Folders";
 constexpr const char* STR_HANDLE_TOKEN = "handle_token";
@@ -136,34 +233,18 @@ constexpr const char* STR_CURRENT_FILTER = "current_filter";
 constexpr const char* STR_CURRENT_NAME = "current_name";
 constexpr const char* STR_CURRENT_FOLDER = "current_folder";
 constexpr const char* STR_CURRENT_FILE = "current_file";
+constexpr const char* STR_FILES = "files";
 constexpr const char* STR_ALL_FILES = "All files";
 constexpr const char* STR_ASTERISK = "*";
 constexpr const char* DBUS_DESTINATION = "org.freedesktop.portal.Desktop";
 constexpr const char* DBUS_PATH = "/org/freedesktop/portal/desktop";
 constexpr const char* DBUS_FILECHOOSER_IFACE = "org.freedesktop.portal.FileChooser";
 constexpr const char* DBUS_REQUEST_IFACE = "org.freedesktop.portal.Request";
+constexpr const char* DBUS_BUS_IFACE = "org.freedesktop.DBus";
+constexpr const char* DBUS_BUS_PATH = "/org/freedesktop/DBus";
 
 #ifdef NFD_WAYLAND
 constexpr const char* WAYLAND_PREFIX = "wayland:";
-
-void DestroyXdgExported(void* context) {
-    zxdg_exported_v1_destroy(static_cast<struct zxdg_exported_v1*>(context));
-}
-
-void zxdg_exported_v1_handle(void* context, struct zxdg_exported_v1*, const char* handle) {
-    DBusMessageIter& iter = *static_cast<DBusMessageIter*>(context);
-    const size_t handle_len = strlen(handle);
-    const size_t prefix_len = strlen(WAYLAND_PREFIX);
-    char* const buf = NFDi_Malloc<char>(prefix_len + handle_len + 1);
-    char* buf_end = copy(WAYLAND_PREFIX, WAYLAND_PREFIX + prefix_len, buf);
-    buf_end = copy(handle, handle + handle_len, buf_end);
-    *buf_end = '\0';
-    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &buf);
-    NFDi_Free(buf);
-}
-
-constexpr struct zxdg_exported_v1_listener wayland_xdg_exported_v1_listener{
-    &zxdg_exported_v1_handle};
 #endif
 
 void AppendOpenFileQueryParentWindow(DBusMessageIter& iter,
@@ -193,25 +274,22 @@ void AppendOpenFileQueryParentWindow(DBusMessageIter& iter,
 #endif
 #ifdef NFD_WAYLAND
         case NFD_WINDOW_HANDLE_TYPE_WAYLAND: {
-            if (wayland_display && wayland_xdg_exporter_v1) {
-                struct zxdg_exported_v1* exported = zxdg_exporter_v1_export(
-                    wayland_xdg_exporter_v1, static_cast<struct wl_surface*>(parentWindow.handle));
-                if (!exported) {
-                    // if we fail to export the wl_surface, act as if the window has no parent
-                    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_EMPTY);
-                    return;
-                }
-                zxdg_exported_v1_add_listener(
-                    exported, &wayland_xdg_exported_v1_listener, static_cast<void*>(&iter));
-                wl_display_roundtrip(wayland_display);
-                zxdg_exported_v1_set_user_data(exported, nullptr);
-                destroy.fn = &DestroyXdgExported;
-                destroy.context = static_cast<void*>(exported);
-                return;
-            } else {
+            const char* handle = NFD_Wayland_AcquireExportedHandle(
+                static_cast<struct wl_surface*>(parentWindow.handle), destroy);
+            if (!handle) {
+                // if we fail to export the wl_surface, act as if the window has no parent
                 dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_EMPTY);
                 return;
             }
+            const size_t handle_len = strlen(handle);
+            const size_t prefix_len = strlen(WAYLAND_PREFIX);
+            char* const buf = NFDi_Malloc<char>(prefix_len + handle_len + 1);
+            char* buf_end = copy(WAYLAND_PREFIX, WAYLAND_PREFIX + prefix_len, buf);
+            buf_end = copy(handle, handle + handle_len, buf_end);
+            *buf_end = '\0';
+            dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &buf);
+            NFDi_Free(buf);
+            return;
         }
 #endif
         default: {
@@ -244,6 +322,10 @@ void AppendSaveFileQueryTitle(DBusMessageIter& iter) {
     dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_SAVE_FILE);
 }
 
+void AppendSaveFilesQueryTitle(DBusMessageIter& iter) {
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_SAVE_FILES);
+}
+
 void AppendOpenFileQueryDictEntryHandleToken(DBusMessageIter& sub_iter, const char* handle_token) {
     DBusMessageIter sub_sub_iter;
     DBusMessageIter variant_iter;
@@ -293,175 +375,165 @@ void AppendOpenFileQueryDictEntryDirectory<true>(DBusMessageIter& sub_iter) {
 template <>
 void AppendOpenFileQueryDictEntryDirectory<false>(DBusMessageIter&) {}
 
-void AppendSingleFilter(DBusMessageIter& base_iter, const nfdnfilteritem_t& filter) {
-    DBusMessageIter filter_list_struct_iter;
-    DBusMessageIter filter_sublist_iter;
-    DBusMessageIter filter_sublist_struct_iter;
-    dbus_message_iter_open_container(
-        &base_iter, DBUS_TYPE_STRUCT, nullptr, &filter_list_struct_iter);
-    // count number of file extensions
-    size_t sep = 1;
-    for (const char* p = filter.spec; *p; ++p) {
-        if (*p == ',') {
-            ++sep;
+const CompiledFilter* CompiledFiltersEntries(const CompiledFilters* filters) {
+    return reinterpret_cast<const CompiledFilter*>(filters + 1);
+}
+
+const char* CompiledFiltersData(const CompiledFilters* filters) {
+    return reinterpret_cast<const char*>(CompiledFiltersEntries(filters) + filters->count);
+}
+
+// Returns true if the given filter list is identical to the one that was compiled.
+bool CompiledFiltersMatch(const CompiledFilters* filters,
+                          const nfdnfilteritem_t* filterList,
+                          nfdfiltersize_t filterCount) {
+    if (filters->count != filterCount) return false;
+    const CompiledFilter* entries = CompiledFiltersEntries(filters);
+    const char* data = CompiledFiltersData(filters);
+    for (nfdfiltersize_t i = 0; i != filterCount; ++i) {
+        if (strcmp(data + entries[i].name, filterList[i].name) != 0 ||
+            strcmp(data + entries[i].spec, filterList[i].spec) != 0) {
+            return false;
         }
     }
-    {
-        const size_t name_len = strlen(filter.name);
-        const size_t spec_len = strlen(filter.spec);
-        char* buf = static_cast<char*>(alloca(sep + name_len + 2 + spec_len + 1));
-        char* buf_end = buf;
-        buf_end = copy(filter.name, filter.name + name_len, buf_end);
-        *buf_end++ = ' ';
-        *buf_end++ = '(';
-        const char* spec_ptr = filter.spec;
-        do {
-            *buf_end++ = *spec_ptr;
-            if (*spec_ptr == ',') *buf_end++ = ' ';
-            ++spec_ptr;
-        } while (*spec_ptr != '\0');
-        *buf_end++ = ')';
-        *buf_end = '\0';
-        dbus_message_iter_append_basic(&filter_list_struct_iter, DBUS_TYPE_STRING, &buf);
+    return true;
+}
+
+// Gets the compiled form of the given filter list, which must not be empty.  The result is cached
+// until a different filter list is given, so that an application that passes the same list to
+// every dialog (possibly with hundreds of filters) does not pay for formatting it each time.
+const CompiledFilters* GetCompiledFilters(const nfdnfilteritem_t* filterList,
+                                          nfdfiltersize_t filterCount) {
+    if (compiled_filters) {
+        if (CompiledFiltersMatch(compiled_filters, filterList, filterCount)) {
+            return compiled_filters;
+        }
+        NFDi_Free(compiled_filters);
     }
-    {
-        dbus_message_iter_open_container(
-            &filter_list_struct_iter, DBUS_TYPE_ARRAY, "(us)", &filter_sublist_iter);
-        const char* extn_begin = filter.spec;
-        const char* extn_end = extn_begin;
+
+    // compute the space needed by all the strings, so we only need a single allocation
+    size_t data_len = 0;
+    for (nfdfiltersize_t i = 0; i != filterCount; ++i) {
+        const size_t name_len = strlen(filterList[i].name);
+        size_t spec_len = 0;
+        size_t sep = 1;
+        for (const char* p = filterList[i].spec; *p; ++p, ++spec_len) {
+            if (*p == ',') ++sep;
+        }
+        // name, spec, "name (spec)" with a space after each comma, then a "*.extn" for each
+        // extension (where each char may expand to 4 chars for case-insensitive globs) or the MIME
+        // type as it is
+        data_len += (name_len + 1) + (spec_len + 1) + (name_len + 2 + spec_len + sep + 1);
+#ifdef NFD_CASE_SENSITIVE_FILTER
+        data_len += spec_len + sep * 3;
+#else
+        data_len += spec_len * 4 + sep * 3;
+#endif
+    }
+
+    CompiledFilters* filters = NFDi_Malloc<CompiledFilters>(
+        sizeof(CompiledFilters) + sizeof(CompiledFilter) * filterCount + data_len);
+    filters->count = filterCount;
+    CompiledFilter* entries = const_cast<CompiledFilter*>(CompiledFiltersEntries(filters));
+    char* const data = const_cast<char*>(CompiledFiltersData(filters));
+    char* data_end = data;
+    for (nfdfiltersize_t i = 0; i != filterCount; ++i) {
+        const char* name = filterList[i].name;
+        const char* spec = filterList[i].spec;
+        const size_t name_len = strlen(name);
+        const size_t spec_len = strlen(spec);
+        CompiledFilter& entry = entries[i];
+
+        entry.name = data_end - data;
+        data_end = copy(name, name + name_len + 1, data_end);
+        entry.spec = data_end - data;
+        data_end = copy(spec, spec + spec_len + 1, data_end);
+
+        entry.label = data_end - data;
+        data_end = copy(name, name + name_len, data_end);
+        *data_end++ = ' ';
+        *data_end++ = '(';
+        for (const char* spec_ptr = spec; *spec_ptr; ++spec_ptr) {
+            *data_end++ = *spec_ptr;
+            if (*spec_ptr == ',') *data_end++ = ' ';
+        }
+        *data_end++ = ')';
+        *data_end++ = '\0';
+
+        entry.globs = data_end - data;
+        entry.globCount = 0;
+        const char* extn_begin = spec;
         while (true) {
-            dbus_message_iter_open_container(
-                &filter_sublist_iter, DBUS_TYPE_STRUCT, nullptr, &filter_sublist_struct_iter);
-            {
-                const unsigned zero = 0;
-                dbus_message_iter_append_basic(
-                    &filter_sublist_struct_iter, DBUS_TYPE_UINT32, &zero);
-            }
-            do {
-                ++extn_end;
-            } while (*extn_end != ',' && *extn_end != '\0');
-            {
+            const char* extn_end = extn_begin;
+            while (*extn_end != ',' && *extn_end != '\0') ++extn_end;
+            if (IsMimeTypeFilterItem(extn_begin, extn_end)) {
+                data_end = copy(extn_begin, extn_end, data_end);
+            } else {
+                *data_end++ = '*';
+                *data_end++ = '.';
 #ifdef NFD_CASE_SENSITIVE_FILTER
-                char* buf = static_cast<char*>(alloca(2 + (extn_end - extn_begin) + 1));
-                char* buf_end = buf;
-                *buf_end++ = '*';
-                *buf_end++ = '.';
-                buf_end = copy(extn_begin, extn_end, buf_end);
-                *buf_end = '\0';
-                dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &buf);
+                data_end = copy(extn_begin, extn_end, data_end);
 #else
-                char* buf = static_cast<char*>(alloca(2 + (extn_end - extn_begin) * 4 + 1));
-                char* buf_end = buf;
-                *buf_end++ = '*';
-                *buf_end++ = '.';
-                buf_end = emit_case_insensitive_glob(extn_begin, extn_end, buf_end);
-                *buf_end = '\0';
-                dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &buf);
+                data_end = emit_case_insensitive_glob(extn_begin, extn_end, data_end);
 #endif
             }
-            dbus_message_iter_close_container(&filter_sublist_iter, &filter_sublist_struct_iter);
-            if (*extn_end == '\0') {
-                break;
-            }
+            *data_end++ = '\0';
+            ++entry.globCount;
+            if (*extn_end == '\0') break;
             extn_begin = extn_end + 1;
-            extn_end = extn_begin;
         }
     }
-    dbus_message_iter_close_container(&filter_list_struct_iter, &filter_sublist_iter);
-    dbus_message_iter_close_container(&base_iter, &filter_list_struct_iter);
+    assert(static_cast<size_t>(data_end - data) <= data_len);
+
+    compiled_filters = filters;
+    return filters;
 }
 
-bool AppendSingleFilterCheckExtn(DBusMessageIter& base_iter,
-                                 const nfdnfilteritem_t& filter,
-                                 const nfdnchar_t* match_extn) {
+void AppendSingleFilter(DBusMessageIter& base_iter,
+                        const char* data,
+                        const CompiledFilter& filter) {
     DBusMessageIter filter_list_struct_iter;
     DBusMessageIter filter_sublist_iter;
     DBusMessageIter filter_sublist_struct_iter;
     dbus_message_iter_open_container(
         &base_iter, DBUS_TYPE_STRUCT, nullptr, &filter_list_struct_iter);
-    // count number of file extensions
-    size_t sep = 1;
-    for (const char* p = filter.spec; *p; ++p) {
-        if (*p == ',') {
-            ++sep;
-        }
-    }
-    {
-        const size_t name_len = strlen(filter.name);
-        const size_t spec_len = strlen(filter.spec);
-        char* buf = static_cast<char*>(alloca(sep + name_len + 2 + spec_len + 1));
-        char* buf_end = buf;
-        buf_end = copy(filter.name, filter.name + name_len, buf_end);
-        *buf_end++ = ' ';
-        *buf_end++ = '(';
-        const char* spec_ptr = filter.spec;
-        do {
-            *buf_end++ = *spec_ptr;
-            if (*spec_ptr == ',') *buf_end++ = ' ';
-            ++spec_ptr;
-        } while (*spec_ptr != '\0');
-        *buf_end++ = ')';
-        *buf_end = '\0';
-        dbus_message_iter_append_basic(&filter_list_struct_iter, DBUS_TYPE_STRING, &buf);
-    }
-    bool extn_matched = false;
     {
+        const char* label = data + filter.label;
+        dbus_message_iter_append_basic(&filter_list_struct_iter, DBUS_TYPE_STRING, &label);
+    }
+    dbus_message_iter_open_container(
+        &filter_list_struct_iter, DBUS_TYPE_ARRAY, "(us)", &filter_sublist_iter);
+    const char* glob = data + filter.globs;
+    for (size_t i = 0; i != filter.globCount; ++i) {
         dbus_message_iter_open_container(
-            &filter_list_struct_iter, DBUS_TYPE_ARRAY, "(us)", &filter_sublist_iter);
-        const char* extn_begin = filter.spec;
-        const char* extn_end = extn_begin;
-        while (true) {
-            dbus_message_iter_open_container(
-                &filter_sublist_iter, DBUS_TYPE_STRUCT, nullptr, &filter_sublist_struct_iter);
-            {
-                const unsigned zero = 0;
-                dbus_message_iter_append_basic(
-                    &filter_sublist_struct_iter, DBUS_TYPE_UINT32, &zero);
-            }
-            do {
-                ++extn_end;
-            } while (*extn_end != ',' && *extn_end != '\0');
-            {
-#ifdef NFD_CASE_SENSITIVE_FILTER
-                char* buf = static_cast<char*>(alloca(2 + (extn_end - extn_begin) + 1));
-                char* buf_end = buf;
-                *buf_end++ = '*';
-                *buf_end++ = '.';
-                buf_end = copy(extn_begin, extn_end, buf_end);
-                *buf_end = '\0';
-                dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &buf);
-#else
-                char* buf = static_cast<char*>(alloca(2 + (extn_end - extn_begin) * 4 + 1));
-                char* buf_end = buf;
-                *buf_end++ = '*';
-                *buf_end++ = '.';
-                buf_end = emit_case_insensitive_glob(extn_begin, extn_end, buf_end);
-                *buf_end = '\0';
-                dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &buf);
-#endif
-            }
-            dbus_message_iter_close_container(&filter_sublist_iter, &filter_sublist_struct_iter);
-            if (!extn_matched) {
-                const char* match_extn_p;
-                const char* p;
-                for (p = extn_begin, match_extn_p = match_extn; p != extn_end && *match_extn_p;
-                     ++p, ++match_extn_p) {
-                    if (*p != *match_extn_p) break;
-                }
-                if (p == extn_end && !*match_extn_p) {
-                    extn_matched = true;
-                }
-            }
-            if (*extn_end == '\0') {
-                break;
-            }
-            extn_begin = extn_end + 1;
-            extn_end = extn_begin;
+            &filter_sublist_iter, DBUS_TYPE_STRUCT, nullptr, &filter_sublist_struct_iter);
+        {
+            // 0 for a glob, 1 for a MIME type
+            const unsigned type = strchr(glob, '/') ? 1 : 0;
+            dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_UINT32, &type);
         }
+        dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &glob);
+        dbus_message_iter_close_container(&filter_sublist_iter, &filter_sublist_struct_iter);
+        glob += strlen(glob) + 1;
     }
     dbus_message_iter_close_container(&filter_list_struct_iter, &filter_sublist_iter);
     dbus_message_iter_close_container(&base_iter, &filter_list_struct_iter);
-    return extn_matched;
+}
+
+// Returns true if one of the comma-separated extensions in spec is exactly match_extn.
+bool FilterSpecHasExtn(const char* spec, const nfdnchar_t* match_extn) {
+    const char* extn_begin = spec;
+    while (true) {
+        const char* p = extn_begin;
+        const nfdnchar_t* match_extn_p = match_extn;
+        for (; *p != ',' && *p != '\0' && *match_extn_p; ++p, ++match_extn_p) {
+            if (*p != *match_extn_p) break;
+        }
+        if ((*p == ',' || *p == '\0') && !*match_extn_p) return true;
+        while (*p != ',' && *p != '\0') ++p;
+        if (*p == '\0') return false;
+        extn_begin = p + 1;
+    }
 }
 
 void AppendWildcardFilter(DBusMessageIter& base_iter) {
@@ -498,6 +570,10 @@ void AppendOpenFileQueryDictEntryFilters<true>(DBusMessageIter& sub_iter,
         DBusMessageIter variant_iter;
         DBusMessageIter filter_list_iter;
 
+        const CompiledFilters* filters = GetCompiledFilters(filterList, filterCount);
+        const CompiledFilter* entries = CompiledFiltersEntries(filters);
+        const char* data = CompiledFiltersData(filters);
+
         // filters
         dbus_message_iter_open_container(&sub_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &sub_sub_iter);
         dbus_message_iter_append_basic(&sub_sub_iter, DBUS_TYPE_STRING, &STR_FILTERS);
@@ -506,7 +582,7 @@ void AppendOpenFileQueryDictEntryFilters<true>(DBusMessageIter& sub_iter,
         dbus_message_iter_open_container(
             &variant_iter, DBUS_TYPE_ARRAY, "(sa(us))", &filter_list_iter);
         for (nfdfiltersize_t i = 0; i != filterCount; ++i) {
-            AppendSingleFilter(filter_list_iter, filterList[i]);
+            AppendSingleFilter(filter_list_iter, data, entries[i]);
         }
         AppendWildcardFilter(filter_list_iter);
         dbus_message_iter_close_container(&variant_iter, &filter_list_iter);
@@ -518,7 +594,7 @@ void AppendOpenFileQueryDictEntryFilters<true>(DBusMessageIter& sub_iter,
         dbus_message_iter_append_basic(&sub_sub_iter, DBUS_TYPE_STRING, &STR_CURRENT_FILTER);
         dbus_message_iter_open_container(
             &sub_sub_iter, DBUS_TYPE_VARIANT, "(sa(us))", &variant_iter);
-        AppendSingleFilter(variant_iter, filterList[0]);
+        AppendSingleFilter(variant_iter, data, entries[0]);
         dbus_message_iter_close_container(&sub_sub_iter, &variant_iter);
         dbus_message_iter_close_container(&sub_iter, &sub_sub_iter);
     }
@@ -537,6 +613,10 @@ void AppendSaveFileQueryDictEntryFilters(DBusMessageIter& sub_iter,
         DBusMessageIter variant_iter;
         DBusMessageIter filter_list_iter;
 
+        const CompiledFilters* filters = GetCompiledFilters(filterList, filterCount);
+        const CompiledFilter* entries = CompiledFiltersEntries(filters);
+        const char* data = CompiledFiltersData(filters);
+
         // The extension of the defaultName (without the '.').  If NULL, it means that there is no
         // extension.
         const nfdnchar_t* extn = NULL;
@@ -559,11 +639,10 @@ void AppendSaveFileQueryDictEntryFilters(DBusMessageIter& sub_iter,
             &variant_iter, DBUS_TYPE_ARRAY, "(sa(us))", &filter_list_iter);
         for (nfdfiltersize_t i = 0; i != filterCount; ++i) {
             if (!extn_matched && extn) {
-                extn_matched = AppendSingleFilterCheckExtn(filter_list_iter, filterList[i], extn);
+                extn_matched = FilterSpecHasExtn(data + entries[i].spec, extn);
                 if (extn_matched) selected_filter_index = i;
-            } else {
-                AppendSingleFilter(filter_list_iter, filterList[i]);
             }
+            AppendSingleFilter(filter_list_iter, data, entries[i]);
         }
         AppendWildcardFilter(filter_list_iter);
         dbus_message_iter_close_container(&variant_iter, &filter_list_iter);
@@ -576,7 +655,7 @@ void AppendSaveFileQueryDictEntryFilters(DBusMessageIter& sub_iter,
         dbus_message_iter_open_container(
             &sub_sub_iter, DBUS_TYPE_VARIANT, "(sa(us))", &variant_iter);
         if (extn_matched) {
-            AppendSingleFilter(variant_iter, filterList[selected_filter_index]);
+            AppendSingleFilter(variant_iter, data, entries[selected_filter_index]);
         } else {
             AppendWildcardFilter(variant_iter);
         }
@@ -607,10 +686,8 @@ void AppendOpenFileQueryDictEntryCurrentFolder(DBusMessageIter& sub_iter, const
     dbus_message_iter_open_container(&sub_sub_iter, DBUS_TYPE_VARIANT, "ay", &variant_iter);
     dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "y", &array_iter);
     // Append string as byte array, including the terminating null byte as required by the portal.
-    const char* p = path;
-    do {
-        dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_BYTE, p);
-    } while (*p++);
+    const size_t path_len = strlen(path) + 1;
+    dbus_message_iter_append_fixed_array(&array_iter, DBUS_TYPE_BYTE, &path, path_len);
     dbus_message_iter_close_container(&variant_iter, &array_iter);
     dbus_message_iter_close_container(&sub_sub_iter, &variant_iter);
     dbus_message_iter_close_container(&sub_iter, &sub_sub_iter);
@@ -651,8 +728,31 @@ void AppendSaveFileQueryDictEntryCurrentFile(DBusMessageIter& sub_iter,
     dbus_message_iter_open_container(&sub_sub_iter, DBUS_TYPE_VARIANT, "ay", &variant_iter);
     dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "y", &array_iter);
     // This includes the terminating null character, which is required by the portal.
-    for (const char* p = pathname; p != pathname_end; ++p) {
-        dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_BYTE, p);
+    const char* pathname_ptr = pathname;
+    dbus_message_iter_append_fixed_array(
+        &array_iter, DBUS_TYPE_BYTE, &pathname_ptr, pathname_end - pathname);
+    dbus_message_iter_close_container(&variant_iter, &array_iter);
+    dbus_message_iter_close_container(&sub_sub_iter, &variant_iter);
+    dbus_message_iter_close_container(&sub_iter, &sub_sub_iter);
+}
+
+void AppendSaveFilesQueryDictEntryFiles(DBusMessageIter& sub_iter,
+                                        const nfdnchar_t* const* fileNames,
+                                        nfdpathsetsize_t fileCount) {
+    DBusMessageIter sub_sub_iter;
+    DBusMessageIter variant_iter;
+    DBusMessageIter array_iter;
+    dbus_message_iter_open_container(&sub_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &sub_sub_iter);
+    dbus_message_iter_append_basic(&sub_sub_iter, DBUS_TYPE_STRING, &STR_FILES);
+    dbus_message_iter_open_container(&sub_sub_iter, DBUS_TYPE_VARIANT, "aay", &variant_iter);
+    dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "ay", &array_iter);
+    for (nfdpathsetsize_t i = 0; i != fileCount; ++i) {
+        DBusMessageIter name_iter;
+        dbus_message_iter_open_container(&array_iter, DBUS_TYPE_ARRAY, "y", &name_iter);
+        // This includes the terminating null character, which is required by the portal.
+        const char* name = fileNames[i];
+        dbus_message_iter_append_fixed_array(&name_iter, DBUS_TYPE_BYTE, &name, strlen(name) + 1);
+        dbus_message_iter_close_container(&array_iter, &name_iter);
     }
     dbus_message_iter_close_container(&variant_iter, &array_iter);
     dbus_message_iter_close_container(&sub_sub_iter, &variant_iter);
@@ -709,6 +809,28 @@ void AppendSaveFileQueryParams(DBusMessage* query,
     dbus_message_iter_close_container(&iter, &sub_iter);
 }
 
+// Append SaveFiles() portal params to the given query.
+void AppendSaveFilesQueryParams(DBusMessage* query,
+                                const char* handle_token,
+                                const nfdnchar_t* const* fileNames,
+                                nfdpathsetsize_t fileCount,
+                                const nfdnchar_t* defaultPath,
+                                const nfdwindowhandle_t& parentWindow,
+                                DestroyFunc& destroy) {
+    DBusMessageIter iter;
+    dbus_message_iter_init_append(query, &iter);
+
+    AppendOpenFileQueryParentWindow(iter, parentWindow, destroy);
+    AppendSaveFilesQueryTitle(iter);
+
+    DBusMessageIter sub_iter;
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &sub_iter);
+    AppendOpenFileQueryDictEntryHandleToken(sub_iter, handle_token);
+    AppendOpenFileQueryDictEntryCurrentFolder(sub_iter, defaultPath);
+    AppendSaveFilesQueryDictEntryFiles(sub_iter, fileNames, fileCount);
+    dbus_message_iter_close_container(&iter, &sub_iter);
+}
+
 nfdresult_t ReadDictImpl(const char*, DBusMessageIter&) {
     return NFD_OKAY;
 }
@@ -829,30 +951,6 @@ nfdresult_t ReadResponseUris(DBusMessage* msg, DBusMessageIter& uriIter) {
     return NFD_OKAY;
 }
 
-// Same as ReadResponseUris, but does not perform any message type checks.
-// You should only use this if you previously used ReadResponseUris and it returned NFD_OKAY!
-void ReadResponseUrisUnchecked(DBusMessage* msg, DBusMessageIter& uriIter) {
-    DBusMessageIter iter;
-    dbus_message_iter_init(msg, &iter);
-    dbus_message_iter_next(&iter);
-    ReadDict(iter, "uris", [&uriIter](DBusMessageIter& uris_iter) {
-        dbus_message_iter_recurse(&uris_iter, &uriIter);
-        return NFD_OKAY;
-    });
-}
-nfdpathsetsize_t ReadResponseUrisUncheckedGetArraySize(DBusMessage* msg) {
-    DBusMessageIter iter;
-    dbus_message_iter_init(msg, &iter);
-    dbus_message_iter_next(&iter);
-    nfdpathsetsize_t sz = 0;  // Initialization will never be used, but we initialize it to prevent
-                              // the uninitialized warning otherwise.
-    ReadDict(iter, "uris", [&sz](DBusMessageIter& uris_iter) {
-        sz = dbus_message_iter_get_element_count(&uris_iter);
-        return NFD_OKAY;
-    });
-    return sz;
-}
-
 // Read the response URI.  If response was okay, then returns NFD_OKAY and set file to it (the
 // pointer is set to some string owned by msg, so you should not manually free it). Otherwise,
 // returns NFD_CANCEL or NFD_ERROR as appropriate, and does not modify `file`.
@@ -978,15 +1076,15 @@ constexpr const char STR_RESPONSE_HANDLE_PREFIX[] = "/org/freedesktop/portal/des
 constexpr size_t STR_RESPONSE_HANDLE_PREFIX_LEN =
     sizeof(STR_RESPONSE_HANDLE_PREFIX) - 1;  // -1 to remove the \0.
 
-// Allocates and returns a path like "/org/freedesktop/portal/desktop/request/SENDER/TOKEN" with
-// randomly generated TOKEN as recommended by flatpak.  `handle_token_ptr` is a pointer to the
-// TOKEN part.
-char* MakeUniqueObjectPath(const char** handle_token_ptr) {
+// Allocates request_path_prefix, i.e. "/org/freedesktop/portal/desktop/request/SENDER/RANDOM_".
+// The random part (as recommended by flatpak) is generated only once, since appending a counter
+// to it is enough to keep the handles of this process unique.
+void MakeRequestPathPrefix() {
     const char* sender = dbus_unique_name;
     if (*sender == ':') ++sender;
     const size_t sender_len = strlen(sender);
-    const size_t sz = STR_RESPONSE_HANDLE_PREFIX_LEN + sender_len + 1 +
-                      64;  // 1 for '/', followed by 64 random chars
+    const size_t sz = STR_RESPONSE_HANDLE_PREFIX_LEN + sender_len + 1 + 64 +
+                      1;  // 1 for '/', followed by 64 random chars and '_'
     char* path = NFDi_Malloc<char>(sz + 1);
     char* path_ptr = path;
     path_ptr = copy(STR_RESPONSE_HANDLE_PREFIX,
@@ -994,13 +1092,35 @@ char* MakeUniqueObjectPath(const char** handle_token_ptr) {
                     path_ptr);
     path_ptr = transform(
         sender, sender + sender_len, path_ptr, [](char ch) { return ch != '.' ? ch : '_'; });
+    request_namespace_len = path_ptr - path;
     *path_ptr++ = '/';
-    *handle_token_ptr = path_ptr;
     path_ptr = Generate64RandomChars(path_ptr);
+    *path_ptr++ = '_';
+    *path_ptr = '\0';
+    request_path_prefix = path;
+    request_path_prefix_len = path_ptr - path;
+}
+
+// Allocates and returns a path like "/org/freedesktop/portal/desktop/request/SENDER/TOKEN", where
+// TOKEN is unique within this connection.  `handle_token_ptr` is a pointer to the TOKEN part.
+char* MakeUniqueObjectPath(const char** handle_token_ptr) {
+    const size_t sz = request_path_prefix_len + sizeof(uintptr_t) * 2;  // counter in hex
+    char* path = NFDi_Malloc<char>(sz + 1);
+    char* path_ptr = path;
+    path_ptr = copy(request_path_prefix, request_path_prefix + request_path_prefix_len, path_ptr);
+    path_ptr = FormatUIntToHexString(path_ptr, ++request_counter);
     *path_ptr = '\0';
+    *handle_token_ptr = path + request_namespace_len + 1;
     return path;
 }
 
+// Returns true if the given handle is in the namespace of our requests, so its Response signal is
+// delivered through response_subscription_rule.
+bool IsOwnRequestPath(const char* handle_path) {
+    return strncmp(handle_path, request_path_prefix, request_namespace_len) == 0 &&
+           handle_path[request_namespace_len] == '/';
+}
+
 constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_1[] =
     "type='signal',sender='org.freedesktop.portal.Desktop',path='";
 constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN =
@@ -1012,135 +1132,66 @@ constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN =
 constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_3[] = "'";
 constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN =
     sizeof(STR_RESPONSE_SUBSCRIPTION_PATH_3) - 1;
-
-class DBusSignalSubscriptionHandler {
-   private:
-    char* sub_cmd;
-
-   public:
-    DBusSignalSubscriptionHandler() : sub_cmd(nullptr) {}
-    ~DBusSignalSubscriptionHandler() {
-        if (sub_cmd) Unsubscribe();
-    }
-
-    nfdresult_t Subscribe(const char* handle_path) {
-        if (sub_cmd) Unsubscribe();
-        sub_cmd = MakeResponseSubscriptionPath(handle_path, dbus_unique_name);
-        DBusError err;
-        dbus_error_init(&err);
-        dbus_bus_add_match(dbus_conn, sub_cmd, &err);
-        if (dbus_error_is_set(&err)) {
-            dbus_error_free(&dbus_err);
-            dbus_move_error(&err, &dbus_err);
-            NFDi_SetError(dbus_err.message);
-            return NFD_ERROR;
-        }
-        return NFD_OKAY;
-    }
-
-    void Unsubscribe() {
-        DBusError err;
-        dbus_error_init(&err);
-        dbus_bus_remove_match(dbus_conn, sub_cmd, &err);
-        NFDi_Free(sub_cmd);
-        sub_cmd = nullptr;
-        dbus_error_free(
-            &err);  // silence unsubscribe errors, because this is intuitively part of 'cleanup'
-    }
-
-   private:
-    static char* MakeResponseSubscriptionPath(const char* handle_path, const char* unique_name) {
-        const size_t handle_path_len = strlen(handle_path);
-        const size_t unique_name_len = strlen(unique_name);
-        const size_t sz = STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN + handle_path_len +
-                          STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN + unique_name_len +
-                          STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN;
-        char* res = NFDi_Malloc<char>(sz + 1);
-        char* res_ptr = res;
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_1,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_1 + STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN,
-                       res_ptr);
-        res_ptr = copy(handle_path, handle_path + handle_path_len, res_ptr);
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_2,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_2 + STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN,
-                       res_ptr);
-        res_ptr = copy(unique_name, unique_name + unique_name_len, res_ptr);
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_3,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_3 + STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN,
-                       res_ptr);
-        *res_ptr = '\0';
-        return res;
-    }
-};
-
-// Returns true if the given file URI is decodable (i.e. not malformed), and false otherwise.
-// If this function returns true, then `out` will be populated with the length of the decoded URI
-// and `fileUriEnd` will point to the trailing null byte of `fileUri`. Otherwise, `out` and
-// `fileUriEnd` will be unmodified.
-bool TryUriDecodeLen(const char* fileUri, size_t& out, const char*& fileUriEnd) {
-    size_t len = 0;
-    while (*fileUri) {
-        if (*fileUri != '%') {
-            ++fileUri;
-        } else {
-            if (*(fileUri + 1) == '\0' || *(fileUri + 2) == '\0') {
-                return false;
-            }
-            if (!IsHex(*(fileUri + 1)) || !IsHex(*(fileUri + 2))) {
-                return false;
-            }
-            fileUri += 3;
-        }
-        ++len;
-    }
-    out = len;
-    fileUriEnd = fileUri;
-    return true;
+constexpr const char STR_RESPONSE_NAMESPACE_SUBSCRIPTION_PATH_1[] =
+    "type='signal',sender='org.freedesktop.portal.Desktop',path_namespace='";
+constexpr const char STR_RESPONSE_NAMESPACE_SUBSCRIPTION_PATH_1_LEN =
+    sizeof(STR_RESPONSE_NAMESPACE_SUBSCRIPTION_PATH_1) - 1;
+
+// Allocates and returns the match rule for Response signals from handles matched by
+// `rule_1 + path`.
+char* MakeResponseSubscriptionPath(const char* rule_1,
+                                   size_t rule_1_len,
+                                   const char* path,
+                                   size_t path_len,
+                                   const char* unique_name) {
+    const size_t unique_name_len = strlen(unique_name);
+    const size_t sz = rule_1_len + path_len + STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN +
+                      unique_name_len + STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN;
+    char* res = NFDi_Malloc<char>(sz + 1);
+    char* res_ptr = res;
+    res_ptr = copy(rule_1, rule_1 + rule_1_len, res_ptr);
+    res_ptr = copy(path, path + path_len, res_ptr);
+    res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_2,
+                   STR_RESPONSE_SUBSCRIPTION_PATH_2 + STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN,
+                   res_ptr);
+    res_ptr = copy(unique_name, unique_name + unique_name_len, res_ptr);
+    res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_3,
+                   STR_RESPONSE_SUBSCRIPTION_PATH_3 + STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN,
+                   res_ptr);
+    *res_ptr = '\0';
+    return res;
 }
 
-// Decodes the given URI and writes it to `outPath`.  The caller must ensure that the given URI is
-// not malformed (typically with a prior call to `TryUriDecodeLen`).  This function does not write
-// any trailing null character.
-char* UriDecodeUnchecked(const char* fileUri, const char* fileUriEnd, char* outPath) {
-    while (fileUri != fileUriEnd) {
-        if (*fileUri != '%') {
-            *outPath++ = *fileUri++;
-        } else {
-            ++fileUri;
-            const char high_nibble = ParseHexUnchecked(*fileUri++);
-            const char low_nibble = ParseHexUnchecked(*fileUri++);
-            *outPath++ = (high_nibble << 4) | low_nibble;
-        }
+constexpr const char FILE_URI_PREFIX[] = "file://";
+
+// Returns a pointer to the part of `fileUri` after the "file://" prefix, or null if `fileUri` does
+// not start with that prefix.
+const char* SkipFileUriPrefix(const char* fileUri) {
+    for (const char* prefix = FILE_URI_PREFIX; *prefix; ++prefix, ++fileUri) {
+        if (*prefix != *fileUri) return nullptr;
     }
-    return outPath;
+    return fileUri;
 }
 
-constexpr const char FILE_URI_PREFIX[] = "file://";
-constexpr size_t FILE_URI_PREFIX_LEN = sizeof(FILE_URI_PREFIX) - 1;
-
 // If fileUri starts with "file://", strips that prefix and URI-decodes the remaining part to a new
 // buffer, and make outPath point to it, and returns NFD_OKAY. Otherwise, does not modify outPath
 // and returns NFD_ERROR (with the correct error set)
 nfdresult_t AllocAndCopyFilePath(const char* fileUri, char*& outPath) {
-    const char* file_uri_iter = fileUri;
-    const char* prefix_begin = FILE_URI_PREFIX;
-    const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
-    for (; prefix_begin != prefix_end; ++prefix_begin, ++file_uri_iter) {
-        if (*prefix_begin != *file_uri_iter) {
-            NFDi_SetFormattedError(
-                "D-Bus freedesktop portal returned \"%s\", which is not a file URI.", fileUri);
-            return NFD_ERROR;
-        }
+    const char* const file_uri_iter = SkipFileUriPrefix(fileUri);
+    if (!file_uri_iter) {
+        NFDi_SetFormattedError(
+            "D-Bus freedesktop portal returned \"%s\", which is not a file URI.", fileUri);
+        return NFD_ERROR;
     }
-    size_t decoded_len;
-    const char* file_uri_end;
-    if (!TryUriDecodeLen(file_uri_iter, decoded_len, file_uri_end)) {
+    const char* const file_uri_end = file_uri_iter + strlen(file_uri_iter);
+    char* const path_without_prefix = NFDi_Malloc<char>(file_uri_end - file_uri_iter + 1);
+    char* const out_end = TryUriDecode(file_uri_iter, file_uri_end, path_without_prefix);
+    if (!out_end) {
+        NFDi_Free(path_without_prefix);
         NFDi_SetFormattedError("D-Bus freedesktop portal returned a malformed URI \"%s\".",
                                fileUri);
         return NFD_ERROR;
     }
-    char* const path_without_prefix = NFDi_Malloc<char>(decoded_len + 1);
-    char* const out_end = UriDecodeUnchecked(file_uri_iter, file_uri_end, path_without_prefix);
     *out_end = '\0';
     outPath = path_without_prefix;
     return NFD_OKAY;
@@ -1166,25 +1217,14 @@ bool TryGetValidExtension(const char* extn,
 // expected to be either in the form "*.abc" or "*", but this function will check for it, and ignore
 // the extension if it is not in the correct form.
 nfdresult_t AllocAndCopyFilePathWithExtn(const char* fileUri, const char* extn, char*& outPath) {
-    const char* file_uri_iter = fileUri;
-    const char* prefix_begin = FILE_URI_PREFIX;
-    const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
-    for (; prefix_begin != prefix_end; ++prefix_begin, ++file_uri_iter) {
-        if (*prefix_begin != *file_uri_iter) {
-            NFDi_SetFormattedError(
-                "D-Bus freedesktop portal returned \"%s\", which is not a file URI.", fileUri);
-            return NFD_ERROR;
-        }
-    }
-
-    size_t decoded_len;
-    const char* file_uri_end;
-    if (!TryUriDecodeLen(file_uri_iter, decoded_len, file_uri_end)) {
-        NFDi_SetFormattedError("D-Bus freedesktop portal returned a malformed URI \"%s\".",
-                               fileUri);
+    const char* const file_uri_iter = SkipFileUriPrefix(fileUri);
+    if (!file_uri_iter) {
+        NFDi_SetFormattedError(
+            "D-Bus freedesktop portal returned \"%s\", which is not a file URI.", fileUri);
         return NFD_ERROR;
     }
 
+    const char* const file_uri_end = file_uri_iter + strlen(file_uri_iter);
     const char* file_it = file_uri_end;
     // The following loop condition is safe because `FILE_URI_PREFIX` ends with '/',
     // so we won't iterate past the beginning of the URI.
@@ -1195,112 +1235,638 @@ nfdresult_t AllocAndCopyFilePathWithExtn(const char* fileUri, const char* extn,
     } while (*file_it != '/' && *file_it != '.');
     const char* trimmed_extn;      // includes the '.'
     const char* trimmed_extn_end;  // includes the '\0'
-    if (*file_it == '.' || !TryGetValidExtension(extn, trimmed_extn, trimmed_extn_end)) {
-        // has file extension already or no valid extension in `extn`
-        char* const path_without_prefix = NFDi_Malloc<char>(decoded_len + 1);
-        char* const out_end = UriDecodeUnchecked(file_uri_iter, file_uri_end, path_without_prefix);
-        *out_end = '\0';
-        outPath = path_without_prefix;
+    // append the extension only if there is no file extension yet and `extn` is valid
+    const bool append_extn =
+        *file_it != '.' && TryGetValidExtension(extn, trimmed_extn, trimmed_extn_end);
+    const size_t extn_len = append_extn ? trimmed_extn_end - trimmed_extn : 1;
+    char* const path_without_prefix = NFDi_Malloc<char>(file_uri_end - file_uri_iter + extn_len);
+    char* const out_mid = TryUriDecode(file_uri_iter, file_uri_end, path_without_prefix);
+    if (!out_mid) {
+        NFDi_Free(path_without_prefix);
+        NFDi_SetFormattedError("D-Bus freedesktop portal returned a malformed URI \"%s\".",
+                               fileUri);
+        return NFD_ERROR;
+    }
+    if (append_extn) {
+        copy(trimmed_extn, trimmed_extn_end, out_mid);
     } else {
-        // no file extension and we have a valid extension
-        char* const path_without_prefix =
-            NFDi_Malloc<char>(decoded_len + (trimmed_extn_end - trimmed_extn));
-        char* const out_mid = UriDecodeUnchecked(file_uri_iter, file_uri_end, path_without_prefix);
-        char* const out_end = copy(trimmed_extn, trimmed_extn_end, out_mid);
-        *out_end = '\0';
-        outPath = path_without_prefix;
+        *out_mid = '\0';
     }
+    outPath = path_without_prefix;
     return NFD_OKAY;
 }
 #endif
 
-// DBus wrapper function that helps invoke the portal for all OpenFile() variants.
-// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
-// Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
-// DBusMessage_Guard).
-template <bool Multiple, bool Directory>
-nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
-                              const nfdnfilteritem_t* filterList,
-                              nfdfiltersize_t filterCount,
-                              const nfdnchar_t* defaultPath,
-                              const nfdwindowhandle_t& parentWindow) {
-    const char* handle_token_ptr;
-    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
-    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
+// Copies `uri` unchanged to a new buffer, for callers that asked for NFD_PATH_FORMAT_URI.
+void AllocAndCopyUri(const char* uri, char*& outPath) {
+    const size_t uri_size = strlen(uri) + 1;
+    outPath = NFDi_Malloc<char>(uri_size);
+    copy(uri, uri + uri_size, outPath);
+}
 
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-                    // if it's stil set
-    dbus_error_init(&err);
+#ifdef NFD_APPEND_EXTENSION
+// Like AllocAndCopyUri, but if `uri` has no extension and `extn` is usable, appends the
+// percent-encoded extension.  See AllocAndCopyFilePathWithExtn for the expected form of `extn`.
+void AllocAndCopyUriWithExtn(const char* uri, const char* extn, char*& outPath) {
+    const char* const uri_end = uri + strlen(uri);
+    const char* uri_it = uri_end;
+    while (uri_it != uri && uri_it[-1] != '/' && uri_it[-1] != '.') --uri_it;
+    const char* trimmed_extn;      // includes the '.'
+    const char* trimmed_extn_end;  // includes the '\0'
+    if ((uri_it != uri && uri_it[-1] == '.') ||
+        !TryGetValidExtension(extn, trimmed_extn, trimmed_extn_end)) {
+        AllocAndCopyUri(uri, outPath);
+        return;
+    }
+    // reserve space for escaping every char of the extension
+    const size_t extn_len = static_cast<size_t>(trimmed_extn_end - trimmed_extn) - 1;
+    outPath = NFDi_Malloc<char>(static_cast<size_t>(uri_end - uri) + extn_len * 3 + 1);
+    char* out_it = copy(uri, uri_end, outPath);
+    for (const char* it = trimmed_extn; it != trimmed_extn_end - 1; ++it) {
+        const unsigned char ch = static_cast<unsigned char>(*it);
+        // only the unreserved chars of RFC 3986 are left as they are
+        if ((ch >= '0' && ch <= '9') || ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'z') || ch == '.' ||
+            ch == '-' || ch == '_' || ch == '~') {
+            *out_it++ = static_cast<char>(ch);
+        } else {
+            *out_it++ = '%';
+            *out_it++ = "0123456789ABCDEF"[ch >> 4];
+            *out_it++ = "0123456789ABCDEF"[ch & 15];
+        }
+    }
+    *out_it = '\0';
+}
+#endif
 
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
-    if (res != NFD_OKAY) return res;
+// The path set returned by the dialogs that allow multiple selection.  All the paths are decoded
+// once when the path set is built, and stored in a single allocation:  the PathSet header is
+// followed by `count` offsets (of type size_t), which are followed by the null-terminated paths.
+// Paths handed out by NFD_PathSet_GetPath point into this allocation, so they do not need to be
+// freed individually.
+// If the caller asked for NFD_PATH_FORMAT_URI, `uris` holds a reference to the response message
+// instead, and the header is followed by `count` pointers to the URIs in that message.
+struct alignas(size_t) PathSet {
+    nfdpathsetsize_t count;
+    DBusMessage* uris;
+};
 
-    // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
-    // Wayland?
+// Offset that marks a URI that could not be decoded; NFD_PathSet_GetPath returns NFD_ERROR for it.
+constexpr size_t INVALID_PATH_OFFSET = static_cast<size_t>(-1);
 
-    DBusMessage* query = dbus_message_new_method_call(
-        DBUS_DESTINATION, DBUS_PATH, DBUS_FILECHOOSER_IFACE, "OpenFile");
-    DBusMessage_Guard query_guard(query);
+const size_t* PathSetOffsets(const PathSet* pathSet) {
+    return reinterpret_cast<const size_t*>(pathSet + 1);
+}
 
-    DestroyFunc destroy;
-    AppendOpenFileQueryParams<Multiple, Directory>(
-        query, handle_token_ptr, filterList, filterCount, defaultPath, parentWindow, destroy);
+const char* PathSetData(const PathSet* pathSet) {
+    return reinterpret_cast<const char*>(PathSetOffsets(pathSet) + pathSet->count);
+}
 
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
-    DBusMessage_Guard reply_guard(reply);
+const char* const* PathSetUris(const PathSet* pathSet) {
+    return reinterpret_cast<const char* const*>(pathSet + 1);
+}
 
-    // Check the reply and update our signal subscription if necessary
+// The enumerator of a PathSet.  It is stored in the nfdpathsetenum_t provided by the caller.
+struct PathSetEnum {
+    const PathSet* pathSet;
+    nfdpathsetsize_t index;
+};
+static_assert(sizeof(PathSetEnum) <= sizeof(nfdpathsetenum_t),
+              "nfdpathsetenum_t is too small to hold the enumerator.");
+
+// Builds a path set from the URI array iterator obtained from ReadResponseUris(), decoding every
+// URI.  The path set does not reference the message, so the caller may free the message
+// afterwards.  If all the URIs are strings, then returns NFD_OKAY and sets `outPaths`.  Otherwise,
+// returns NFD_ERROR and does not modify `outPaths`.
+nfdresult_t AllocPathSet(DBusMessageIter uriIter, const nfdpathset_t*& outPaths) {
+    // The decoded path is never longer than the URI, so the total length of the URIs (including
+    // their null terminators) is enough to hold all the paths.
+    nfdpathsetsize_t count = 0;
+    size_t data_capacity = 0;
     {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
+        DBusMessageIter iter = uriIter;
+        for (int arg_type; (arg_type = dbus_message_iter_get_arg_type(&iter)) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&iter)) {
+            if (arg_type != DBUS_TYPE_STRING) {
+                NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+                return NFD_ERROR;
+            }
+            const char* uri;
+            dbus_message_iter_get_basic(&iter, &uri);
+            data_capacity += strlen(uri) + 1;
+            ++count;
         }
-
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
+    }
+    const size_t header_size = sizeof(PathSet) + sizeof(size_t) * static_cast<size_t>(count);
+    PathSet* pathSet = NFDi_Malloc<PathSet>(header_size + data_capacity);
+    pathSet->count = count;
+    pathSet->uris = nullptr;
+    size_t* const offsets = reinterpret_cast<size_t*>(pathSet + 1);
+    char* const data = reinterpret_cast<char*>(offsets + count);
+    char* data_end = data;
+    for (nfdpathsetsize_t i = 0; i != count; ++i, dbus_message_iter_next(&uriIter)) {
+        const char* uri;
+        dbus_message_iter_get_basic(&uriIter, &uri);
+        const char* const uri_without_prefix = SkipFileUriPrefix(uri);
+        char* const path_end =
+            uri_without_prefix
+                ? TryUriDecode(
+                      uri_without_prefix, uri_without_prefix + strlen(uri_without_prefix), data_end)
+                : nullptr;
+        if (!path_end) {
+            // nothing is kept from the malformed URI, so the next path overwrites it
+            offsets[i] = INVALID_PATH_OFFSET;
+            continue;
         }
+        offsets[i] = static_cast<size_t>(data_end - data);
+        data_end = path_end;
+        *data_end++ = '\0';
     }
+    // Give back the space that was reserved for the percent-encoding and the URI prefixes.
+    const size_t data_size = static_cast<size_t>(data_end - data);
+    if (data_size != data_capacity) {
+        pathSet = NFDi_Realloc(pathSet, header_size + data_size);
+    }
+    outPaths = pathSet;
+    return NFD_OKAY;
+}
 
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
-
-            if (dbus_message_is_signal(msg, DBUS_REQUEST_IFACE, "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
+// Builds a path set that borrows the URIs from `msg`, without decoding or copying them.  If all the
+// URIs are strings, then returns NFD_OKAY and sets `outPaths`.  Otherwise, returns NFD_ERROR and
+// does not modify `outPaths`.
+nfdresult_t AllocUriPathSet(DBusMessage* msg,
+                            DBusMessageIter uriIter,
+                            const nfdpathset_t*& outPaths) {
+    nfdpathsetsize_t count = 0;
+    {
+        DBusMessageIter iter = uriIter;
+        for (int arg_type; (arg_type = dbus_message_iter_get_arg_type(&iter)) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&iter)) {
+            if (arg_type != DBUS_TYPE_STRING) {
+                NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+                return NFD_ERROR;
             }
-
-            dbus_message_unref(msg);
+            ++count;
         }
-    } while (dbus_connection_read_write(dbus_conn, -1));
+    }
+    PathSet* const pathSet = NFDi_Malloc<PathSet>(sizeof(PathSet) +
+                                                  sizeof(const char*) * static_cast<size_t>(count));
+    pathSet->count = count;
+    pathSet->uris = dbus_message_ref(msg);
+    const char** const uris = reinterpret_cast<const char**>(pathSet + 1);
+    for (nfdpathsetsize_t i = 0; i != count; ++i, dbus_message_iter_next(&uriIter)) {
+        dbus_message_iter_get_basic(&uriIter, &uris[i]);
+    }
+    outPaths = pathSet;
+    return NFD_OKAY;
+}
 
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+// Sets `outPath` to the path at `index`, which points into the path set.  Returns NFD_ERROR if the
+// URI at that index could not be decoded.
+nfdresult_t GetPathSetPath(const PathSet* pathSet, nfdpathsetsize_t index, nfdnchar_t*& outPath) {
+    if (pathSet->uris) {
+        outPath = const_cast<nfdnchar_t*>(PathSetUris(pathSet)[index]);
+        return NFD_OKAY;
+    }
+    const size_t offset = PathSetOffsets(pathSet)[index];
+    if (offset == INVALID_PATH_OFFSET) {
+        NFDi_SetFormattedError(
+            "D-Bus freedesktop portal returned a malformed file URI at index %u.", index);
+        return NFD_ERROR;
+    }
+    outPath = const_cast<nfdnchar_t*>(PathSetData(pathSet) + offset);
+    return NFD_OKAY;
 }
 
-// DBus wrapper function that helps invoke the portal for the SaveFile() API.
-// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
+#ifdef NFD_PORTAL_HOST_PATHS
+constexpr const char* DBUS_DOCUMENTS_DESTINATION = "org.freedesktop.portal.Documents";
+constexpr const char* DBUS_DOCUMENTS_PATH = "/org/freedesktop/portal/documents";
+constexpr const char* DBUS_DOCUMENTS_IFACE = "org.freedesktop.portal.Documents";
+#endif
+
+constexpr const char STR_PORTAL_OWNER_SUBSCRIPTION_PATH[] =
+    "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',"
+    "member='NameOwnerChanged',arg0='org.freedesktop.portal.Desktop'";
+
+// Handles a message that is not the response we are waiting for.  If the portal has been replaced
+// (e.g. because it restarted), the cached capabilities are dropped so that they will be fetched
+// again from the new portal.  Anything else is counted as a foreign message.
+void HandleOtherMessage(DBusMessage* msg) {
+    if (dbus_message_is_signal(msg, DBUS_BUS_IFACE, "NameOwnerChanged")) {
+        const char* name;
+        if (dbus_message_get_args(msg, nullptr, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID) &&
+            strcmp(name, DBUS_DESTINATION) == 0) {
+            __atomic_store_n(&portal_caps_valid, false, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_add_fetch(&foreign_message_count, 1, __ATOMIC_RELAXED);
+}
+
+// Releases our reference to the connection, closing it first if it is our own.
+void NFD_DBus_CloseConnection() {
+#ifdef NFD_PORTAL_PRIVATE_CONNECTION
+    dbus_connection_close(dbus_conn);
+#endif
+    dbus_connection_unref(dbus_conn);
+}
+
+// Wakes the thread that is waiting for the connection, if any, after a message that some thread
+// waits for has been dispatched.  The eventfd stays signalled until that thread reads it, so the
+// wakeup is not lost even if it is not polling yet, and it wakes the other waiting threads in turn.
+void WakeWaiters() {
+    const uint64_t one = 1;
+    const ssize_t res = write(dispatch_wake_fd, &one, sizeof(one));
+    (void)res;  // if it fails, the eventfd is already signalled
+}
+
+// Filter for every message that is dispatched on our connection, on whichever thread dispatches
+// it.  A Response signal is handed to the thread that is waiting for it, if any.
+DBusHandlerResult DispatchFilter(DBusConnection*, DBusMessage* msg, void*) {
+    if (dbus_message_is_signal(msg, DBUS_REQUEST_IFACE, "Response")) {
+        const char* path = dbus_message_get_path(msg);
+        Mutex_Guard lock(&waiter_mutex);
+        for (Waiter* waiter = response_waiters; waiter; waiter = waiter->next) {
+            if (!__atomic_load_n(&waiter->msg, __ATOMIC_RELAXED) &&
+                strcmp(waiter->path, path) == 0) {
+                __atomic_store_n(&waiter->msg, dbus_message_ref(msg), __ATOMIC_RELEASE);
+                WakeWaiters();
+                return DBUS_HANDLER_RESULT_HANDLED;
+            }
+        }
+        // nobody is waiting for it, e.g. it is a late response to an abandoned request
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    HandleOtherMessage(msg);
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+// Called on whichever thread completes a pending call.  The reply stays in the pending call, so
+// this only needs to wake the thread that waits for it.
+void PendingCallNotify(DBusPendingCall*, void*) {
+    WakeWaiters();
+}
+
+// Returns true if the message that the waiter waits for has arrived.
+bool IsWaiterDone(Waiter& waiter) {
+    if (waiter.pending) return dbus_pending_call_get_completed(waiter.pending);
+    return __atomic_load_n(&waiter.msg, __ATOMIC_ACQUIRE) != nullptr;
+}
+
+// Dispatches the messages that libdbus has already read.  Replies complete their pending calls,
+// and everything else goes through DispatchFilter.
+void DispatchQueued() {
+    while (dbus_connection_dispatch(dbus_conn) == DBUS_DISPATCH_DATA_REMAINS) {
+    }
+}
+
+// Wakes the thread that is waiting for the connection, so that it sends whatever libdbus could
+// not send immediately.  Call this after queuing a message for sending.
+void WakeDispatcher() {
+    if (dispatch_active) {
+        const uint64_t one = 1;
+        const ssize_t res = write(dispatch_wake_fd, &one, sizeof(one));
+        (void)res;  // if it fails, the eventfd is already signalled
+    }
+}
+
+// Computes the deadline for a timeout in milliseconds.  Returns a pointer to outDeadline, or
+// nullptr if timeoutMs is 0 (i.e. there is no deadline).
+const timespec* MakeDeadline(unsigned int timeoutMs, timespec& outDeadline) {
+    if (timeoutMs == 0) return nullptr;
+    clock_gettime(CLOCK_MONOTONIC, &outDeadline);
+    outDeadline.tv_sec += timeoutMs / 1000;
+    outDeadline.tv_nsec += static_cast<long>(timeoutMs % 1000) * 1000000;
+    if (outDeadline.tv_nsec >= 1000000000) {
+        outDeadline.tv_nsec -= 1000000000;
+        ++outDeadline.tv_sec;
+    }
+    return &outDeadline;
+}
+
+// Gets the deadline that the caller of a *_With() function asked for.
+template <typename Args>
+const timespec* GetDeadline(nfdversion_t version, const Args* args, timespec& outDeadline) {
+    // timeoutMs was added in version 2 of the interface
+    return MakeDeadline(version >= 2 ? args->timeoutMs : 0, outDeadline);
+}
+
+// Returns the timeout for poll() (in milliseconds, rounded up), which is 0 if the deadline has
+// passed, or -1 if there is no deadline.
+int PollTimeout(const timespec* deadline) {
+    if (!deadline) return -1;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long remaining_ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL +
+                                   (deadline->tv_nsec - now.tv_nsec);
+    if (remaining_ns <= 0) return 0;
+    const long long remaining_ms = (remaining_ns + 999999) / 1000000;
+    return remaining_ms < INT32_MAX ? static_cast<int>(remaining_ms) : INT32_MAX;
+}
+
+// Waits until the message of the waiter has arrived, or until the deadline (if not nullptr) has
+// passed.  Must be called with nfd_mutex held.
+// Any number of threads may wait at the same time.  One of them polls the connection and
+// dispatches whatever arrives, while the others sleep until it has done so.  The polling thread
+// doesn't block inside libdbus, so the other threads can still send messages in the meantime.
+nfdresult_t NFD_DBus_Wait(Waiter& waiter, const timespec* deadline) {
+    while (!IsWaiterDone(waiter)) {
+        const int timeout = PollTimeout(deadline);
+        if (timeout == 0) {
+            NFDi_SetError("Timed out waiting for the D-Bus freedesktop portal.");
+            return NFD_ERROR;
+        }
+        if (dispatch_active) {
+            if (deadline) {
+                pthread_cond_timedwait(&dispatch_cond, &nfd_mutex, deadline);
+            } else {
+                pthread_cond_wait(&dispatch_cond, &nfd_mutex);
+            }
+            continue;
+        }
+
+        // messages might have been read but not dispatched yet
+        DispatchQueued();
+        if (IsWaiterDone(waiter)) break;
+
+        int fd;
+        if (!dbus_connection_get_unix_fd(dbus_conn, &fd)) {
+            NFDi_SetError("D-Bus connection has been closed.");
+            return NFD_ERROR;
+        }
+        struct pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = dbus_connection_has_messages_to_send(dbus_conn) ? POLLIN | POLLOUT : POLLIN;
+        fds[1].fd = dispatch_wake_fd;
+        fds[1].events = POLLIN;
+
+        dispatch_active = true;
+        pthread_mutex_unlock(&nfd_mutex);
+        const int poll_res = poll(fds, 2, timeout);
+        const int poll_errno = errno;
+        pthread_mutex_lock(&nfd_mutex);
+        dispatch_active = false;
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            const ssize_t res = read(dispatch_wake_fd, &count, sizeof(count));
+            (void)res;  // it is non-blocking, so this only fails if another thread reset it
+        }
+        const bool connected = dbus_connection_read_write(dbus_conn, 0);
+        DispatchQueued();
+        pthread_cond_broadcast(&dispatch_cond);
+
+        if (poll_res < 0 && poll_errno != EINTR) {
+            NFDi_SetFormattedError("Failed to poll the D-Bus connection (errno %d).", poll_errno);
+            return NFD_ERROR;
+        }
+        if (!connected) {
+            NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
+            return NFD_ERROR;
+        }
+    }
+    return NFD_OKAY;
+}
+
+// Waits for the reply of a pending call, and cancels the call if the deadline passes first.  Must
+// be called with nfd_mutex held.
+nfdresult_t NFD_DBus_WaitForReply(DBusPendingCall* pending,
+                                  DBusMessage*& outReply,
+                                  const timespec* deadline) {
+    // set this before checking whether the call has completed, so that a completion on another
+    // thread either is seen by NFD_DBus_Wait or wakes it
+    dbus_pending_call_set_notify(pending, &PendingCallNotify, nullptr, nullptr);
+    Waiter waiter{nullptr, pending, nullptr, nullptr};
+    const nfdresult_t res = NFD_DBus_Wait(waiter, deadline);
+    if (res != NFD_OKAY) {
+        dbus_pending_call_cancel(pending);
+        return res;
+    }
+    outReply = dbus_pending_call_steal_reply(pending);
+    return NFD_OKAY;
+}
+
+// Sends a method call and waits for its reply, which is set to outReply unless it is an error.
+// Must be called with nfd_mutex held.  Caller is responsible for freeing the outReply using
+// dbus_message_unref() (or use DBusMessage_Guard).
+nfdresult_t NFD_DBus_Call(DBusMessage* query, DBusMessage*& outReply, const timespec* deadline) {
+    DBusPendingCall* pending;
+    if (!dbus_connection_send_with_reply(dbus_conn, query, &pending, DBUS_TIMEOUT_INFINITE) ||
+        !pending) {
+        NFDi_SetError("Failed to send the D-Bus message.");
+        return NFD_ERROR;
+    }
+    WakeDispatcher();
+    DBusMessage* reply;
+    const nfdresult_t res = NFD_DBus_WaitForReply(pending, reply, deadline);
+    dbus_pending_call_unref(pending);
+    if (res != NFD_OKAY) return res;
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+        dbus_error_free(&dbus_err);
+        dbus_set_error_from_message(&dbus_err, reply);
+        NFDi_SetError(dbus_err.message);
+        dbus_message_unref(reply);
+        return NFD_ERROR;
+    }
+    outReply = reply;
+    return NFD_OKAY;
+}
+
+// Adds a match rule to our connection, and waits for the bus to confirm it.
+nfdresult_t NFD_DBus_AddMatch(const char* rule, const timespec* deadline) {
+    DBusMessage* query =
+        dbus_message_new_method_call(DBUS_BUS_IFACE, DBUS_BUS_PATH, DBUS_BUS_IFACE, "AddMatch");
+    DBusMessage_Guard query_guard(query);
+    dbus_message_append_args(query, DBUS_TYPE_STRING, &rule, DBUS_TYPE_INVALID);
+    DBusMessage* reply;
+    const nfdresult_t res = NFD_DBus_Call(query, reply, deadline);
+    if (res != NFD_OKAY) return res;
+    dbus_message_unref(reply);
+    return NFD_OKAY;
+}
+
+// Registers a thread that waits for the Response signal of a request, for the lifetime of this
+// object.  The Response is dropped if it arrives but is never taken from the Waiter.
+struct ResponseWaiter_Guard {
+    Waiter& data;
+    ResponseWaiter_Guard(Waiter& waiter) noexcept : data(waiter) {
+        Mutex_Guard lock(&waiter_mutex);
+        data.next = response_waiters;
+        response_waiters = &data;
+    }
+    ~ResponseWaiter_Guard() {
+        Mutex_Guard lock(&waiter_mutex);
+        Waiter** ptr = &response_waiters;
+        while (*ptr != &data) ptr = &(*ptr)->next;
+        *ptr = data.next;
+        if (data.msg) dbus_message_unref(data.msg);
+    }
+
+    // Changes the handle whose Response is awaited.
+    void SetPath(const char* path) {
+        Mutex_Guard lock(&waiter_mutex);
+        data.path = path;
+    }
+
+    // Takes the Response, which must have arrived.
+    DBusMessage* TakeMessage() {
+        Mutex_Guard lock(&waiter_mutex);
+        DBusMessage* msg = data.msg;
+        data.msg = nullptr;
+        return msg;
+    }
+};
+
+// Subscribes to the Response signals of all our requests.  This is done once per connection, so
+// that each dialog needs only a single round-trip to the bus.
+nfdresult_t SubscribeToResponses(const timespec* deadline) {
+    if (response_subscribed) return NFD_OKAY;
+    // The bus handles our messages in order, so other threads may send requests right away without
+    // waiting for the bus to confirm the rule.
+    response_subscribed = true;
+    const nfdresult_t res = NFD_DBus_AddMatch(response_subscription_rule, deadline);
+    if (res != NFD_OKAY) response_subscribed = false;
+    return res;
+}
+
+// Subscribes to the Response signal of a single request, for portals that do not put the handle
+// in the namespace of our requests.
+class DBusSignalSubscriptionHandler {
+   private:
+    char* sub_cmd;
+
+   public:
+    DBusSignalSubscriptionHandler() : sub_cmd(nullptr) {}
+    ~DBusSignalSubscriptionHandler() {
+        if (sub_cmd) Unsubscribe();
+    }
+
+    nfdresult_t Subscribe(const char* handle_path, const timespec* deadline) {
+        if (sub_cmd) Unsubscribe();
+        sub_cmd = MakeResponseSubscriptionPath(STR_RESPONSE_SUBSCRIPTION_PATH_1,
+                                               STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN,
+                                               handle_path,
+                                               strlen(handle_path),
+                                               dbus_unique_name);
+        return NFD_DBus_AddMatch(sub_cmd, deadline);
+    }
+
+    void Unsubscribe() {
+        // don't wait for the reply, because this is intuitively part of 'cleanup'
+        dbus_bus_remove_match(dbus_conn, sub_cmd, nullptr);
+        WakeDispatcher();
+        NFDi_Free(sub_cmd);
+        sub_cmd = nullptr;
+    }
+};
+
+// Asks the portal to close the dialog of a request that we have given up on.  We don't wait for the
+// reply, and there is nothing to do if the request no longer exists.
+void NFD_DBus_CloseRequest(const char* handle_path) {
+    DBusMessage* query =
+        dbus_message_new_method_call(DBUS_DESTINATION, handle_path, DBUS_REQUEST_IFACE, "Close");
+    DBusMessage_Guard query_guard(query);
+    dbus_message_set_no_reply(query, true);
+    // if the portal isn't running, there is no dialog to close
+    dbus_message_set_auto_start(query, false);
+    dbus_connection_send(dbus_conn, query, nullptr);
+    dbus_connection_flush(dbus_conn);
+}
+
+// Sends the given portal request and waits for its Response signal.  Signals from other requests
+// (e.g. late responses to requests that have already been abandoned) are discarded.  If this
+// fails after the request has been sent (e.g. because the deadline has passed), the request is
+// closed so that the portal doesn't keep showing its dialog.  Must be called with nfd_mutex held.
+// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
+nfdresult_t NFD_DBus_SendRequest(DBusMessage*& outMsg,
+                                 DBusMessage* query,
+                                 const char* handle_obj_path,
+                                 const timespec* deadline) {
+    // wait for the Response before sending, so that it can't arrive before we are ready for it
+    Waiter waiter{handle_obj_path, nullptr, nullptr, nullptr};
+    ResponseWaiter_Guard waiter_guard(waiter);
+
+    DBusMessage* reply;
+    nfdresult_t res = NFD_DBus_Call(query, reply, deadline);
+    if (res != NFD_OKAY) {
+        // The portal might not have replied yet, but it handles our messages in order.  If it has
+        // sent an error instead, there is no request and closing it does nothing.
+        NFD_DBus_CloseRequest(handle_obj_path);
+        return res;
+    }
+    DBusMessage_Guard reply_guard(reply);
+
+    // Check the reply and subscribe to the returned handle if our subscription does not cover it
+    const char* path;
+    {
+        DBusMessageIter iter;
+        if (!dbus_message_iter_init(reply, &iter)) {
+            NFDi_SetError("D-Bus reply is missing an argument.");
+            return NFD_ERROR;
+        }
+        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
+            NFDi_SetError("D-Bus reply is not an object path.");
+            return NFD_ERROR;
+        }
+        dbus_message_iter_get_basic(&iter, &path);
+    }
+    DBusSignalSubscriptionHandler signal_sub;
+    if (strcmp(path, handle_obj_path) != 0) {
+        if (!IsOwnRequestPath(path)) {
+            // old portals ignore the handle token and might return a handle outside our namespace
+            res = signal_sub.Subscribe(path, deadline);
+            if (res != NFD_OKAY) {
+                NFD_DBus_CloseRequest(path);
+                return res;
+            }
+        }
+        waiter_guard.SetPath(path);
+    }
+
+    // Wait and read the response
+    res = NFD_DBus_Wait(waiter, deadline);
+    if (res != NFD_OKAY) {
+        NFD_DBus_CloseRequest(path);
+        return res;
+    }
+    outMsg = waiter_guard.TakeMessage();
+    return NFD_OKAY;
+}
+
+// DBus wrapper function that helps invoke the portal for all OpenFile() variants.
+// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
+// Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
+// DBusMessage_Guard).
+template <bool Multiple, bool Directory>
+nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
+                              const nfdnfilteritem_t* filterList,
+                              nfdfiltersize_t filterCount,
+                              const nfdnchar_t* defaultPath,
+                              const nfdwindowhandle_t& parentWindow,
+                              const timespec* deadline) {
+    Mutex_Guard lock(&nfd_mutex);
+    const char* handle_token_ptr;
+    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
+    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
+
+    const nfdresult_t res = SubscribeToResponses(deadline);
+    if (res != NFD_OKAY) return res;
+
+    // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
+    // Wayland?
+
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_DESTINATION, DBUS_PATH, DBUS_FILECHOOSER_IFACE, "OpenFile");
+    DBusMessage_Guard query_guard(query);
+
+    DestroyFunc destroy;
+    AppendOpenFileQueryParams<Multiple, Directory>(
+        query, handle_token_ptr, filterList, filterCount, defaultPath, parentWindow, destroy);
+
+    return NFD_DBus_SendRequest(outMsg, query, handle_obj_path, deadline);
+}
+
+// DBus wrapper function that helps invoke the portal for the SaveFile() API.
+// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
 // Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
 // DBusMessage_Guard).
 nfdresult_t NFD_DBus_SaveFile(DBusMessage*& outMsg,
@@ -1308,18 +1874,14 @@ nfdresult_t NFD_DBus_SaveFile(DBusMessage*& outMsg,
                               nfdfiltersize_t filterCount,
                               const nfdnchar_t* defaultPath,
                               const nfdnchar_t* defaultName,
-                              const nfdwindowhandle_t& parentWindow) {
+                              const nfdwindowhandle_t& parentWindow,
+                              const timespec* deadline) {
+    Mutex_Guard lock(&nfd_mutex);
     const char* handle_token_ptr;
     char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
     Free_Guard<char> handle_obj_path_guard(handle_obj_path);
 
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-                    // if it's stil set
-    dbus_error_init(&err);
-
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
+    const nfdresult_t res = SubscribeToResponses(deadline);
     if (res != NFD_OKAY) return res;
 
     // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
@@ -1339,86 +1901,63 @@ nfdresult_t NFD_DBus_SaveFile(DBusMessage*& outMsg,
                               parentWindow,
                               destroy);
 
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
-    DBusMessage_Guard reply_guard(reply);
-
-    // Check the reply and update our signal subscription if necessary
-    {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
-        }
+    return NFD_DBus_SendRequest(outMsg, query, handle_obj_path, deadline);
+}
 
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
-        }
-    }
+// DBus wrapper function that helps invoke the portal for the SaveFiles() API.
+// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
+// Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
+// DBusMessage_Guard).
+nfdresult_t NFD_DBus_SaveFiles(DBusMessage*& outMsg,
+                               const nfdnchar_t* const* fileNames,
+                               nfdpathsetsize_t fileCount,
+                               const nfdnchar_t* defaultPath,
+                               const nfdwindowhandle_t& parentWindow,
+                               const timespec* deadline) {
+    Mutex_Guard lock(&nfd_mutex);
+    const char* handle_token_ptr;
+    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
+    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
 
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
+    const nfdresult_t res = SubscribeToResponses(deadline);
+    if (res != NFD_OKAY) return res;
 
-            if (dbus_message_is_signal(msg, DBUS_REQUEST_IFACE, "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
-            }
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_DESTINATION, DBUS_PATH, DBUS_FILECHOOSER_IFACE, "SaveFiles");
+    DBusMessage_Guard query_guard(query);
 
-            dbus_message_unref(msg);
-        }
-    } while (dbus_connection_read_write(dbus_conn, -1));
+    DestroyFunc destroy;
+    AppendSaveFilesQueryParams(
+        query, handle_token_ptr, fileNames, fileCount, defaultPath, parentWindow, destroy);
 
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+    return NFD_DBus_SendRequest(outMsg, query, handle_obj_path, deadline);
 }
 
-nfdresult_t NFD_DBus_GetVersion(dbus_uint32_t& outVersion) {
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-                    // if it's stil set
-    dbus_error_init(&err);
-
+// Allocates the query for the version of the FileChooser interface.  Caller is responsible for
+// freeing it using dbus_message_unref() (or use DBusMessage_Guard).
+DBusMessage* MakeVersionQuery() {
     DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
                                                       "/org/freedesktop/portal/desktop",
                                                       "org.freedesktop.DBus.Properties",
                                                       "Get");
-    DBusMessage_Guard query_guard(query);
-    {
-        DBusMessageIter iter;
-        dbus_message_iter_init_append(query, &iter);
+    DBusMessageIter iter;
+    dbus_message_iter_init_append(query, &iter);
 
-        constexpr const char* STR_INTERFACE = "org.freedesktop.portal.FileChooser";
-        dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_INTERFACE);
-        constexpr const char* STR_VERSION = "version";
-        dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_VERSION);
-    }
+    constexpr const char* STR_INTERFACE = "org.freedesktop.portal.FileChooser";
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_INTERFACE);
+    constexpr const char* STR_VERSION = "version";
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_VERSION);
+    return query;
+}
 
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
+// Reads the version of the FileChooser interface from the reply to MakeVersionQuery().
+nfdresult_t ReadVersionReply(DBusMessage* reply, dbus_uint32_t& outVersion) {
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
         dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
+        dbus_set_error_from_message(&dbus_err, reply);
         NFDi_SetError(dbus_err.message);
         return NFD_ERROR;
     }
-    DBusMessage_Guard reply_guard(reply);
     {
         DBusMessageIter iter;
         if (!dbus_message_iter_init(reply, &iter)) {
@@ -1441,6 +1980,411 @@ nfdresult_t NFD_DBus_GetVersion(dbus_uint32_t& outVersion) {
     return NFD_OKAY;
 }
 
+nfdresult_t NFD_DBus_GetVersion(dbus_uint32_t& outVersion, const timespec* deadline) {
+    DBusMessage* query = MakeVersionQuery();
+    DBusMessage_Guard query_guard(query);
+
+    DBusMessage* reply;
+    const nfdresult_t res = NFD_DBus_Call(query, reply, deadline);
+    if (res != NFD_OKAY) return res;
+    DBusMessage_Guard reply_guard(reply);
+    return ReadVersionReply(reply, outVersion);
+}
+
+#ifdef NFD_PORTAL_WARM_UP
+// Sends a method call whose reply is waited for later, and returns the pending call, or nullptr if
+// it could not be sent.
+DBusPendingCall* NFD_DBus_SendWithReply(DBusMessage* query) {
+    DBusPendingCall* pending;
+    if (!dbus_connection_send_with_reply(dbus_conn, query, &pending, DBUS_TIMEOUT_INFINITE)) {
+        return nullptr;
+    }
+    return pending;
+}
+
+// Starts the portal (if it is D-Bus activated), subscribes to its signals, and asks for its
+// capabilities, without waiting for any of the replies.  Dialogs only wait for the replies that
+// they need, so the activation of the portal overlaps with whatever the application does before
+// showing the first dialog.
+void NFD_DBus_WarmUp() {
+    {
+        DBusMessage* query = dbus_message_new_method_call(
+            DBUS_BUS_IFACE, DBUS_BUS_PATH, DBUS_BUS_IFACE, "StartServiceByName");
+        DBusMessage_Guard query_guard(query);
+        const dbus_uint32_t flags = 0;
+        dbus_message_append_args(query,
+                                 DBUS_TYPE_STRING,
+                                 &DBUS_DESTINATION,
+                                 DBUS_TYPE_UINT32,
+                                 &flags,
+                                 DBUS_TYPE_INVALID);
+        // we don't care about the reply, since the version query fails if the portal can't start
+        dbus_message_set_no_reply(query, true);
+        dbus_connection_send(dbus_conn, query, nullptr);
+    }
+    {
+        // The capabilities may only be cached once the bus has confirmed this subscription, so
+        // NFD_DBus_GetCapabilities waits for its reply.  The bus handles our messages in order, so
+        // the subscription is in place before the portal gets the version query.
+        const char* rule = STR_PORTAL_OWNER_SUBSCRIPTION_PATH;
+        DBusMessage* query =
+            dbus_message_new_method_call(DBUS_BUS_IFACE, DBUS_BUS_PATH, DBUS_BUS_IFACE, "AddMatch");
+        DBusMessage_Guard query_guard(query);
+        dbus_message_append_args(query, DBUS_TYPE_STRING, &rule, DBUS_TYPE_INVALID);
+        warm_up_owner_match_call = NFD_DBus_SendWithReply(query);
+    }
+    {
+        DBusMessage* query = MakeVersionQuery();
+        DBusMessage_Guard query_guard(query);
+        warm_up_version_call = NFD_DBus_SendWithReply(query);
+    }
+    // Without an error object, this doesn't wait for the bus to reply.  Requests are sent after it,
+    // so they are handled after it too.
+    dbus_bus_add_match(dbus_conn, response_subscription_rule, nullptr);
+    response_subscribed = true;
+    dbus_connection_flush(dbus_conn);
+}
+
+// Waits for the reply to the subscription that NFD_DBus_WarmUp sent, and returns true if the bus
+// accepted it.  Must be called with nfd_mutex held.
+bool NFD_DBus_ConfirmWarmUpOwnerMatch(const timespec* deadline) {
+    DBusPendingCall* pending = warm_up_owner_match_call;
+    warm_up_owner_match_call = nullptr;
+    DBusMessage* reply;
+    const nfdresult_t res = NFD_DBus_WaitForReply(pending, reply, deadline);
+    dbus_pending_call_unref(pending);
+    if (res != NFD_OKAY) return false;
+    const bool accepted = dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR;
+    dbus_message_unref(reply);
+    return accepted;
+}
+
+void NFD_DBus_CancelWarmUp() {
+    if (warm_up_version_call) {
+        dbus_pending_call_cancel(warm_up_version_call);
+        dbus_pending_call_unref(warm_up_version_call);
+        warm_up_version_call = nullptr;
+    }
+    if (warm_up_owner_match_call) {
+        // the bus has probably added the rule anyway, so don't leave it behind on the connection
+        dbus_pending_call_cancel(warm_up_owner_match_call);
+        dbus_pending_call_unref(warm_up_owner_match_call);
+        warm_up_owner_match_call = nullptr;
+        dbus_bus_remove_match(dbus_conn, STR_PORTAL_OWNER_SUBSCRIPTION_PATH, nullptr);
+    }
+}
+#endif
+
+// Gets the capabilities of the portal, using the cached capabilities if the portal has not changed
+// since they were fetched.  In the steady state this does not need any round-trip to the bus.
+nfdresult_t NFD_DBus_GetCapabilities(PortalCapabilities& outCaps, const timespec* deadline) {
+    Mutex_Guard lock(&nfd_mutex);
+    if (__atomic_load_n(&portal_caps_valid, __ATOMIC_RELAXED)) {
+        // Look at what has arrived since the last dialog, in case the portal has been replaced.
+        // If another thread is waiting for the connection, it does this for us.
+        if (!dispatch_active) {
+            dbus_connection_read_write(dbus_conn, 0);
+            DispatchQueued();
+        }
+        if (__atomic_load_n(&portal_caps_valid, __ATOMIC_RELAXED)) {
+            outCaps = portal_caps;
+            return NFD_OKAY;
+        }
+    }
+#ifdef NFD_PORTAL_WARM_UP
+    if (warm_up_owner_match_call) {
+        // If the bus rejected it (or we gave up waiting), it is sent again below.
+        portal_owner_subscribed = NFD_DBus_ConfirmWarmUpOwnerMatch(deadline);
+    }
+    if (warm_up_version_call) {
+        // use the version that NFD_Init asked for, waiting for it if it hasn't arrived yet
+        DBusPendingCall* pending = warm_up_version_call;
+        warm_up_version_call = nullptr;
+        DBusMessage* reply;
+        const nfdresult_t res = NFD_DBus_WaitForReply(pending, reply, deadline);
+        dbus_pending_call_unref(pending);
+        if (res == NFD_OKAY) {
+            DBusMessage_Guard reply_guard(reply);
+            if (ReadVersionReply(reply, portal_caps.fileChooserVersion) == NFD_OKAY) {
+                __atomic_store_n(&portal_caps_valid, portal_owner_subscribed, __ATOMIC_RELAXED);
+                outCaps = portal_caps;
+                return NFD_OKAY;
+            }
+            // the portal might not have been ready yet, so ask again below
+        }
+    }
+#endif
+    if (!portal_owner_subscribed) {
+        // If this fails, we can still fetch the capabilities, but we cannot cache them since we
+        // would not know when the portal is replaced.
+        portal_owner_subscribed = true;
+        if (NFD_DBus_AddMatch(STR_PORTAL_OWNER_SUBSCRIPTION_PATH, deadline) != NFD_OKAY) {
+            portal_owner_subscribed = false;
+        }
+    }
+    PortalCapabilities caps;
+    const nfdresult_t res = NFD_DBus_GetVersion(caps.fileChooserVersion, deadline);
+    if (res != NFD_OKAY) return res;
+    portal_caps = caps;
+    __atomic_store_n(&portal_caps_valid, portal_owner_subscribed, __ATOMIC_RELAXED);
+    outCaps = caps;
+    return NFD_OKAY;
+}
+
+#ifdef NFD_PORTAL_HOST_PATHS
+// Looks up the mount point of the document portal, unless that has already been done.  Returns
+// false if there is no document portal.  Must be called with nfd_mutex held.
+bool NFD_DBus_GetDocumentsMountPoint(const timespec* deadline) {
+    if (documents_mount_point_valid) return documents_mount_point;
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_DOCUMENTS_DESTINATION, DBUS_DOCUMENTS_PATH, DBUS_DOCUMENTS_IFACE, "GetMountPoint");
+    DBusMessage_Guard query_guard(query);
+    DBusMessage* reply;
+    dbus_error_free(&dbus_err);
+    if (NFD_DBus_Call(query, reply, deadline) != NFD_OKAY) {
+        // Remember the failure only if the bus answered with an error (e.g. because there is no
+        // document portal), and not if we merely timed out.  The dialog itself has succeeded, so
+        // this is not reported to the caller.
+        documents_mount_point_valid = dbus_error_is_set(&dbus_err);
+        NFD_ClearError();
+        return false;
+    }
+    DBusMessage_Guard reply_guard(reply);
+    documents_mount_point_valid = true;
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(reply, &iter) ||
+        dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
+        dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_BYTE) {
+        return false;
+    }
+    DBusMessageIter byte_iter;
+    dbus_message_iter_recurse(&iter, &byte_iter);
+    const char* path;
+    int path_len;
+    dbus_message_iter_get_fixed_array(&byte_iter, &path, &path_len);
+    // the path might be null-terminated
+    if (path_len && path[path_len - 1] == '\0') --path_len;
+    if (!path_len) return false;
+    documents_mount_point_len = static_cast<size_t>(path_len) + 1;
+    documents_mount_point = NFDi_Malloc<char>(documents_mount_point_len + 1);
+    char* end = copy(path, path + path_len, documents_mount_point);
+    *end++ = '/';
+    *end = '\0';
+    return true;
+}
+
+// A path inside the document portal, which looks like <mount point>/<document id>/<name>[/...].
+struct DocumentPath {
+    const char* id;  // not null-terminated
+    size_t id_len;
+    const char* rest;  // the part of the path after <name>
+    nfdpathsetsize_t index;
+    const char* host;  // host path of the document (not null-terminated), or nullptr if unknown
+    size_t host_len;
+};
+
+// If `path` is inside the document portal, sets `outDoc` (except its index) and returns true.
+bool GetDocumentPath(const char* path, DocumentPath& outDoc) {
+    if (strncmp(path, documents_mount_point, documents_mount_point_len) != 0) return false;
+    const char* const id = path + documents_mount_point_len;
+    const char* const id_end = strchr(id, '/');
+    if (!id_end || id_end == id) return false;
+    const char* const name_end = strchrnul(id_end + 1, '/');
+    if (name_end == id_end + 1) return false;
+    outDoc.id = id;
+    outDoc.id_len = static_cast<size_t>(id_end - id);
+    outDoc.rest = name_end;
+    outDoc.host = nullptr;
+    outDoc.host_len = 0;
+    return true;
+}
+
+int CompareDocumentIds(const void* a, const void* b) {
+    const DocumentPath* const x = static_cast<const DocumentPath*>(a);
+    const DocumentPath* const y = static_cast<const DocumentPath*>(b);
+    const int res = memcmp(x->id, y->id, x->id_len < y->id_len ? x->id_len : y->id_len);
+    if (res != 0) return res;
+    return (x->id_len > y->id_len) - (x->id_len < y->id_len);
+}
+
+int CompareDocumentIndices(const void* a, const void* b) {
+    const DocumentPath* const x = static_cast<const DocumentPath*>(a);
+    const DocumentPath* const y = static_cast<const DocumentPath*>(b);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// Looks up the host paths of the given documents, which must be sorted by id, with a single call
+// to the document portal.  Sets the `host` and `host_len` of every document that the portal knows,
+// which point into the returned reply.  Returns nullptr if the call failed.  Must be called with
+// nfd_mutex held.
+DBusMessage* NFD_DBus_GetHostPaths(DocumentPath* docs, size_t count, const timespec* deadline) {
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_DOCUMENTS_DESTINATION, DBUS_DOCUMENTS_PATH, DBUS_DOCUMENTS_IFACE, "GetHostPaths");
+    DBusMessage_Guard query_guard(query);
+    {
+        // Each distinct id is sent once.  They need to be null-terminated, so copy them first.
+        size_t ids_size = 0;
+        for (size_t i = 0; i != count; ++i) ids_size += docs[i].id_len + 1;
+        char* const ids = NFDi_Malloc<char>(ids_size);
+        Free_Guard<char> ids_guard(ids);
+        char* ids_end = ids;
+        DBusMessageIter iter;
+        DBusMessageIter array_iter;
+        dbus_message_iter_init_append(query, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &array_iter);
+        for (size_t i = 0; i != count; ++i) {
+            if (i != 0 && CompareDocumentIds(&docs[i - 1], &docs[i]) == 0) continue;
+            const char* id = ids_end;
+            ids_end = copy(docs[i].id, docs[i].id + docs[i].id_len, ids_end);
+            *ids_end++ = '\0';
+            dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING, &id);
+        }
+        dbus_message_iter_close_container(&iter, &array_iter);
+    }
+    DBusMessage* reply;
+    if (NFD_DBus_Call(query, reply, deadline) != NFD_OKAY) {
+        NFD_ClearError();
+        return nullptr;
+    }
+
+    // The reply is a{say}, mapping each id to its host path.
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(reply, &iter) ||
+        dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
+        return reply;
+    }
+    DBusMessageIter dict_iter;
+    dbus_message_iter_recurse(&iter, &dict_iter);
+    for (; dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY;
+         dbus_message_iter_next(&dict_iter)) {
+        DBusMessageIter entry_iter;
+        dbus_message_iter_recurse(&dict_iter, &entry_iter);
+        if (dbus_message_iter_get_arg_type(&entry_iter) != DBUS_TYPE_STRING) continue;
+        DocumentPath key;
+        dbus_message_iter_get_basic(&entry_iter, &key.id);
+        key.id_len = strlen(key.id);
+        if (!dbus_message_iter_next(&entry_iter) ||
+            dbus_message_iter_get_arg_type(&entry_iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&entry_iter) != DBUS_TYPE_BYTE) {
+            continue;
+        }
+        DBusMessageIter byte_iter;
+        dbus_message_iter_recurse(&entry_iter, &byte_iter);
+        const char* host;
+        int host_len;
+        dbus_message_iter_get_fixed_array(&byte_iter, &host, &host_len);
+        // the path might be null-terminated
+        if (host_len && host[host_len - 1] == '\0') --host_len;
+        if (!host_len) continue;
+
+        DocumentPath* doc = static_cast<DocumentPath*>(
+            bsearch(&key, docs, count, sizeof(DocumentPath), &CompareDocumentIds));
+        if (!doc) continue;
+        // several paths might be in the same document
+        while (doc != docs && CompareDocumentIds(doc - 1, &key) == 0) --doc;
+        for (; doc != docs + count && CompareDocumentIds(doc, &key) == 0; ++doc) {
+            doc->host = host;
+            doc->host_len = static_cast<size_t>(host_len);
+        }
+    }
+    return reply;
+}
+
+// Replaces `path` (allocated with NFDi_Malloc) by the corresponding path on the host, if it is
+// inside the document portal and the document portal tells us the host path.
+void ResolveHostPath(char*& path, const timespec* deadline) {
+    Mutex_Guard lock(&nfd_mutex);
+    if (!NFD_DBus_GetDocumentsMountPoint(deadline)) return;
+    DocumentPath doc;
+    if (!GetDocumentPath(path, doc)) return;
+    DBusMessage* reply = NFD_DBus_GetHostPaths(&doc, 1, deadline);
+    if (!reply) return;
+    DBusMessage_Guard reply_guard(reply);
+    if (!doc.host) return;
+    const size_t rest_size = strlen(doc.rest) + 1;
+    char* const host_path = NFDi_Malloc<char>(doc.host_len + rest_size);
+    char* const host_path_end = copy(doc.host, doc.host + doc.host_len, host_path);
+    copy(doc.rest, doc.rest + rest_size, host_path_end);
+    NFDi_Free(path);
+    path = host_path;
+}
+
+// Replaces the paths in `outPaths` that are inside the document portal by the corresponding paths
+// on the host, asking the document portal for all of them in a single call.  Paths that cannot be
+// resolved are kept as they are.
+void ResolveHostPaths(const nfdpathset_t*& outPaths, const timespec* deadline) {
+    const PathSet* const pathSet = static_cast<const PathSet*>(outPaths);
+    const nfdpathsetsize_t count = pathSet->count;
+    if (count == 0) return;
+    const size_t* const offsets = PathSetOffsets(pathSet);
+    const char* const data = PathSetData(pathSet);
+
+    Mutex_Guard lock(&nfd_mutex);
+    if (!NFD_DBus_GetDocumentsMountPoint(deadline)) return;
+    DocumentPath* const docs = NFDi_Malloc<DocumentPath>(sizeof(DocumentPath) * count);
+    Free_Guard<DocumentPath> docs_guard(docs);
+    size_t doc_count = 0;
+    for (nfdpathsetsize_t i = 0; i != count; ++i) {
+        if (offsets[i] == INVALID_PATH_OFFSET) continue;
+        if (GetDocumentPath(data + offsets[i], docs[doc_count])) {
+            docs[doc_count++].index = i;
+        }
+    }
+    if (doc_count == 0) return;
+    qsort(docs, doc_count, sizeof(DocumentPath), &CompareDocumentIds);
+    DBusMessage* reply = NFD_DBus_GetHostPaths(docs, doc_count, deadline);
+    if (!reply) return;
+    DBusMessage_Guard reply_guard(reply);
+    qsort(docs, doc_count, sizeof(DocumentPath), &CompareDocumentIndices);
+
+    // Build a new path set with the resolved paths, in the same layout as AllocPathSet().
+    size_t data_size = 0;
+    {
+        const DocumentPath* doc = docs;
+        for (nfdpathsetsize_t i = 0; i != count; ++i) {
+            if (offsets[i] == INVALID_PATH_OFFSET) continue;
+            const char* const path = data + offsets[i];
+            if (doc != docs + doc_count && doc->index == i) {
+                if (doc->host) {
+                    data_size += doc->host_len + strlen(doc->rest) + 1;
+                    ++doc;
+                    continue;
+                }
+                ++doc;
+            }
+            data_size += strlen(path) + 1;
+        }
+    }
+    const size_t header_size = sizeof(PathSet) + sizeof(size_t) * static_cast<size_t>(count);
+    PathSet* const newPathSet = NFDi_Malloc<PathSet>(header_size + data_size);
+    newPathSet->count = count;
+    newPathSet->uris = nullptr;
+    size_t* const new_offsets = reinterpret_cast<size_t*>(newPathSet + 1);
+    char* const new_data = reinterpret_cast<char*>(new_offsets + count);
+    char* data_end = new_data;
+    const DocumentPath* doc = docs;
+    for (nfdpathsetsize_t i = 0; i != count; ++i) {
+        if (offsets[i] == INVALID_PATH_OFFSET) {
+            new_offsets[i] = INVALID_PATH_OFFSET;
+            continue;
+        }
+        new_offsets[i] = static_cast<size_t>(data_end - new_data);
+        const char* path = data + offsets[i];
+        if (doc != docs + doc_count && doc->index == i) {
+            if (doc->host) {
+                data_end = copy(doc->host, doc->host + doc->host_len, data_end);
+                path = doc->rest;
+            }
+            ++doc;
+        }
+        const size_t path_size = strlen(path) + 1;
+        data_end = copy(path, path + path_size, data_end);
+    }
+    NFDi_Free(const_cast<PathSet*>(pathSet));
+    outPaths = newPathSet;
+}
+#endif
+
 }  // namespace
 
 /* public */
@@ -1455,36 +2399,143 @@ void NFD_ClearError(void) {
 }
 
 nfdresult_t NFD_Init(void) {
-    // Initialize dbus_err
+    // Initialize dbus_err of this thread
     dbus_error_init(&dbus_err);
+    if (!dbus_threads_init_default()) {
+        NFDi_SetError("Failed to initialize D-Bus threading support.");
+        return NFD_ERROR;
+    }
+
+    Mutex_Guard lock(&nfd_mutex);
+    if (init_count != 0) {
+        // another thread has already set everything up
+        ++init_count;
+        return NFD_OKAY;
+    }
     // Get DBus connection
+#ifdef NFD_PORTAL_PRIVATE_CONNECTION
+    dbus_conn = dbus_bus_get_private(DBUS_BUS_SESSION, &dbus_err);
+#else
     dbus_conn = dbus_bus_get(DBUS_BUS_SESSION, &dbus_err);
+#endif
     if (!dbus_conn) {
         NFDi_SetError(dbus_err.message);
         return NFD_ERROR;
     }
+#ifdef NFD_PORTAL_PRIVATE_CONNECTION
+    // unlike the shared connection, losing our own connection should not exit the application
+    dbus_connection_set_exit_on_disconnect(dbus_conn, false);
+#endif
     dbus_unique_name = dbus_bus_get_unique_name(dbus_conn);
     if (!dbus_unique_name) {
         NFDi_SetError("Unable to get the unique name of our D-Bus connection.");
-        dbus_connection_unref(dbus_conn);
+        NFD_DBus_CloseConnection();
+        return NFD_ERROR;
+    }
+    dispatch_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (dispatch_wake_fd == -1) {
+        NFDi_SetFormattedError("Failed to create an eventfd (errno %d).", errno);
+        NFD_DBus_CloseConnection();
+        return NFD_ERROR;
+    }
+    if (!dbus_connection_add_filter(dbus_conn, &DispatchFilter, nullptr, nullptr)) {
+        NFDi_SetError("Failed to add a D-Bus message filter.");
+        close(dispatch_wake_fd);
+        NFD_DBus_CloseConnection();
         return NFD_ERROR;
     }
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        const int err = pthread_cond_init(&dispatch_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        if (err != 0) {
+            NFDi_SetFormattedError("Failed to create a condition variable (errno %d).", err);
+            dbus_connection_remove_filter(dbus_conn, &DispatchFilter, nullptr);
+            close(dispatch_wake_fd);
+            NFD_DBus_CloseConnection();
+            return NFD_ERROR;
+        }
+    }
+    dispatch_active = false;
+    response_waiters = nullptr;
+    __atomic_store_n(&foreign_message_count, 0, __ATOMIC_RELAXED);
+    MakeRequestPathPrefix();
+    request_counter = 0;
+    response_subscription_rule =
+        MakeResponseSubscriptionPath(STR_RESPONSE_NAMESPACE_SUBSCRIPTION_PATH_1,
+                                     STR_RESPONSE_NAMESPACE_SUBSCRIPTION_PATH_1_LEN,
+                                     request_path_prefix,
+                                     request_namespace_len,
+                                     dbus_unique_name);
+    response_subscribed = false;
+    __atomic_store_n(&portal_caps_valid, false, __ATOMIC_RELAXED);
+    portal_owner_subscribed = false;
+    compiled_filters = nullptr;
+#ifdef NFD_PORTAL_HOST_PATHS
+    documents_mount_point = nullptr;
+    documents_mount_point_valid = false;
+#endif
+#ifdef NFD_PORTAL_WARM_UP
+    warm_up_version_call = nullptr;
+    warm_up_owner_match_call = nullptr;
+    NFD_DBus_WarmUp();
+#endif
 #ifdef NFD_WAYLAND
     NFD_Wayland_Init();
 #endif
+    init_count = 1;
     return NFD_OKAY;
 }
 
 void NFD_Quit(void) {
+    Mutex_Guard lock(&nfd_mutex);
+    if (--init_count != 0) return;
 #ifdef NFD_WAYLAND
     NFD_Wayland_Quit();
 #endif
-    dbus_connection_unref(dbus_conn);
+#ifdef NFD_PORTAL_WARM_UP
+    NFD_DBus_CancelWarmUp();
+#endif
+    if (portal_owner_subscribed) {
+        // the connection is shared, so don't leave our match rule behind on it
+        dbus_bus_remove_match(dbus_conn, STR_PORTAL_OWNER_SUBSCRIPTION_PATH, nullptr);
+        portal_owner_subscribed = false;
+    }
+    __atomic_store_n(&portal_caps_valid, false, __ATOMIC_RELAXED);
+    if (response_subscribed) {
+        dbus_bus_remove_match(dbus_conn, response_subscription_rule, nullptr);
+        response_subscribed = false;
+    }
+    // dbus_bus_remove_match() without an error only queues the call, so send it (and whatever else
+    // is still queued) before a private connection is closed
+    dbus_connection_flush(dbus_conn);
+    if (compiled_filters) {
+        NFDi_Free(compiled_filters);
+        compiled_filters = nullptr;
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    if (documents_mount_point) {
+        NFDi_Free(documents_mount_point);
+        documents_mount_point = nullptr;
+    }
+#endif
+    NFDi_Free(response_subscription_rule);
+    NFDi_Free(request_path_prefix);
+    pthread_cond_destroy(&dispatch_cond);
+    dbus_connection_remove_filter(dbus_conn, &DispatchFilter, nullptr);
+    close(dispatch_wake_fd);
+    NFD_DBus_CloseConnection();
     // Note: We do not free dbus_error since NFD_Init might set it.
     // To avoid leaking memory, the caller should explicitly call NFD_ClearError after reading the
     // error.
 }
 
+size_t NFD_Portal_GetForeignMessageCount(void) {
+    return __atomic_load_n(&foreign_message_count, __ATOMIC_RELAXED);
+}
+
 void NFD_FreePathN(nfdnchar_t* filePath) {
     assert(filePath);
     NFDi_Free(filePath);
@@ -1492,6 +2543,30 @@ void NFD_FreePathN(nfdnchar_t* filePath) {
 
 void NFD_FreePathU8(nfdu8char_t* filePath) __attribute__((alias("NFD_FreePathN")));
 
+void NFD_PumpEvents(void) {
+    // nothing is deferred here
+}
+
+nfdresult_t NFD_SetWaylandDisplay(struct wl_display* display) {
+#ifdef NFD_WAYLAND
+    Mutex_Guard lock(&nfd_mutex);
+    NFD_Wayland_SetDisplay(display);
+#else
+    (void)display;
+#endif
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_ReleaseWaylandSurface(struct wl_surface* surface) {
+#ifdef NFD_WAYLAND
+    Mutex_Guard lock(&nfd_mutex);
+    NFD_Wayland_ReleaseSurface(surface);
+#else
+    (void)surface;
+#endif
+    return NFD_OKAY;
+}
+
 nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
                             const nfdnfilteritem_t* filterList,
                             nfdfiltersize_t filterCount,
@@ -1506,13 +2581,17 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
 
     DBusMessage* msg;
     {
-        const nfdresult_t res = NFD_DBus_OpenFile<false, false>(
-            msg, args->filterList, args->filterCount, args->defaultPath, args->parentWindow);
+        const nfdresult_t res = NFD_DBus_OpenFile<false, false>(msg,
+                                                                args->filterList,
+                                                                args->filterCount,
+                                                                args->defaultPath,
+                                                                args->parentWindow,
+                                                                deadline);
         if (res != NFD_OKAY) {
             return res;
         }
@@ -1527,7 +2606,21 @@ nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    if (WantsUris(version, args)) {
+        AllocAndCopyUri(uri, *outPath);
+        return NFD_OKAY;
+    }
+
+    {
+        const nfdresult_t res = AllocAndCopyFilePath(uri, *outPath);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPath(*outPath, deadline);
+#endif
+    return NFD_OKAY;
 }
 
 nfdresult_t NFD_OpenDialogU8(nfdu8char_t** outPath,
@@ -1555,26 +2648,40 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
 nfdresult_t NFD_OpenDialogMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
 
     DBusMessage* msg;
     {
-        const nfdresult_t res = NFD_DBus_OpenFile<true, false>(
-            msg, args->filterList, args->filterCount, args->defaultPath, args->parentWindow);
+        const nfdresult_t res = NFD_DBus_OpenFile<true, false>(msg,
+                                                               args->filterList,
+                                                               args->filterCount,
+                                                               args->defaultPath,
+                                                               args->parentWindow,
+                                                               deadline);
         if (res != NFD_OKAY) {
             return res;
         }
     }
 
+    DBusMessage_Guard msg_guard(msg);
+
     DBusMessageIter uri_iter;
     const nfdresult_t res = ReadResponseUris(msg, uri_iter);
     if (res != NFD_OKAY) {
-        dbus_message_unref(msg);
         return res;
     }
 
-    *outPaths = msg;
+    if (WantsUris(version, args)) {
+        return AllocUriPathSet(msg, uri_iter, *outPaths);
+    }
+
+    if (AllocPathSet(uri_iter, *outPaths) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPaths(*outPaths, deadline);
+#endif
     return NFD_OKAY;
 }
 
@@ -1605,8 +2712,8 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdsavedialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
 
     DBusMessage* msg;
     {
@@ -1615,7 +2722,8 @@ nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
                                                   args->filterCount,
                                                   args->defaultPath,
                                                   args->defaultName,
-                                                  args->parentWindow);
+                                                  args->parentWindow,
+                                                  deadline);
         if (res != NFD_OKAY) {
             return res;
         }
@@ -1632,7 +2740,21 @@ nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
         }
     }
 
-    return AllocAndCopyFilePathWithExtn(uri, extn, *outPath);
+    if (WantsUris(version, args)) {
+        AllocAndCopyUriWithExtn(uri, extn, *outPath);
+        return NFD_OKAY;
+    }
+
+    {
+        const nfdresult_t res = AllocAndCopyFilePathWithExtn(uri, extn, *outPath);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPath(*outPath, deadline);
+#endif
+    return NFD_OKAY;
 #else
     const char* uri;
     {
@@ -1642,7 +2764,21 @@ nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    if (WantsUris(version, args)) {
+        AllocAndCopyUri(uri, *outPath);
+        return NFD_OKAY;
+    }
+
+    {
+        const nfdresult_t res = AllocAndCopyFilePath(uri, *outPath);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPath(*outPath, deadline);
+#endif
+    return NFD_OKAY;
 #endif
 }
 
@@ -1658,6 +2794,85 @@ nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
                                        const nfdsavedialogu8args_t* args)
     __attribute__((alias("NFD_SaveDialogN_With_Impl")));
 
+nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnchar_t* const* fileNames,
+                                    nfdpathsetsize_t fileCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdsavedialogmultiplenargs_t args{};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdsavedialogmultiplenargs_t* args) {
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
+
+    const char* fileNamesError = CheckSaveFileNames(args->fileNames, args->fileCount);
+    if (fileNamesError) {
+        NFDi_SetError(fileNamesError);
+        return NFD_ERROR;
+    }
+
+    {
+        PortalCapabilities caps;
+        const nfdresult_t res = NFD_DBus_GetCapabilities(caps, deadline);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+        if (caps.fileChooserVersion < 3) {
+            NFDi_SetFormattedError(
+                "The xdg-desktop-portal installed on this system does not support saving multiple "
+                "files; at least version 3 of the org.freedesktop.portal.FileChooser interface is "
+                "required but the installed interface version is %u.",
+                caps.fileChooserVersion);
+            return NFD_ERROR;
+        }
+    }
+
+    DBusMessage* msg;
+    {
+        const nfdresult_t res = NFD_DBus_SaveFiles(
+            msg, args->fileNames, args->fileCount, args->defaultPath, args->parentWindow, deadline);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+    }
+    DBusMessage_Guard msg_guard(msg);
+
+    DBusMessageIter uri_iter;
+    const nfdresult_t res = ReadResponseUris(msg, uri_iter);
+    if (res != NFD_OKAY) {
+        return res;
+    }
+
+    if (WantsUris(version, args)) {
+        return AllocUriPathSet(msg, uri_iter, *outPaths);
+    }
+
+    if (AllocPathSet(uri_iter, *outPaths) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPaths(*outPaths, deadline);
+#endif
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8char_t* const* fileNames,
+                                     nfdpathsetsize_t fileCount,
+                                     const nfdu8char_t* defaultPath)
+    __attribute__((alias("NFD_SaveDialogMultipleN")));
+
+nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdsavedialogmultipleu8args_t* args)
+    __attribute__((alias("NFD_SaveDialogMultipleN_With_Impl")));
+
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
     nfdpickfoldernargs_t args{};
     args.defaultPath = defaultPath;
@@ -1667,29 +2882,29 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
 nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
 
     {
-        dbus_uint32_t portal_version;
-        const nfdresult_t res = NFD_DBus_GetVersion(portal_version);
+        PortalCapabilities caps;
+        const nfdresult_t res = NFD_DBus_GetCapabilities(caps, deadline);
         if (res != NFD_OKAY) {
             return res;
         }
-        if (portal_version < 3) {
+        if (caps.fileChooserVersion < 3) {
             NFDi_SetFormattedError(
                 "The xdg-desktop-portal installed on this system does not support a folder picker; "
                 "at least version 3 of the org.freedesktop.portal.FileChooser interface is "
                 "required but the installed interface version is %u.",
-                portal_version);
+                caps.fileChooserVersion);
             return NFD_ERROR;
         }
     }
 
     DBusMessage* msg;
     {
-        const nfdresult_t res =
-            NFD_DBus_OpenFile<false, true>(msg, nullptr, 0, args->defaultPath, args->parentWindow);
+        const nfdresult_t res = NFD_DBus_OpenFile<false, true>(
+            msg, nullptr, 0, args->defaultPath, args->parentWindow, deadline);
         if (res != NFD_OKAY) {
             return res;
         }
@@ -1704,7 +2919,21 @@ nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    if (WantsUris(version, args)) {
+        AllocAndCopyUri(uri, *outPath);
+        return NFD_OKAY;
+    }
+
+    {
+        const nfdresult_t res = AllocAndCopyFilePath(uri, *outPath);
+        if (res != NFD_OKAY) {
+            return res;
+        }
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPath(*outPath, deadline);
+#endif
+    return NFD_OKAY;
 }
 
 nfdresult_t NFD_PickFolderU8(nfdu8char_t** outPath, const nfdu8char_t* defaultPath)
@@ -1724,42 +2953,52 @@ nfdresult_t NFD_PickFolderMultipleN(const nfdpathset_t** outPaths, const nfdncha
 nfdresult_t NFD_PickFolderMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    timespec deadline_storage;
+    const timespec* deadline = GetDeadline(version, args, deadline_storage);
 
     {
-        dbus_uint32_t portal_version;
-        const nfdresult_t res = NFD_DBus_GetVersion(portal_version);
+        PortalCapabilities caps;
+        const nfdresult_t res = NFD_DBus_GetCapabilities(caps, deadline);
         if (res != NFD_OKAY) {
             return res;
         }
-        if (portal_version < 3) {
+        if (caps.fileChooserVersion < 3) {
             NFDi_SetFormattedError(
                 "The xdg-desktop-portal installed on this system does not support a folder picker; "
                 "at least version 3 of the org.freedesktop.portal.FileChooser interface is "
                 "required but the installed interface version is %u.",
-                portal_version);
+                caps.fileChooserVersion);
             return NFD_ERROR;
         }
     }
 
     DBusMessage* msg;
     {
-        const nfdresult_t res =
-            NFD_DBus_OpenFile<true, true>(msg, nullptr, 0, args->defaultPath, args->parentWindow);
+        const nfdresult_t res = NFD_DBus_OpenFile<true, true>(
+            msg, nullptr, 0, args->defaultPath, args->parentWindow, deadline);
         if (res != NFD_OKAY) {
             return res;
         }
     }
 
+    DBusMessage_Guard msg_guard(msg);
+
     DBusMessageIter uri_iter;
     const nfdresult_t res = ReadResponseUris(msg, uri_iter);
     if (res != NFD_OKAY) {
-        dbus_message_unref(msg);
         return res;
     }
 
-    *outPaths = msg;
+    if (WantsUris(version, args)) {
+        return AllocUriPathSet(msg, uri_iter, *outPaths);
+    }
+
+    if (AllocPathSet(uri_iter, *outPaths) != NFD_OKAY) {
+        return NFD_ERROR;
+    }
+#ifdef NFD_PORTAL_HOST_PATHS
+    ResolveHostPaths(*outPaths, deadline);
+#endif
     return NFD_OKAY;
 }
 
@@ -1773,8 +3012,7 @@ nfdresult_t NFD_PickFolderMultipleU8_With_Impl(nfdversion_t version,
 
 nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
     assert(pathSet);
-    DBusMessage* msg = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(pathSet));
-    *count = ReadResponseUrisUncheckedGetArraySize(msg);
+    *count = static_cast<const PathSet*>(pathSet)->count;
     return NFD_OKAY;
 }
 
@@ -1782,28 +3020,16 @@ nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
                                  nfdpathsetsize_t index,
                                  nfdnchar_t** outPath) {
     assert(pathSet);
-    DBusMessage* msg = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(pathSet));
-    DBusMessageIter uri_iter;
-    ReadResponseUrisUnchecked(msg, uri_iter);
-    nfdpathsetsize_t rem_index = index;
-    while (rem_index > 0) {
-        --rem_index;
-        if (!dbus_message_iter_next(&uri_iter)) {
-            NFDi_SetFormattedError(
-                "Index out of bounds; you asked for index %u but there are only %u file paths "
-                "available.",
-                index,
-                index - rem_index);
-            return NFD_ERROR;
-        }
-    }
-    if (dbus_message_iter_get_arg_type(&uri_iter) != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+    const PathSet* paths = static_cast<const PathSet*>(pathSet);
+    if (index >= paths->count) {
+        NFDi_SetFormattedError(
+            "Index out of bounds; you asked for index %u but there are only %u file paths "
+            "available.",
+            index,
+            paths->count);
         return NFD_ERROR;
     }
-    const char* uri;
-    dbus_message_iter_get_basic(&uri_iter, &uri);
-    return AllocAndCopyFilePath(uri, *outPath);
+    return GetPathSetPath(paths, index, *outPath);
 }
 
 nfdresult_t NFD_PathSet_GetPathU8(const nfdpathset_t* pathSet,
@@ -1813,7 +3039,8 @@ nfdresult_t NFD_PathSet_GetPathU8(const nfdpathset_t* pathSet,
 
 void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
     assert(filePath);
-    NFD_FreePathN(const_cast<nfdnchar_t*>(filePath));
+    (void)filePath;  // prevent warning in release build
+    // no-op, because the path points into the path set, which NFD_PathSet_Free frees
 }
 
 void NFD_PathSet_FreePathU8(const nfdu8char_t* filePath)
@@ -1821,38 +3048,31 @@ void NFD_PathSet_FreePathU8(const nfdu8char_t* filePath)
 
 void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
     assert(pathSet);
-    DBusMessage* msg = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(pathSet));
-    dbus_message_unref(msg);
+    PathSet* const paths = const_cast<PathSet*>(static_cast<const PathSet*>(pathSet));
+    if (paths->uris) dbus_message_unref(paths->uris);
+    NFDi_Free(paths);
 }
 
 nfdresult_t NFD_PathSet_GetEnum(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator) {
     assert(pathSet);
-    DBusMessage* msg = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(pathSet));
-    ReadResponseUrisUnchecked(msg, *reinterpret_cast<DBusMessageIter*>(outEnumerator));
+    PathSetEnum& pathSetEnum = *reinterpret_cast<PathSetEnum*>(outEnumerator);
+    pathSetEnum.pathSet = static_cast<const PathSet*>(pathSet);
+    pathSetEnum.index = 0;
     return NFD_OKAY;
 }
 
 void NFD_PathSet_FreeEnum(nfdpathsetenum_t*) {
-    // Do nothing, because the enumeration is just a message iterator
+    // Do nothing, because the enumeration is just an index into the path set
 }
 
 nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath) {
-    DBusMessageIter& uri_iter = *reinterpret_cast<DBusMessageIter*>(enumerator);
-    const int arg_type = dbus_message_iter_get_arg_type(&uri_iter);
-    if (arg_type == DBUS_TYPE_INVALID) {
+    PathSetEnum& pathSetEnum = *reinterpret_cast<PathSetEnum*>(enumerator);
+    if (pathSetEnum.index == pathSetEnum.pathSet->count) {
         *outPath = nullptr;
         return NFD_OKAY;
     }
-    if (arg_type != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
-        return NFD_ERROR;
-    }
-    const char* uri;
-    dbus_message_iter_get_basic(&uri_iter, &uri);
-    const nfdresult_t res = AllocAndCopyFilePath(uri, *outPath);
-    if (res != NFD_OKAY) return res;
-    dbus_message_iter_next(&uri_iter);
-    return NFD_OKAY;
+    // advance even if this entry is malformed, so that the caller can skip it and continue
+    return GetPathSetPath(pathSetEnum.pathSet, pathSetEnum.index++, *outPath);
 }
 
 nfdresult_t NFD_PathSet_EnumNextU8(nfdpathsetenum_t* enumerator, nfdu8char_t** outPath)
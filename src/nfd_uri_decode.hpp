@@ -0,0 +1,120 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+  Authors: Bernard Teo
+
+  This is the URI decoder of the portal implementation, in its own header so that it can be tested
+  without D-Bus.
+*/
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // for decoding URI escapes in vector lanes
+#endif
+
+namespace {
+
+// Lookup table from a char to its hexadecimal value, or to 0xFF if the char is not in
+// [0-9A-Fa-f].  Since the value of a hex digit is at most 15, two lookups can be validated at once
+// by checking the high bits of their bitwise OR.
+constexpr unsigned char HEX_TABLE[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#if defined(__SSE2__)
+// Decodes the five consecutive escapes "%XX%XX%XX%XX%XX" at the start of `fileUri`, where at least
+// 16 chars starting from `fileUri` must be readable.  Multibyte UTF-8 characters (e.g. CJK) are
+// encoded as runs of escapes, so this handles most of the work for paths in such languages.
+// Returns true and writes the five decoded chars to `outPath` if the first 15 chars are five
+// well-formed escapes.  Otherwise, returns false and writes nothing.
+bool TryUriDecodeFiveEscapes(const char* fileUri, char* outPath) {
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fileUri));
+    // Lanes 0, 3, 6, 9, and 12 must be '%'.
+    const int percent_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('%')));
+    // A lane is a digit iff (ch - '0') <= 9 as an unsigned byte.
+    const __m128i digit_value = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    const __m128i is_digit =
+        _mm_cmpeq_epi8(_mm_min_epu8(digit_value, _mm_set1_epi8(9)), digit_value);
+    // A lane is a hex letter iff ((ch | 0x20) - 'a') <= 5 as an unsigned byte.
+    const __m128i letter_value =
+        _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_letter =
+        _mm_cmpeq_epi8(_mm_min_epu8(letter_value, _mm_set1_epi8(5)), letter_value);
+    // All the other lanes (except lane 15, which belongs to the next escape) must be hex digits.
+    const int hex_mask = _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+    if ((percent_mask & 0x1249) != 0x1249 || (hex_mask & 0x6DB6) != 0x6DB6) return false;
+    // Every lane of `nibbles` is at most 15 (lanes that are not hex digits are zero), so the 16-bit
+    // shift does not carry bits across lanes, and lane i of `decoded` becomes
+    // (nibbles[i] << 4) | nibbles[i + 1].  The decoded chars are in lanes 1, 4, 7, 10, and 13.
+    const __m128i nibbles = _mm_or_si128(
+        _mm_and_si128(digit_value, is_digit),
+        _mm_and_si128(_mm_add_epi8(letter_value, _mm_set1_epi8(10)), is_letter));
+    const __m128i decoded = _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_si128(nibbles, 1));
+    alignas(16) char buf[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(buf), decoded);
+    outPath[0] = buf[1];
+    outPath[1] = buf[4];
+    outPath[2] = buf[7];
+    outPath[3] = buf[10];
+    outPath[4] = buf[13];
+    return true;
+}
+#endif
+
+// URI-decodes [fileUri, fileUriEnd) and writes it to `outPath`, validating the escapes as it goes.
+// `outPath` must have space for at least (fileUriEnd - fileUri) chars, which is always enough since
+// decoding never makes the string longer.  Returns the end of the decoded chars if the URI is
+// well-formed, or null otherwise (in which case some garbage may have been written to `outPath`).
+// This function does not write any trailing null character.  `Vectorized` is only false in tests
+// and benchmarks, to compare against the scalar loop.
+template <bool Vectorized = true>
+char* TryUriDecode(const char* fileUri, const char* fileUriEnd, char* outPath) {
+    while (true) {
+        // Copy the run of chars before the next escape in bulk.
+        const char* escape = static_cast<const char*>(
+            memchr(fileUri, '%', static_cast<size_t>(fileUriEnd - fileUri)));
+        if (!escape) escape = fileUriEnd;
+        memcpy(outPath, fileUri, static_cast<size_t>(escape - fileUri));
+        outPath += escape - fileUri;
+        fileUri = escape;
+        if (fileUri == fileUriEnd) return outPath;
+        // Decode the run of escapes.
+        do {
+#if defined(__SSE2__)
+            if (Vectorized && fileUriEnd - fileUri >= 16 &&
+                TryUriDecodeFiveEscapes(fileUri, outPath)) {
+                fileUri += 15;
+                outPath += 5;
+                continue;
+            }
+#endif
+            if (fileUriEnd - fileUri < 3) return nullptr;
+            const unsigned char high_nibble =
+                HEX_TABLE[static_cast<unsigned char>(fileUri[1])];
+            const unsigned char low_nibble =
+                HEX_TABLE[static_cast<unsigned char>(fileUri[2])];
+            if ((high_nibble | low_nibble) & 0xF0) return nullptr;
+            *outPath++ = static_cast<char>((high_nibble << 4) | low_nibble);
+            fileUri += 3;
+        } while (fileUri != fileUriEnd && *fileUri == '%');
+    }
+}
+
+}  // namespace
@@ -298,6 +298,18 @@ HWND GetNativeWindowHandle(const nfdwindowhandle_t& parentWindow) {
     }
     return static_cast<HWND>(parentWindow.handle);
 }
+
+// Only NFD_PATH_FORMAT_PATH is supported here, so this returns false (and sets the error) if the
+// caller of a *_With() function asked for anything else.  pathFormat was added in version 3 of the
+// interface.
+template <typename Args>
+bool CheckPathFormat(nfdversion_t version, const Args* args) {
+    if (version >= 3 && args->pathFormat != NFD_PATH_FORMAT_PATH) {
+        NFDi_SetError("Returning URIs is not supported on Windows.");
+        return false;
+    }
+    return true;
+}
 }  // namespace
 
 const char* NFD_GetError(void) {
@@ -339,6 +351,10 @@ void NFD_Quit(void) {
     if (needs_uninitialize) ::CoUninitialize();
 }
 
+void NFD_PumpEvents(void) {
+    // nothing is deferred here
+}
+
 void NFD_FreePathN(nfdnchar_t* filePath) {
     assert(filePath);
     ::CoTaskMemFree(filePath);
@@ -358,8 +374,9 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_OpenDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     ::IFileOpenDialog* fileOpenDialog;
 
@@ -442,8 +459,9 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
 nfdresult_t NFD_OpenDialogMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdopendialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     ::IFileOpenDialog* fileOpenDialog;
 
@@ -520,8 +538,9 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdsavedialognargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     ::IFileSaveDialog* fileSaveDialog;
 
@@ -595,6 +614,27 @@ nfdresult_t NFD_SaveDialogN_With_Impl(nfdversion_t version,
     }
 }
 
+nfdresult_t NFD_SaveDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnchar_t* const* fileNames,
+                                    nfdpathsetsize_t fileCount,
+                                    const nfdnchar_t* defaultPath) {
+    nfdsavedialogmultiplenargs_t args{};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleN_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleN_With_Impl(nfdversion_t version,
+                                              const nfdpathset_t** outPaths,
+                                              const nfdsavedialogmultiplenargs_t* args) {
+    (void)version;
+    (void)outPaths;
+    (void)args;
+    NFDi_SetError("Saving multiple files is not supported on Windows.");
+    return NFD_ERROR;
+}
+
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
     nfdpickfoldernargs_t args{};
     args.defaultPath = defaultPath;
@@ -604,8 +644,9 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
 nfdresult_t NFD_PickFolderN_With_Impl(nfdversion_t version,
                                       nfdnchar_t** outPath,
                                       const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     ::IFileOpenDialog* fileOpenDialog;
 
@@ -670,8 +711,9 @@ nfdresult_t NFD_PickFolderMultipleN(const nfdpathset_t** outPaths, const nfdncha
 nfdresult_t NFD_PickFolderMultipleN_With_Impl(nfdversion_t version,
                                               const nfdpathset_t** outPaths,
                                               const nfdpickfoldernargs_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     ::IFileOpenDialog* fileOpenDialog;
 
@@ -945,8 +987,9 @@ nfdresult_t NFD_OpenDialogU8(nfdu8char_t** outPath,
 nfdresult_t NFD_OpenDialogU8_With_Impl(nfdversion_t version,
                                        nfdu8char_t** outPath,
                                        const nfdopendialogu8args_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     // populate the real nfdnfilteritem_t
     FilterItem_Guard filterItemsNGuard;
@@ -994,8 +1037,9 @@ nfdresult_t NFD_OpenDialogMultipleU8(const nfdpathset_t** outPaths,
 nfdresult_t NFD_OpenDialogMultipleU8_With_Impl(nfdversion_t version,
                                                const nfdpathset_t** outPaths,
                                                const nfdopendialogu8args_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     // populate the real nfdnfilteritem_t
     FilterItem_Guard filterItemsNGuard;
@@ -1033,8 +1077,9 @@ nfdresult_t NFD_SaveDialogU8(nfdu8char_t** outPath,
 nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
                                        nfdu8char_t** outPath,
                                        const nfdsavedialogu8args_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     // populate the real nfdnfilteritem_t
     FilterItem_Guard filterItemsNGuard;
@@ -1072,6 +1117,28 @@ nfdresult_t NFD_SaveDialogU8_With_Impl(nfdversion_t version,
     return res;
 }
 
+/* multiple file save dialog */
+nfdresult_t NFD_SaveDialogMultipleU8(const nfdpathset_t** outPaths,
+                                     const nfdu8char_t* const* fileNames,
+                                     nfdpathsetsize_t fileCount,
+                                     const nfdu8char_t* defaultPath) {
+    nfdsavedialogmultipleu8args_t args{};
+    args.fileNames = fileNames;
+    args.fileCount = fileCount;
+    args.defaultPath = defaultPath;
+    return NFD_SaveDialogMultipleU8_With_Impl(NFD_INTERFACE_VERSION, outPaths, &args);
+}
+
+nfdresult_t NFD_SaveDialogMultipleU8_With_Impl(nfdversion_t version,
+                                               const nfdpathset_t** outPaths,
+                                               const nfdsavedialogmultipleu8args_t* args) {
+    (void)version;
+    (void)outPaths;
+    (void)args;
+    NFDi_SetError("Saving multiple files is not supported on Windows.");
+    return NFD_ERROR;
+}
+
 /* select folder dialog */
 /* It is the caller's responsibility to free `outPath` via NFD_FreePathU8() if this function returns
  * NFD_OKAY */
@@ -1084,8 +1151,9 @@ nfdresult_t NFD_PickFolderU8(nfdu8char_t** outPath, const nfdu8char_t* defaultPa
 nfdresult_t NFD_PickFolderU8_With_Impl(nfdversion_t version,
                                        nfdu8char_t** outPath,
                                        const nfdpickfolderu8args_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     // convert and normalize the default path, but only if it is not nullptr
     FreeCheck_Guard<nfdnchar_t> defaultPathNGuard;
@@ -1122,8 +1190,9 @@ nfdresult_t NFD_PickFolderMultipleU8(const nfdpathset_t** outPaths,
 nfdresult_t NFD_PickFolderMultipleU8_With_Impl(nfdversion_t version,
                                                const nfdpathset_t** outPaths,
                                                const nfdpickfolderu8args_t* args) {
-    // We haven't needed to bump the interface version yet.
-    (void)version;
+    if (!CheckPathFormat(version, args)) {
+        return NFD_ERROR;
+    }
 
     // convert and normalize the default path, but only if it is not nullptr
     FreeCheck_Guard<nfdnchar_t> defaultPathNGuard;
@@ -0,0 +1,125 @@
+/*
+  Times the GTK implementation's filter callback (the extension table) on a large synthetic folder
+  listing, against one "*.ext" glob per extension as the filter used before.  The globs are matched
+  with fnmatch, standing in for GTK's own glob matcher (which works the same way, one pattern at a
+  time).
+
+  Usage:
+    bench_extension_table [names] [rounds]
+*/
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nfd_linux_shared.hpp"
+#include "nfd_extension_table.hpp"
+
+namespace {
+
+double NowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<double>(now.tv_sec) * 1000.0 + static_cast<double>(now.tv_nsec) / 1000000.0;
+}
+
+const char SPEC[] = "c,cpp,cc,cxx,h,hpp,hh,hxx,inl,ipp,m,mm,txt,md,cmake,json";
+
+// The globs that the filter used before, as AddFilterSpecItem built them.
+char** MakeGlobs(size_t& count) {
+    char** globs = static_cast<char**>(malloc(sizeof(SPEC) * sizeof(char*)));
+    count = 0;
+    for (const char *p_extensionStart = SPEC, *p_spec = SPEC; true; ++p_spec) {
+        if (*p_spec == ',' || !*p_spec) {
+            char* glob = static_cast<char*>(malloc((p_spec - p_extensionStart) * 4 + 3));
+            char* p_glob = glob;
+            *p_glob++ = '*';
+            *p_glob++ = '.';
+#ifdef NFD_CASE_SENSITIVE_FILTER
+            memcpy(p_glob, p_extensionStart, p_spec - p_extensionStart);
+            p_glob += p_spec - p_extensionStart;
+#else
+            p_glob = emit_case_insensitive_glob(p_extensionStart, p_spec, p_glob);
+#endif
+            *p_glob = '\0';
+            globs[count++] = glob;
+            if (!*p_spec) break;
+            p_extensionStart = p_spec + 1;
+        }
+    }
+    return globs;
+}
+
+// File names as in a large source tree, about a third of which match SPEC.
+char** MakeNames(size_t count) {
+    static const char* const EXTENSIONS[] = {
+        "c", "cpp", "H", "o", "d", "png", "txt", "tar.gz", "", "jpg", "so", "json", "obj",
+        "Makefile", "hpp", "py", "rs", "html"};
+    char** names = static_cast<char**>(malloc(count * sizeof(char*)));
+    for (size_t i = 0; i != count; ++i) {
+        char name[64];
+        const char* extension = EXTENSIONS[(i * 7) % (sizeof(EXTENSIONS) / sizeof(EXTENSIONS[0]))];
+        snprintf(name, sizeof(name), "source_file_%u.%s", static_cast<unsigned>(i), extension);
+        names[i] = strdup(name);
+    }
+    return names;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const size_t count = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 100000;
+    const unsigned rounds = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 10;
+
+    char** names = MakeNames(count);
+    size_t globCount;
+    char** globs = MakeGlobs(globCount);
+    ExtensionTable* table = BuildExtensionTable(SPEC);
+
+    double bestGlobs = 0;
+    double bestTable = 0;
+    size_t globMatches = 0;
+    size_t tableMatches = 0;
+    for (unsigned round = 0; round != rounds; ++round) {
+        double begin = NowMs();
+        globMatches = 0;
+        for (size_t i = 0; i != count; ++i) {
+            for (size_t k = 0; k != globCount; ++k) {
+                if (fnmatch(globs[k], names[i], 0) == 0) {
+                    ++globMatches;
+                    break;
+                }
+            }
+        }
+        const double globsMs = NowMs() - begin;
+
+        begin = NowMs();
+        tableMatches = 0;
+        for (size_t i = 0; i != count; ++i) tableMatches += ExtensionTableMatches(table, names[i]);
+        const double tableMs = NowMs() - begin;
+
+        if (round == 0 || globsMs < bestGlobs) bestGlobs = globsMs;
+        if (round == 0 || tableMs < bestTable) bestTable = tableMs;
+    }
+
+    printf("%u names, %u extensions:\n",
+           static_cast<unsigned>(count),
+           static_cast<unsigned>(globCount));
+    printf("  globs  %9.3f ms, %7.1f ns per name (%u matches)\n",
+           bestGlobs,
+           bestGlobs * 1000000.0 / static_cast<double>(count),
+           static_cast<unsigned>(globMatches));
+    printf("  table  %9.3f ms, %7.1f ns per name (%u matches)\n",
+           bestTable,
+           bestTable * 1000000.0 / static_cast<double>(count),
+           static_cast<unsigned>(tableMatches));
+
+    NFDi_Free(table);
+    for (size_t k = 0; k != globCount; ++k) free(globs[k]);
+    free(globs);
+    for (size_t i = 0; i != count; ++i) free(names[i]);
+    free(names);
+    return globMatches == tableMatches ? 0 : 1;
+}
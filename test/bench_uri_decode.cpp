@@ -0,0 +1,165 @@
+/*
+  Times the portal's URI decoder on mostly-ASCII paths and on paths that are mostly escapes (as
+  CJK paths are), with and without its SSE2 fast path, against the two-pass decoder that the portal
+  implementation used before (which measured the decoded length and then decoded).
+
+  Usage:
+    bench_uri_decode [uris] [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nfd_uri_decode.hpp"
+
+namespace {
+
+double NowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<double>(now.tv_sec) * 1000.0 + static_cast<double>(now.tv_nsec) / 1000000.0;
+}
+
+// The previous decoder.
+
+bool IsHex(char ch) {
+    return ('0' <= ch && ch <= '9') || ('A' <= ch && ch <= 'F') || ('a' <= ch && ch <= 'f');
+}
+
+char ParseHexUnchecked(char ch) {
+    if ('0' <= ch && ch <= '9') return ch - '0';
+    if ('A' <= ch && ch <= 'F') return ch - ('A' - 10);
+    return ch - ('a' - 10);
+}
+
+bool TryUriDecodeLen(const char* fileUri, size_t& out, const char*& fileUriEnd) {
+    size_t len = 0;
+    while (*fileUri) {
+        if (*fileUri != '%') {
+            ++fileUri;
+        } else {
+            if (*(fileUri + 1) == '\0' || *(fileUri + 2) == '\0') {
+                return false;
+            }
+            if (!IsHex(*(fileUri + 1)) || !IsHex(*(fileUri + 2))) {
+                return false;
+            }
+            fileUri += 3;
+        }
+        ++len;
+    }
+    out = len;
+    fileUriEnd = fileUri;
+    return true;
+}
+
+char* UriDecodeUnchecked(const char* fileUri, const char* fileUriEnd, char* outPath) {
+    while (fileUri != fileUriEnd) {
+        if (*fileUri != '%') {
+            *outPath++ = *fileUri++;
+        } else {
+            ++fileUri;
+            const char high_nibble = ParseHexUnchecked(*fileUri++);
+            const char low_nibble = ParseHexUnchecked(*fileUri++);
+            *outPath++ = static_cast<char>((high_nibble << 4) | low_nibble);
+        }
+    }
+    return outPath;
+}
+
+// `count` null-terminated URIs, one after another.
+struct Corpus {
+    char* data;
+    size_t size;
+    size_t count;
+};
+
+Corpus MakeCorpus(const char* format, size_t count) {
+    Corpus corpus;
+    corpus.data = static_cast<char*>(malloc(count * 256));
+    corpus.size = 0;
+    corpus.count = count;
+    for (size_t i = 0; i != count; ++i) {
+        corpus.size += static_cast<size_t>(
+                           snprintf(corpus.data + corpus.size, 256, format, static_cast<int>(i))) +
+                       1;
+    }
+    return corpus;
+}
+
+enum Decoder { TWO_PASS, SCALAR, VECTORIZED };
+
+// Decodes every URI of the corpus into `out`, and returns the total length of the decoded URIs.
+size_t DecodeAll(const Corpus& corpus, Decoder decoder, char* out) {
+    size_t total = 0;
+    const char* uri = corpus.data;
+    for (size_t i = 0; i != corpus.count; ++i) {
+        const char* end;
+        char* outEnd = nullptr;
+        if (decoder == TWO_PASS) {
+            size_t len;
+            if (TryUriDecodeLen(uri, len, end)) {
+                outEnd = UriDecodeUnchecked(uri, end, out);
+            } else {
+                end = uri + strlen(uri);
+            }
+        } else {
+            end = uri + strlen(uri);
+            outEnd = decoder == SCALAR ? TryUriDecode<false>(uri, end, out)
+                                       : TryUriDecode<true>(uri, end, out);
+        }
+        if (outEnd) total += static_cast<size_t>(outEnd - out);
+        uri = end + 1;
+    }
+    return total;
+}
+
+void Run(const char* name, const Corpus& corpus, unsigned rounds) {
+    static const char* const DECODER_NAMES[] = {"two-pass", "scalar", "SSE2"};
+    char* const out = static_cast<char*>(malloc(256));
+    printf("%s (%u URIs, %u bytes):\n",
+           name,
+           static_cast<unsigned>(corpus.count),
+           static_cast<unsigned>(corpus.size));
+    for (int decoder = TWO_PASS; decoder <= VECTORIZED; ++decoder) {
+#if !defined(__SSE2__)
+        if (decoder == VECTORIZED) continue;
+#endif
+        double best = 0;
+        size_t total = 0;
+        for (unsigned round = 0; round != rounds; ++round) {
+            const double begin = NowMs();
+            total = DecodeAll(corpus, static_cast<Decoder>(decoder), out);
+            const double elapsed = NowMs() - begin;
+            if (round == 0 || elapsed < best) best = elapsed;
+        }
+        printf("  %-8s %8.3f ms, %6.1f ns per URI, %7.1f MB/s (%u bytes decoded)\n",
+               DECODER_NAMES[decoder],
+               best,
+               best * 1000000.0 / static_cast<double>(corpus.count),
+               static_cast<double>(corpus.size) / best / 1000.0,
+               static_cast<unsigned>(total));
+    }
+    free(out);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const size_t count = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 100000;
+    const unsigned rounds = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 10;
+
+    Corpus ascii =
+        MakeCorpus("/home/user/Documents/Project%%20Files/reports/quarterly-report-%06d.pdf", count);
+    Corpus escapes = MakeCorpus(
+        "/home/user/%%E6%%96%%87%%E6%%A1%%A3/%%E9%%A1%%B9%%E7%%9B%%AE%%E8%%B5%%84%%E6%%96%%99/"
+        "%%E5%%AD%%A3%%E5%%BA%%A6%%E6%%8A%%A5%%E5%%91%%8A-%06d.pdf",
+        count);
+    Run("ASCII-heavy", ascii, rounds);
+    Run("escape-heavy", escapes, rounds);
+    free(escapes.data);
+    free(ascii.data);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+  Times the first portal dialog after NFD_Init and the dialogs after it, against mock_portal, to
+  compare builds with and without NFD_PORTAL_WARM_UP.  The dialogs are folder pickers, which need
+  the version of the portal, so the later ones show the cost of a cached version.  Start the mock
+  with --startup to make it slow to handle its first call, like a portal that is D-Bus activated.
+
+  Usage (see run_with_mock_portal.sh):
+    bench_portal_first_dialog [dialogs] [--idle MS]
+
+  --idle waits MS milliseconds between NFD_Init and the first dialog, like an application that
+  does other work before showing a dialog.
+*/
+
+#define _POSIX_C_SOURCE 199309L  // for clock_gettime and nanosleep
+
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double NowMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+static int CompareDoubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    int dialogs = 20;
+    unsigned idleMs = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--idle") && i + 1 < argc) {
+            idleMs = (unsigned)atoi(argv[++i]);
+        } else {
+            dialogs = atoi(argv[i]);
+        }
+    }
+    if (dialogs < 2) dialogs = 2;
+
+    const double initBegin = NowMs();
+    if (NFD_Init() != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    const double initMs = NowMs() - initBegin;
+    if (idleMs) {
+        const struct timespec idle = {idleMs / 1000, (long)(idleMs % 1000) * 1000000L};
+        nanosleep(&idle, NULL);
+    }
+
+    double* times = (double*)malloc(sizeof(double) * (size_t)dialogs);
+    for (int dialog = 0; dialog != dialogs; ++dialog) {
+        nfdu8char_t* outPath;
+        const double begin = NowMs();
+        const nfdresult_t result = NFD_PickFolderU8(&outPath, "/tmp");
+        times[dialog] = NowMs() - begin;
+        if (result != NFD_OKAY) {
+            printf("dialog %d: %s\n", dialog, result == NFD_ERROR ? NFD_GetError() : "cancelled");
+            free(times);
+            NFD_Quit();
+            return 1;
+        }
+        NFD_FreePathU8(outPath);
+    }
+
+    qsort(times + 1, (size_t)dialogs - 1, sizeof(double), CompareDoubles);
+    printf("NFD_Init: %.3f ms, first dialog: %.3f ms, later dialogs: median %.3f ms, min %.3f ms\n",
+           initMs,
+           times[0],
+           times[1 + (dialogs - 1) / 2],
+           times[1]);
+    free(times);
+    NFD_Quit();
+    return 0;
+}
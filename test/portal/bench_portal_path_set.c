@@ -0,0 +1,136 @@
+/*
+  Times multiple-selection portal dialogs that return from 10 to 100000 URIs, against mock_portal,
+  to show that building the path set and reading it with the NFD_PathSet_GetCount and
+  NFD_PathSet_GetPath loop scale linearly with the number of URIs.  Also prints how much heap
+  memory each path set holds, next to the total length of its URIs, and the peak RSS.
+
+  Usage (see run_with_mock_portal.sh):
+    bench_portal_path_set [rounds]
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static double NowMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+// Returns the number of bytes allocated on the heap.
+static size_t HeapInUse(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Makes mock_portal answer the following requests with `count` URIs, and returns their total
+// length, or 0 on failure.
+static size_t SetResponseUris(DBusConnection* conn, unsigned count) {
+    char** uris = (char**)malloc(sizeof(char*) * (count ? count : 1));
+    size_t totalLength = 0;
+    for (unsigned i = 0; i != count; ++i) {
+        uris[i] = (char*)malloc(128);
+        totalLength += (size_t)sprintf(
+            uris[i], "file:///home/user/Pictures/2024/Holiday%%20%u/IMG_%06u.jpg", i % 50, i);
+    }
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "SetResponseUris");
+    dbus_message_append_args(
+        query, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &uris, (int)count, DBUS_TYPE_INVALID);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 60000, NULL);
+    dbus_message_unref(query);
+    for (unsigned i = 0; i != count; ++i) free(uris[i]);
+    free(uris);
+    if (!reply) return 0;
+    dbus_message_unref(reply);
+    return totalLength;
+}
+
+int main(int argc, char** argv) {
+    static const unsigned COUNTS[] = {10, 100, 1000, 10000, 50000, 100000};
+    const int rounds = argc > 1 ? atoi(argv[1]) : 5;
+    if (NFD_Init() != NFD_OKAY) {
+        printf("%s\n", NFD_GetError());
+        return 1;
+    }
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+
+    printf("%8s %12s %10s %12s %10s %14s\n",
+           "URIs",
+           "dialog ms",
+           "ns/URI",
+           "GetPath ms",
+           "ns/URI",
+           "path set bytes");
+    for (size_t c = 0; c != sizeof(COUNTS) / sizeof(COUNTS[0]); ++c) {
+        const unsigned count = COUNTS[c];
+        const size_t uriBytes = SetResponseUris(conn, count);
+        if (!uriBytes) {
+            printf("Failed to set the URIs of mock_portal.\n");
+            return 1;
+        }
+        double bestDialog = 0;
+        double bestIndex = 0;
+        size_t heldBytes = 0;
+        for (int round = 0; round != rounds; ++round) {
+            const size_t heapBefore = HeapInUse();
+            const nfdpathset_t* paths;
+            double begin = NowMs();
+            if (NFD_OpenDialogMultipleU8(&paths, NULL, 0, NULL) != NFD_OKAY) {
+                printf("Error: %s\n", NFD_GetError());
+                return 1;
+            }
+            const double dialogMs = NowMs() - begin;
+            heldBytes = HeapInUse() - heapBefore;
+
+            begin = NowMs();
+            nfdpathsetsize_t pathCount = 0;
+            NFD_PathSet_GetCount(paths, &pathCount);
+            unsigned enumerated = 0;
+            for (nfdpathsetsize_t i = 0; i != pathCount; ++i) {
+                nfdu8char_t* path;
+                if (NFD_PathSet_GetPathU8(paths, i, &path) != NFD_OKAY) break;
+                enumerated += path[0] == '/';
+                NFD_PathSet_FreePathU8(path);
+            }
+            const double indexMs = NowMs() - begin;
+            NFD_PathSet_Free(paths);
+            if (enumerated != count) {
+                printf("Got %u of %u paths.\n", enumerated, count);
+                return 1;
+            }
+            if (round == 0 || dialogMs < bestDialog) bestDialog = dialogMs;
+            if (round == 0 || indexMs < bestIndex) bestIndex = indexMs;
+        }
+        printf("%8u %12.3f %10.1f %12.3f %10.1f %14u (URIs: %u bytes)\n",
+               count,
+               bestDialog,
+               bestDialog * 1000000.0 / count,
+               bestIndex,
+               bestIndex * 1000000.0 / count,
+               (unsigned)heldBytes,
+               (unsigned)uriBytes);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak RSS: %ld KiB\n", usage.ru_maxrss);
+
+    dbus_connection_unref(conn);
+    NFD_Quit();
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs a command on a new session bus, where mock_portal stands in for xdg-desktop-portal.
+#
+# Usage:
+#   run_with_mock_portal.sh <mock_portal> <respond|hang-reply|hang-response> <command> [args...]
+# The mode may be followed by options of the mock, in the same argument (e.g. "respond --startup
+# 200").  Exits with the exit status of the command.
+
+if [ $# -lt 3 ]; then
+  echo "usage: $0 <mock_portal> <respond|hang-reply|hang-response> <command> [args...]" >&2
+  exit 2
+fi
+
+exec dbus-run-session -- sh -c '
+  mock_portal="$1"
+  mode="$2"
+  shift 2
+  # split the mode from the options of the mock
+  "$mock_portal" $mode &
+  mock_pid=$!
+  # wait for the mock to own its name, so that the bus does not try to activate a real portal
+  tries=0
+  until dbus-send --session --print-reply --dest=org.freedesktop.DBus / \
+      org.freedesktop.DBus.GetNameOwner string:org.freedesktop.portal.Desktop >/dev/null 2>&1; do
+    tries=$((tries + 1))
+    if [ $tries -ge 100 ] || ! kill -0 $mock_pid 2>/dev/null; then
+      echo "mock_portal did not start" >&2
+      exit 1
+    fi
+    sleep 0.05
+  done
+  "$@"
+  status=$?
+  kill $mock_pid
+  exit $status' sh "$@"
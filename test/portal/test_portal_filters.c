@@ -0,0 +1,105 @@
+/*
+  Checks the filters that the portal implementation sends to the portal, against mock_portal: file
+  extensions must become "*.ext" globs (type 0, case-insensitive unless NFD is built with
+  NFD_CASE_SENSITIVE_FILTER), and MIME types such as "text/plain" must be sent as they are (type 1),
+  so that the file chooser matches them natively instead of through globs.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_filters
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+// Returns the filters of the last request as formatted by mock_portal, to be freed with free().
+static char* GetLastFilters(DBusConnection* conn) {
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "GetLastFilters");
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 10000, NULL);
+    dbus_message_unref(query);
+    char* result = NULL;
+    const char* filters;
+    if (reply &&
+        dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &filters, DBUS_TYPE_INVALID)) {
+        result = strdup(filters);
+    }
+    if (reply) dbus_message_unref(reply);
+    return result;
+}
+
+// Checks the filters of the last request against the expected ones for a case-insensitive and for
+// a case-sensitive build.
+static void Check(DBusConnection* conn,
+                  const char* what,
+                  const char* caseInsensitive,
+                  const char* caseSensitive) {
+    char* filters = GetLastFilters(conn);
+    if (!filters ||
+        (strcmp(filters, caseInsensitive) != 0 && strcmp(filters, caseSensitive) != 0)) {
+        printf("FAIL: %s: got\n%s\nexpected\n%s\n",
+               what,
+               filters ? filters : "(null)",
+               caseInsensitive);
+        ++failures;
+    }
+    free(filters);
+}
+
+int main(void) {
+    if (NFD_Init() != NFD_OKAY) {
+        printf("%s\n", NFD_GetError());
+        return 1;
+    }
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+
+    nfdu8char_t* outPath;
+    nfdu8filteritem_t mixed[] = {{"Images", "png,image/*"}, {"Documents", "text/plain,md"}};
+    if (NFD_OpenDialogU8(&outPath, mixed, 2, NULL) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    NFD_FreePathU8(outPath);
+    Check(conn,
+          "extensions and MIME types",
+          "Images (png, image/*)\t0:*.[pP][nN][gG]\t1:image/*\n"
+          "Documents (text/plain, md)\t1:text/plain\t0:*.[mM][dD]\n"
+          "All files\t0:*\n",
+          "Images (png, image/*)\t0:*.png\t1:image/*\n"
+          "Documents (text/plain, md)\t1:text/plain\t0:*.md\n"
+          "All files\t0:*\n");
+
+    // a different list must replace the cached one, also in a save dialog
+    nfdu8filteritem_t mimeOnly[] = {{"Any image", "image/*"}, {"Archives", "application/zip"}};
+    if (NFD_SaveDialogU8(&outPath, mimeOnly, 2, NULL, "a.png") != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    NFD_FreePathU8(outPath);
+    Check(conn,
+          "MIME types only",
+          "Any image (image/*)\t1:image/*\n"
+          "Archives (application/zip)\t1:application/zip\n"
+          "All files\t0:*\n",
+          "Any image (image/*)\t1:image/*\n"
+          "Archives (application/zip)\t1:application/zip\n"
+          "All files\t0:*\n");
+
+    dbus_connection_unref(conn);
+    NFD_Quit();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+  Checks that messages which are not meant for NFD pass through it, against mock_portal (which is
+  told to send some test.Foreign.Ping signals before each Response).  With the shared connection,
+  a filter that the application adds after NFD_Init must still see every one of them, and with a
+  private connection (NFD_PORTAL_PRIVATE_CONNECTION) it must see none.  Either way, NFD must count
+  them in NFD_Portal_GetForeignMessageCount.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_foreign [dialogs] [--app-dispatch]
+
+  With --app-dispatch, another thread keeps dispatching libdbus's shared session connection, like
+  an application that uses that connection for its own purposes.
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIGNALS_PER_DIALOG 5
+
+static unsigned app_signal_count;  // accessed atomically
+static int stop_dispatching;        // accessed atomically
+
+static DBusHandlerResult AppFilter(DBusConnection* conn, DBusMessage* msg, void* data) {
+    (void)conn;
+    (void)data;
+    if (dbus_message_is_signal(msg, "test.Foreign", "Ping")) {
+        __atomic_add_fetch(&app_signal_count, 1, __ATOMIC_RELAXED);
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void* DispatchThread(void* arg) {
+    DBusConnection* conn = (DBusConnection*)arg;
+    while (!__atomic_load_n(&stop_dispatching, __ATOMIC_RELAXED)) {
+        dbus_connection_read_write_dispatch(conn, 10);
+    }
+    return NULL;
+}
+
+// Calls a method of mock_portal, and returns its reply (or NULL).
+static DBusMessage* CallMock(DBusConnection* conn, const char* method, int type, const void* arg) {
+    DBusMessage* query =
+        dbus_message_new_method_call("org.freedesktop.portal.Desktop", "/", "test.Mock", method);
+    if (type != DBUS_TYPE_INVALID) dbus_message_append_args(query, type, arg, DBUS_TYPE_INVALID);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 10000, NULL);
+    dbus_message_unref(query);
+    return reply;
+}
+
+int main(int argc, char** argv) {
+    int dialogs = 20;
+    int app_dispatch = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--app-dispatch") == 0) {
+            app_dispatch = 1;
+        } else {
+            dialogs = atoi(argv[i]);
+        }
+    }
+    if (dialogs < 1) dialogs = 1;
+
+    // a lost wakeup makes a dialog wait forever, so treat that as a failure
+    alarm(60);
+
+    dbus_threads_init_default();
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+    if (NFD_Init() != NFD_OKAY) {
+        printf("%s\n", NFD_GetError());
+        return 1;
+    }
+    // after NFD_Init, so that NFD's own filter sees the signals first
+    dbus_connection_add_filter(conn, &AppFilter, NULL, NULL);
+
+    const dbus_uint32_t signalsPerDialog = SIGNALS_PER_DIALOG;
+    DBusMessage* reply = CallMock(conn, "SetForeignSignals", DBUS_TYPE_UINT32, &signalsPerDialog);
+    if (!reply) {
+        printf("Failed to set up mock_portal.\n");
+        return 1;
+    }
+    dbus_message_unref(reply);
+
+    pthread_t dispatch_thread;
+    if (app_dispatch) pthread_create(&dispatch_thread, NULL, &DispatchThread, conn);
+
+    const size_t foreignBefore = NFD_Portal_GetForeignMessageCount();
+    int failures = 0;
+    for (int dialog = 0; dialog != dialogs; ++dialog) {
+        nfdu8char_t* outPath;
+        if (NFD_PickFolderU8(&outPath, "/tmp") != NFD_OKAY) {
+            printf("dialog %d: %s\n", dialog, NFD_GetError());
+            ++failures;
+            continue;
+        }
+        NFD_FreePathU8(outPath);
+    }
+    const unsigned expected = (unsigned)dialogs * SIGNALS_PER_DIALOG;
+
+    // whether NFD uses the shared connection, i.e. the signals were sent to it
+    int shared = 0;
+    reply = CallMock(conn, "GetLastSender", DBUS_TYPE_INVALID, NULL);
+    const char* sender;
+    if (reply && dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &sender, DBUS_TYPE_INVALID)) {
+        shared = strcmp(sender, dbus_bus_get_unique_name(conn)) == 0;
+    }
+    if (reply) dbus_message_unref(reply);
+
+    // The signals arrive before the Response, so NFD has dispatched them by the time the dialog
+    // returns, unless the application's thread is dispatching them.
+    if (app_dispatch && shared) {
+        for (int tries = 0; tries != 500; ++tries) {
+            if (__atomic_load_n(&app_signal_count, __ATOMIC_RELAXED) >= expected) break;
+            usleep(10000);
+        }
+    }
+    if (app_dispatch) {
+        __atomic_store_n(&stop_dispatching, 1, __ATOMIC_RELAXED);
+        pthread_join(dispatch_thread, NULL);
+    }
+
+    const unsigned seen = __atomic_load_n(&app_signal_count, __ATOMIC_RELAXED);
+    const size_t foreign = NFD_Portal_GetForeignMessageCount() - foreignBefore;
+    printf("%s connection: the application saw %u of %u foreign signals, NFD counted %zu\n",
+           shared ? "shared" : "private",
+           seen,
+           expected,
+           foreign);
+    if (seen != (shared ? expected : 0)) {
+        printf("FAIL: foreign signals did not pass through\n");
+        ++failures;
+    }
+    if (foreign < expected) {
+        printf("FAIL: foreign signals were not counted\n");
+        ++failures;
+    }
+
+    dbus_connection_remove_filter(conn, &AppFilter, NULL);
+    NFD_Quit();
+    dbus_connection_unref(conn);
+    return failures == 0 ? 0 : 1;
+}
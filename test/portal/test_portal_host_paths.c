@@ -0,0 +1,167 @@
+/*
+  Checks that a build with NFD_PORTAL_HOST_PATHS replaces the paths inside the document portal by
+  their host paths, against mock_portal started with --documents: paths in documents that the
+  document portal knows are mapped with a single GetHostPaths call per dialog, and all the other
+  paths (and the URIs, when the caller asks for URIs) are returned unchanged.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_host_paths
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <stdio.h>
+#include <string.h>
+
+static int failures;
+
+static void Fail(const char* what, unsigned index) {
+    if (++failures <= 10) printf("FAIL at %u: %s\n", index, what);
+}
+
+// Makes mock_portal answer the following requests with the given URIs.
+static int SetResponseUris(DBusConnection* conn, const char* const* uris, int count) {
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "SetResponseUris");
+    dbus_message_append_args(
+        query, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &uris, count, DBUS_TYPE_INVALID);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 10000, NULL);
+    dbus_message_unref(query);
+    if (!reply) return 0;
+    dbus_message_unref(reply);
+    return 1;
+}
+
+static unsigned GetHostPathsCount(DBusConnection* conn) {
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "GetHostPathsCount");
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 10000, NULL);
+    dbus_message_unref(query);
+    dbus_uint32_t count = 0;
+    if (reply) {
+        dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &count, DBUS_TYPE_INVALID);
+        dbus_message_unref(reply);
+    }
+    return count;
+}
+
+// The mock's document portal is mounted at /run/user/1000/doc, and maps every document id that
+// does not start with "unknown" to /home/user/host/<id>.
+static const char* const URIS[] = {
+    "file:///run/user/1000/doc/a1/report.txt",
+    "file:///run/user/1000/doc/unknown1/notes.txt",
+    "file:///tmp/outside.txt",
+    "file:///run/user/1000/doc/b2/Photos/2024/img%201.jpg",
+    "file:///run/user/1000/doc/b2/Photos/img2.jpg",
+    "file:///run/user/1000/doc/bad%zz/x.txt",
+    "file:///run/user/1000/doc/a1",
+    "file:///run/user/1000/docs/c3/x.txt"};
+// NULL where the URI is malformed
+static const char* const PATHS[] = {"/home/user/host/a1",
+                                    "/run/user/1000/doc/unknown1/notes.txt",
+                                    "/tmp/outside.txt",
+                                    "/home/user/host/b2/2024/img 1.jpg",
+                                    "/home/user/host/b2/img2.jpg",
+                                    NULL,
+                                    "/run/user/1000/doc/a1",
+                                    "/run/user/1000/docs/c3/x.txt"};
+#define URI_COUNT (sizeof(URIS) / sizeof(URIS[0]))
+
+static void CheckMultiple(DBusConnection* conn) {
+    const unsigned callsBefore = GetHostPathsCount(conn);
+    if (!SetResponseUris(conn, URIS, (int)URI_COUNT)) {
+        Fail("cannot set the URIs of the mock", 0);
+        return;
+    }
+    const nfdpathset_t* paths;
+    if (NFD_OpenDialogMultipleU8(&paths, NULL, 0, NULL) != NFD_OKAY) {
+        Fail(NFD_GetError(), 0);
+        return;
+    }
+    nfdpathsetsize_t count;
+    if (NFD_PathSet_GetCount(paths, &count) != NFD_OKAY || count != URI_COUNT) {
+        Fail("wrong number of paths", 0);
+    }
+    for (unsigned i = 0; i != URI_COUNT && i != count; ++i) {
+        nfdu8char_t* path;
+        const nfdresult_t result = NFD_PathSet_GetPathU8(paths, i, &path);
+        if (!PATHS[i]) {
+            if (result != NFD_ERROR) Fail("malformed URI was not reported", i);
+        } else if (result != NFD_OKAY) {
+            Fail(NFD_GetError(), i);
+        } else {
+            if (strcmp(path, PATHS[i]) != 0) Fail(path, i);
+            NFD_PathSet_FreePathU8(path);
+        }
+    }
+    NFD_PathSet_Free(paths);
+    if (GetHostPathsCount(conn) != callsBefore + 1) Fail("not a single GetHostPaths call", 0);
+}
+
+static void CheckSingle(DBusConnection* conn) {
+    for (unsigned i = 0; i != URI_COUNT; ++i) {
+        if (!PATHS[i]) continue;
+        nfdu8char_t* path;
+        if (!SetResponseUris(conn, &URIS[i], 1) ||
+            NFD_OpenDialogU8(&path, NULL, 0, NULL) != NFD_OKAY) {
+            Fail("single dialog failed", i);
+            continue;
+        }
+        if (strcmp(path, PATHS[i]) != 0) Fail(path, i);
+        NFD_FreePathU8(path);
+    }
+}
+
+// Callers that ask for URIs get them as the portal sent them.
+static void CheckUris(DBusConnection* conn) {
+    const unsigned callsBefore = GetHostPathsCount(conn);
+    if (!SetResponseUris(conn, URIS, (int)URI_COUNT)) {
+        Fail("cannot set the URIs of the mock", 0);
+        return;
+    }
+    nfdopendialogu8args_t args;
+    memset(&args, 0, sizeof(args));
+    args.pathFormat = NFD_PATH_FORMAT_URI;
+    const nfdpathset_t* paths;
+    if (NFD_OpenDialogMultipleU8_With(&paths, &args) != NFD_OKAY) {
+        Fail(NFD_GetError(), 0);
+        return;
+    }
+    for (unsigned i = 0; i != URI_COUNT; ++i) {
+        nfdu8char_t* uri;
+        if (NFD_PathSet_GetPathU8(paths, i, &uri) != NFD_OKAY) {
+            Fail(NFD_GetError(), i);
+        } else {
+            if (strcmp(uri, URIS[i]) != 0) Fail(uri, i);
+            NFD_PathSet_FreePathU8(uri);
+        }
+    }
+    NFD_PathSet_Free(paths);
+    if (GetHostPathsCount(conn) != callsBefore) Fail("URIs were resolved", 0);
+}
+
+int main(void) {
+    if (NFD_Init() != NFD_OKAY) {
+        printf("%s\n", NFD_GetError());
+        return 1;
+    }
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+
+    CheckMultiple(conn);
+    CheckSingle(conn);
+    CheckUris(conn);
+
+    dbus_connection_unref(conn);
+    NFD_Quit();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
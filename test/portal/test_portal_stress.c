@@ -0,0 +1,145 @@
+/*
+  Shows many portal dialogs from many threads at the same time, against mock_portal (which answers
+  the requests out of order), and checks that every thread gets the answer to its own dialog.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_stress [threads] [dialogs per thread] [--app-dispatch]
+
+  With --app-dispatch, another thread keeps dispatching libdbus's shared session connection, like
+  an application that uses that connection for its own purposes.
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 1024
+#define MAX_NAME_LEN 64
+
+static int dialog_count = 50;
+static int failures;  // accessed atomically
+static int stop_dispatching;  // accessed atomically
+
+static void Fail(long thread, int dialog, const char* what) {
+    printf("thread %ld, dialog %d: %s\n", thread, dialog, what);
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+static void* DialogThread(void* arg) {
+    const long thread = (long)arg;
+    if (NFD_Init() != NFD_OKAY) {
+        Fail(thread, -1, NFD_GetError());
+        return NULL;
+    }
+    for (int dialog = 0; dialog != dialog_count; ++dialog) {
+        char folder[MAX_NAME_LEN];
+        char name[MAX_NAME_LEN];
+        char expected[2 * MAX_NAME_LEN];
+        snprintf(folder, sizeof(folder), "/tmp/nfd_stress/%ld/%d", thread, dialog);
+        nfdu8char_t* outPath = NULL;
+        nfdresult_t result;
+        switch (dialog % 3) {
+            case 0: {
+                nfdu8filteritem_t filters[2] = {{"Source code", "c,cpp"}, {"Headers", "h"}};
+                result = NFD_OpenDialogU8(&outPath, filters, 2, folder);
+                snprintf(expected, sizeof(expected), "%s/picked", folder);
+                break;
+            }
+            case 1: {
+                snprintf(name, sizeof(name), "file%d.txt", dialog);
+                result = NFD_SaveDialogU8(&outPath, NULL, 0, folder, name);
+                snprintf(expected, sizeof(expected), "%s/%s", folder, name);
+                break;
+            }
+            default:
+                result = NFD_PickFolderU8(&outPath, folder);
+                snprintf(expected, sizeof(expected), "%s/picked", folder);
+                break;
+        }
+        if (result != NFD_OKAY) {
+            Fail(thread, dialog, result == NFD_ERROR ? NFD_GetError() : "cancelled");
+            continue;
+        }
+        if (strcmp(outPath, expected) != 0) {
+            Fail(thread, dialog, "got the answer of another dialog");
+        }
+        NFD_FreePathU8(outPath);
+    }
+    NFD_Quit();
+    return NULL;
+}
+
+static void* DispatchThread(void* arg) {
+    DBusConnection* conn = (DBusConnection*)arg;
+    while (!__atomic_load_n(&stop_dispatching, __ATOMIC_RELAXED)) {
+        dbus_connection_read_write_dispatch(conn, 10);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int thread_count = 128;
+    int app_dispatch = 0;
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--app-dispatch") == 0) {
+            app_dispatch = 1;
+        } else if (positional++ == 0) {
+            thread_count = atoi(argv[i]);
+        } else {
+            dialog_count = atoi(argv[i]);
+        }
+    }
+    if (thread_count < 1 || thread_count > MAX_THREADS || dialog_count < 1) {
+        printf("usage: %s [threads] [dialogs per thread] [--app-dispatch]\n", argv[0]);
+        return 2;
+    }
+
+    // a lost wakeup makes a dialog wait forever, so treat that as a failure
+    alarm(300);
+
+    DBusConnection* conn = NULL;
+    pthread_t dispatch_thread;
+    if (app_dispatch) {
+        dbus_threads_init_default();
+        conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+        if (!conn) {
+            printf("Failed to connect to the session bus.\n");
+            return 1;
+        }
+        pthread_create(&dispatch_thread, NULL, &DispatchThread, conn);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    pthread_t threads[MAX_THREADS];
+    for (long i = 0; i != thread_count; ++i) {
+        pthread_create(&threads[i], NULL, &DialogThread, (void*)i);
+    }
+    for (int i = 0; i != thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (app_dispatch) {
+        __atomic_store_n(&stop_dispatching, 1, __ATOMIC_RELAXED);
+        pthread_join(dispatch_thread, NULL);
+        dbus_connection_unref(conn);
+    }
+
+    const double ms =
+        (end.tv_sec - begin.tv_sec) * 1000.0 + (end.tv_nsec - begin.tv_nsec) / 1000000.0;
+    printf("%d threads x %d dialogs: %d failures, %.1f ms, %zu foreign messages\n",
+           thread_count,
+           dialog_count,
+           failures,
+           ms,
+           NFD_Portal_GetForeignMessageCount());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/*
+  Shows dialogs with different timeouts from several threads at the same time, against a
+  mock_portal that never answers (in hang-reply or hang-response mode), and checks that each dialog
+  gives up close to its own deadline and closes its request.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_timeout [threads]
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+// how much later than its deadline a dialog may give up
+#define TOLERANCE_MS 250
+
+static int failures;  // accessed atomically
+
+static double ElapsedMs(const struct timespec* begin) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - begin->tv_sec) * 1000.0 + (now.tv_nsec - begin->tv_nsec) / 1000000.0;
+}
+
+static void* DialogThread(void* arg) {
+    const long thread = (long)arg;
+    if (NFD_Init() != NFD_OKAY) {
+        printf("thread %ld: %s\n", thread, NFD_GetError());
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    nfdopendialogu8args_t args = {0};
+    args.timeoutMs = 100 + 50 * (unsigned int)thread;
+    nfdu8char_t* outPath;
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    const nfdresult_t result = NFD_OpenDialogU8_With(&outPath, &args);
+    const double ms = ElapsedMs(&begin);
+    if (result == NFD_OKAY) NFD_FreePathU8(outPath);
+    const int ok = result == NFD_ERROR && strncmp(NFD_GetError(), "Timed out", 9) == 0 &&
+                   ms >= args.timeoutMs && ms <= args.timeoutMs + TOLERANCE_MS;
+    printf("thread %ld: timeout %u ms, gave up after %.0f ms: %s\n",
+           thread,
+           args.timeoutMs,
+           ms,
+           ok ? "ok" : (result == NFD_ERROR ? NFD_GetError() : "did not time out"));
+    if (!ok) __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+    NFD_Quit();
+    return NULL;
+}
+
+// Asks mock_portal how many requests have been closed.
+static int GetClosedCount(DBusConnection* conn, dbus_uint32_t* outCount) {
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "GetClosedCount");
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 1000, NULL);
+    dbus_message_unref(query);
+    if (!reply) return 0;
+    const int ok =
+        dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, outCount, DBUS_TYPE_INVALID);
+    dbus_message_unref(reply);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const int thread_count = argc > 1 ? atoi(argv[1]) : 8;
+    if (thread_count < 1 || thread_count > MAX_THREADS) {
+        printf("usage: %s [threads]\n", argv[0]);
+        return 2;
+    }
+    alarm(60);
+
+    pthread_t threads[MAX_THREADS];
+    for (long i = 0; i != thread_count; ++i) {
+        pthread_create(&threads[i], NULL, &DialogThread, (void*)i);
+    }
+    for (int i = 0; i != thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // the Close calls are not waited for, so give mock_portal some time to receive them
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+    dbus_uint32_t closed = 0;
+    for (int attempt = 0; attempt != 20; ++attempt) {
+        if (!GetClosedCount(conn, &closed)) {
+            printf("Failed to ask mock_portal how many requests were closed.\n");
+            return 1;
+        }
+        if (closed >= (dbus_uint32_t)thread_count) break;
+        usleep(50000);
+    }
+    dbus_connection_unref(conn);
+    printf("%u of %d requests were closed\n", closed, thread_count);
+    if (closed != (dbus_uint32_t)thread_count) ++failures;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/*
+  Checks the path sets built from the URIs in portal responses, against mock_portal: a response
+  with malformed and non-file:// URIs (which must be reported as errors at their own indices,
+  without disturbing the other paths), and a response with many URIs.
+
+  Usage (see run_with_mock_portal.sh):
+    test_portal_uris [uris]
+*/
+
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+static void Fail(const char* what, unsigned index) {
+    if (++failures <= 10) printf("FAIL at %u: %s\n", index, what);
+}
+
+// Makes mock_portal answer the following requests with the given URIs.
+static int SetResponseUris(DBusConnection* conn, const char* const* uris, int count) {
+    DBusMessage* query = dbus_message_new_method_call(
+        "org.freedesktop.portal.Desktop", "/", "test.Mock", "SetResponseUris");
+    dbus_message_append_args(
+        query, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &uris, count, DBUS_TYPE_INVALID);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, 10000, NULL);
+    dbus_message_unref(query);
+    if (!reply) return 0;
+    dbus_message_unref(reply);
+    return 1;
+}
+
+// The URI and the path of the i-th file of the large response.
+static void MakeFile(unsigned i, char* uri, char* path) {
+    sprintf(uri, "file:///tmp/nfd_uris/%u/file%%20%u-%%E6%%96%%87.txt", i % 97, i);
+    sprintf(path, "/tmp/nfd_uris/%u/file %u-\xE6\x96\x87.txt", i % 97, i);
+}
+
+static void CheckMalformed(DBusConnection* conn) {
+    static const char* const URIS[] = {"file:///tmp/a",
+                                       "file:///tmp/b%zz",
+                                       "https://example.com/c",
+                                       "file:///tmp/%E6%96%87",
+                                       "",
+                                       "file:///tmp/truncated%4",
+                                       "file:///tmp/%2525"};
+    // NULL where the URI is malformed
+    static const char* const PATHS[] = {
+        "/tmp/a", NULL, NULL, "/tmp/\xE6\x96\x87", NULL, NULL, "/tmp/%25"};
+    const unsigned count = sizeof(URIS) / sizeof(URIS[0]);
+    if (!SetResponseUris(conn, URIS, (int)count)) {
+        Fail("cannot set the URIs of the mock", 0);
+        return;
+    }
+
+    const nfdpathset_t* paths;
+    if (NFD_OpenDialogMultipleU8(&paths, NULL, 0, NULL) != NFD_OKAY) {
+        Fail(NFD_GetError(), 0);
+        return;
+    }
+    nfdpathsetsize_t pathCount;
+    if (NFD_PathSet_GetCount(paths, &pathCount) != NFD_OKAY || pathCount != count) {
+        Fail("wrong number of paths", 0);
+    }
+
+    // by index
+    for (unsigned i = 0; i != count && i != pathCount; ++i) {
+        nfdu8char_t* path;
+        const nfdresult_t result = NFD_PathSet_GetPathU8(paths, i, &path);
+        if (!PATHS[i]) {
+            if (result != NFD_ERROR) Fail("malformed URI was not reported", i);
+            continue;
+        }
+        if (result != NFD_OKAY) {
+            Fail(NFD_GetError(), i);
+        } else {
+            if (strcmp(path, PATHS[i]) != 0) Fail("wrong path", i);
+            NFD_PathSet_FreePathU8(path);
+        }
+    }
+
+    // with an enumerator, which must move past the malformed URIs
+    nfdpathsetenum_t enumerator;
+    if (NFD_PathSet_GetEnum(paths, &enumerator) != NFD_OKAY) {
+        Fail(NFD_GetError(), 0);
+    } else {
+        for (unsigned i = 0; i <= count; ++i) {
+            nfdu8char_t* path;
+            const nfdresult_t result = NFD_PathSet_EnumNextU8(&enumerator, &path);
+            if (i == count) {
+                if (result != NFD_OKAY || path) Fail("enumerator did not end", i);
+            } else if (!PATHS[i]) {
+                if (result != NFD_ERROR) Fail("enumerator did not report a malformed URI", i);
+            } else if (result != NFD_OKAY) {
+                Fail(NFD_GetError(), i);
+            } else {
+                if (strcmp(path, PATHS[i]) != 0) Fail("wrong path from the enumerator", i);
+                NFD_PathSet_FreePathU8(path);
+            }
+        }
+        NFD_PathSet_FreeEnum(&enumerator);
+    }
+    NFD_PathSet_Free(paths);
+
+    // a single-selection dialog fails if its URI is malformed
+    const char* const malformed[] = {"file:///tmp/b%zz"};
+    nfdu8char_t* outPath;
+    if (!SetResponseUris(conn, malformed, 1) ||
+        NFD_OpenDialogU8(&outPath, NULL, 0, NULL) != NFD_ERROR) {
+        Fail("single malformed URI was not reported", 0);
+    }
+}
+
+static void CheckMany(DBusConnection* conn, unsigned count) {
+    char** uris = (char**)malloc(sizeof(char*) * count);
+    char path[128];
+    for (unsigned i = 0; i != count; ++i) {
+        uris[i] = (char*)malloc(128);
+        MakeFile(i, uris[i], path);
+    }
+    const int ok = SetResponseUris(conn, (const char* const*)uris, (int)count);
+    for (unsigned i = 0; i != count; ++i) free(uris[i]);
+    free(uris);
+    if (!ok) {
+        Fail("cannot set the URIs of the mock", 0);
+        return;
+    }
+
+    const nfdpathset_t* paths;
+    if (NFD_OpenDialogMultipleU8(&paths, NULL, 0, NULL) != NFD_OKAY) {
+        Fail(NFD_GetError(), 0);
+        return;
+    }
+    nfdpathsetsize_t pathCount;
+    if (NFD_PathSet_GetCount(paths, &pathCount) != NFD_OKAY || pathCount != count) {
+        Fail("wrong number of paths", 0);
+    }
+    nfdpathsetenum_t enumerator;
+    NFD_PathSet_GetEnum(paths, &enumerator);
+    unsigned i = 0;
+    nfdu8char_t* outPath;
+    while (NFD_PathSet_EnumNextU8(&enumerator, &outPath) == NFD_OKAY && outPath) {
+        char uri[128];
+        MakeFile(i, uri, path);
+        if (strcmp(outPath, path) != 0) Fail("wrong path", i);
+        NFD_PathSet_FreePathU8(outPath);
+        ++i;
+    }
+    if (i != count) Fail("enumerator ended early", i);
+    NFD_PathSet_FreeEnum(&enumerator);
+    NFD_PathSet_Free(paths);
+    printf("%u URIs: ok\n", count);
+}
+
+int main(int argc, char** argv) {
+    const unsigned count = argc > 1 ? (unsigned)atoi(argv[1]) : 50000;
+    if (NFD_Init() != NFD_OKAY) {
+        printf("%s\n", NFD_GetError());
+        return 1;
+    }
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+    if (!conn) {
+        printf("Failed to connect to the session bus.\n");
+        return 1;
+    }
+
+    CheckMalformed(conn);
+    CheckMany(conn, count);
+
+    dbus_connection_unref(conn);
+    NFD_Quit();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
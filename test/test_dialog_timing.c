@@ -0,0 +1,191 @@
+/*
+  Shows the same open dialog several times with the GTK implementation, and prints how long each
+  one took to appear and how long NFD took to return after the user closed it, so that these can be
+  compared between builds and options (e.g. NFD_GTK_DEFERRED_TEARDOWN).  Close each dialog to show
+  the next one.
+
+  A dialog has appeared when GTK maps its window, and has been closed when it emits "response".
+  Dialogs that GTK shows through the desktop portal have no window in this process, so nothing is
+  printed for them.  Selecting files also times enumerating the returned path set.
+
+  Usage:
+    test_dialog_timing [rounds] [defaultPath] [--pool] [--warm-up MS]
+
+  defaultPath is the folder to open the dialogs in, e.g. a large one to measure NFD_GTK_PREFETCH.
+  --pool enables the dialog pool, so that only the first dialog is created.
+  --warm-up runs the main loop (with NFD_PumpEvents) for MS milliseconds before the first dialog,
+  so that a build with NFD_GTK_PREWARM can warm up the file chooser.
+*/
+
+#define _POSIX_C_SOURCE 199309L  // for clock_gettime
+
+#include <nfd.h>
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double NowMs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+/* when the first window was mapped and when the first dialog responded since the current dialog
+ * was started, or 0; the hooks run on the GTK thread, which is not this thread with
+ * NFD_GTK_UI_THREAD */
+G_LOCK_DEFINE_STATIC(times);
+static double mapped_ms;
+static double response_ms;
+
+static void RecordTime(double* time) {
+    const double now = NowMs();
+    G_LOCK(times);
+    if (*time == 0) *time = now;
+    G_UNLOCK(times);
+}
+
+static void TimeEnumeration(const nfdpathset_t* paths) {
+    nfdpathsetsize_t count;
+    NFD_PathSet_GetCount(paths, &count);
+
+    double begin = NowMs();
+    for (nfdpathsetsize_t i = 0; i != count; ++i) {
+        nfdu8char_t* path;
+        if (NFD_PathSet_GetPathU8(paths, i, &path) == NFD_OKAY) NFD_PathSet_FreePathU8(path);
+    }
+    const double indexed = NowMs() - begin;
+
+    begin = NowMs();
+    nfdpathsetenum_t enumerator;
+    NFD_PathSet_GetEnum(paths, &enumerator);
+    nfdu8char_t* path;
+    size_t totalLength = 0;
+    while (NFD_PathSet_EnumNextU8(&enumerator, &path) == NFD_OKAY && path) {
+        totalLength += strlen(path);
+        NFD_PathSet_FreePathU8(path);
+    }
+    NFD_PathSet_FreeEnum(&enumerator);
+    const double end = NowMs();
+
+    printf("  %u paths (%u bytes): %.3f ms by index, %.3f ms with an enumerator\n",
+           (unsigned)count,
+           (unsigned)totalLength,
+           indexed,
+           end - begin);
+}
+
+static gboolean OnMap(GSignalInvocationHint* hint,
+                      guint paramCount,
+                      const GValue* params,
+                      gpointer data) {
+    (void)hint;
+    (void)paramCount;
+    (void)data;
+    if (GTK_IS_WINDOW(g_value_get_object(&params[0]))) RecordTime(&mapped_ms);
+    return TRUE;  // stay installed
+}
+
+static gboolean OnResponse(GSignalInvocationHint* hint,
+                           guint paramCount,
+                           const GValue* params,
+                           gpointer data) {
+    (void)hint;
+    (void)paramCount;
+    (void)params;
+    (void)data;
+    RecordTime(&response_ms);
+    return TRUE;  // stay installed
+}
+
+int main(int argc, char** argv) {
+    unsigned rounds = 5;
+    const char* defaultPath = NULL;
+    int pool = 0;
+    unsigned warmUpMs = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--pool")) {
+            pool = 1;
+        } else if (!strcmp(argv[i], "--warm-up") && i + 1 < argc) {
+            warmUpMs = (unsigned)atoi(argv[++i]);
+        } else if (argv[i][0] >= '0' && argv[i][0] <= '9') {
+            rounds = (unsigned)atoi(argv[i]);
+        } else {
+            defaultPath = argv[i];
+        }
+    }
+
+    if (NFD_Init() != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    NFD_GTK_SetDialogPoolEnabled(pool);
+
+    // give the idle callbacks of NFD_GTK_PREWARM a chance to run, as an application's main loop
+    // would while the user does something else
+    const double warmUpEnd = NowMs() + warmUpMs;
+    while (NowMs() < warmUpEnd) {
+        NFD_PumpEvents();
+        const struct timespec interval = {0, 1000000};
+        nanosleep(&interval, NULL);
+    }
+
+    // watch every window that is mapped and every dialog that responds; signals are only
+    // installed once their class exists (GtkDialog is deprecated in GTK 4, but the file chooser
+    // still is one)
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    const GType dialogType = GTK_TYPE_DIALOG;
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    gpointer widgetClass = g_type_class_ref(GTK_TYPE_WIDGET);
+    gpointer dialogClass = g_type_class_ref(dialogType);
+    g_signal_add_emission_hook(g_signal_lookup("map", GTK_TYPE_WIDGET), 0, OnMap, NULL, NULL);
+    g_signal_add_emission_hook(g_signal_lookup("response", dialogType), 0, OnResponse, NULL, NULL);
+
+    nfdu8filteritem_t filterItem[2] = {{"Source code", "c,cpp,cc"}, {"Headers", "h,hpp"}};
+    nfdopendialogu8args_t args = {0};
+    args.filterList = filterItem;
+    args.filterCount = 2;
+    args.defaultPath = defaultPath;
+
+    for (unsigned round = 0; round != rounds; ++round) {
+        G_LOCK(times);
+        mapped_ms = 0;
+        response_ms = 0;
+        G_UNLOCK(times);
+
+        // the blocking function, because NFD_GTK_DEFERRED_TEARDOWN only applies to those
+        const nfdpathset_t* paths;
+        const double begin = NowMs();
+        const nfdresult_t result = NFD_OpenDialogMultipleU8_With(&paths, &args);
+        const double end = NowMs();
+
+        G_LOCK(times);
+        const double mappedAt = mapped_ms;
+        const double responseAt = response_ms;
+        G_UNLOCK(times);
+        if (mappedAt != 0 && responseAt != 0) {
+            printf("round %u (%s): mapped after %.2f ms, returned %.2f ms after the response\n",
+                   round,
+                   round == 0 || !pool ? "new" : "pooled",
+                   mappedAt - begin,
+                   end - responseAt);
+        } else {
+            printf("round %u: no window was mapped in this process\n", round);
+        }
+
+        if (result == NFD_OKAY) {
+            TimeEnumeration(paths);
+            NFD_PathSet_Free(paths);
+        } else if (result == NFD_ERROR) {
+            printf("Error: %s\n", NFD_GetError());
+            break;
+        }
+    }
+
+    g_type_class_unref(dialogClass);
+    g_type_class_unref(widgetClass);
+    NFD_Quit();
+    return 0;
+}
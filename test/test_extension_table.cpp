@@ -0,0 +1,155 @@
+/*
+  Checks that the GTK implementation's extension table matches the same file names as the "*.ext"
+  globs that it replaces (built as AddFilterSpecItem builds them, and matched with fnmatch).  It is
+  built once with and once without NFD_CASE_SENSITIVE_FILTER.
+*/
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nfd_linux_shared.hpp"
+#include "nfd_extension_table.hpp"
+
+namespace {
+
+// Returns true if one of the plain extensions in spec matches the name as a "*.ext" glob.
+bool MatchGlobs(const char* spec, const char* name) {
+    char pattern[256];
+    for (const char *p_extensionStart = spec, *p_spec = spec; true; ++p_spec) {
+        if (*p_spec == ',' || !*p_spec) {
+            if (IsPlainExtensionItem(p_extensionStart, p_spec)) {
+                char* p_pattern = pattern;
+                *p_pattern++ = '*';
+                *p_pattern++ = '.';
+#ifdef NFD_CASE_SENSITIVE_FILTER
+                memcpy(p_pattern, p_extensionStart, p_spec - p_extensionStart);
+                p_pattern += p_spec - p_extensionStart;
+#else
+                p_pattern = emit_case_insensitive_glob(p_extensionStart, p_spec, p_pattern);
+#endif
+                *p_pattern = '\0';
+                if (fnmatch(pattern, name, 0) == 0) return true;
+            }
+            if (!*p_spec) break;
+            p_extensionStart = p_spec + 1;
+        }
+    }
+    return false;
+}
+
+// Returns whether the table built from spec matches the name, or -1 if there is no table.
+int MatchTable(const char* spec, const char* name) {
+    ExtensionTable* table = BuildExtensionTable(spec);
+    if (!table) return -1;
+    const bool matches = ExtensionTableMatches(table, name);
+    NFDi_Free(table);
+    return matches;
+}
+
+unsigned failures;
+
+void Fail(const char* spec, const char* name, const char* what) {
+    if (++failures <= 10) printf("FAIL: spec \"%s\", name \"%s\": %s\n", spec, name, what);
+}
+
+// Checks that the table agrees with the globs (when there are plain extensions in spec).
+void Check(const char* spec, const char* name) {
+    const int table = MatchTable(spec, name);
+    if (table >= 0 && table != static_cast<int>(MatchGlobs(spec, name))) {
+        Fail(spec, name, "the table and the globs disagree");
+    }
+}
+
+// Also checks the expected result.
+void Check(const char* spec, const char* name, bool expected) {
+    Check(spec, name);
+    if (MatchGlobs(spec, name) != expected) Fail(spec, name, "unexpected result");
+}
+
+unsigned rng_state = 12345;
+
+unsigned Random(unsigned bound) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state % bound;
+}
+
+// Appends random chars, mostly ones that the globs and the table treat specially.
+char* AppendRandom(char* out, unsigned maxCount) {
+    // the last two are "é" and "É" in UTF-8
+    static const char* const PIECES[] = {
+        "a", "A", "b", "B", "z", "Z", ".", "0", "_", "\xC3\xA9", "\xC3\x89"};
+    for (unsigned count = Random(maxCount + 1); count != 0; --count) {
+        const char* piece = PIECES[Random(sizeof(PIECES) / sizeof(PIECES[0]))];
+        out = stpcpy(out, piece);
+    }
+    return out;
+}
+
+}  // namespace
+
+int main() {
+    Check("gz", "a.tar.gz", true);
+    Check("tar.gz", "a.tar.gz", true);
+    Check("tar.gz", "a.gz", false);
+    Check("tar.gz", "tar.gz", false);
+    Check("tar.gz", ".tar.gz", true);
+    Check("gz,tar.gz", "a.tar.gz", true);
+    Check("tar", "a.tar.gz", false);
+    Check("png", ".png", true);
+    Check("png", "png", false);
+    Check("png", "a.png.txt", false);
+    Check("png", "a..png", true);
+    Check("png", "a.xpng", false);
+    Check("png,", "a.", true);
+    Check("png", "a.", false);
+    Check("c,cpp,cc", "main.c", true);
+    Check("c,cpp,cc", "main.cxx", false);
+    // extensions longer than the longest one in the table
+    Check("md", "notes.markdown", false);
+    Check("md", "a.md.extraordinarilylongextension", false);
+    Check("longextension,x", "file.longextension", true);
+    Check("longextension,x", "file.verylongextension", false);
+    // case folding
+#ifdef NFD_CASE_SENSITIVE_FILTER
+    Check("png", "IMAGE.PNG", false);
+    Check("PNG", "image.png", false);
+    Check("PNG", "image.PNG", true);
+    Check("Tar.Gz", "a.TAR.GZ", false);
+    Check("\xC3\xA9t\xC3\xA9", "a.\xC3\xA9T\xC3\xA9", false);
+#else
+    Check("png", "IMAGE.PNG", true);
+    Check("PNG", "image.png", true);
+    Check("Tar.Gz", "a.TAR.GZ", true);
+    Check("png", "image.PnG", true);
+    Check("\xC3\xA9t\xC3\xA9", "a.\xC3\xA9T\xC3\xA9", true);
+#endif
+    // only the Latin letters are folded
+    Check("\xC3\xA9t\xC3\xA9", "a.\xC3\x89t\xC3\xA9", false);
+    // glob and MIME items are not in the table, but the plain ones are
+    Check("txt,*.log,text/plain", "a.txt", true);
+    Check("*.log,txt", "a.log");
+    Check("image/*", "a.png");
+
+    char spec[256];
+    char name[256];
+    for (unsigned round = 0; round != 200000; ++round) {
+        char* p_spec = spec;
+        for (unsigned items = 1 + Random(5); items != 0; --items) {
+            p_spec = AppendRandom(p_spec, 4);
+            if (items != 1) *p_spec++ = ',';
+        }
+        *p_spec = '\0';
+        *AppendRandom(name, 10) = '\0';
+        Check(spec, name);
+    }
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
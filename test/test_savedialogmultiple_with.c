@@ -0,0 +1,53 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* this test should compile on all supported platforms, but it only shows a dialog on Linux */
+
+int main(void) {
+    // initialize NFD
+    // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
+    // or before/after every time you want to show a file dialog.
+    NFD_Init();
+
+    const nfdpathset_t* outPaths;
+
+    // prepare the names of the files to save
+    const nfdu8char_t* fileNames[3] = {"Layer 1.png", "Layer 2.png", "Background.png"};
+
+    // show the dialog
+    nfdsavedialogmultipleu8args_t args = {0};
+    args.fileNames = fileNames;
+    args.fileCount = 3;
+    nfdresult_t result = NFD_SaveDialogMultipleU8_With(&outPaths, &args);
+
+    if (result == NFD_OKAY) {
+        puts("Success!");
+
+        nfdpathsetsize_t numPaths;
+        NFD_PathSet_GetCount(outPaths, &numPaths);
+
+        nfdpathsetsize_t i;
+        for (i = 0; i < numPaths; ++i) {
+            nfdu8char_t* path;
+            NFD_PathSet_GetPathU8(outPaths, i, &path);
+            printf("Path %i: %s\n", (int)i, path);
+
+            // remember to free the pathset path with NFD_PathSet_FreePathU8 (not NFD_FreePathU8!)
+            NFD_PathSet_FreePathU8(path);
+        }
+
+        // remember to free the pathset memory (since NFD_OKAY is returned)
+        NFD_PathSet_Free(outPaths);
+    } else if (result == NFD_CANCEL) {
+        puts("User pressed cancel.");
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+  Checks that the portal's URI decoder gives the same results with and without its SSE2 fast path,
+  and that both agree with a straightforward decoder.  The inputs are placed at the end of their
+  buffers, so that reading past them is caught by AddressSanitizer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfd_uri_decode.hpp"
+
+namespace {
+
+int HexValue(char ch) {
+    if ('0' <= ch && ch <= '9') return ch - '0';
+    if ('A' <= ch && ch <= 'F') return ch - 'A' + 10;
+    if ('a' <= ch && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// Returns the length of the decoded URI, or -1 if it is malformed.
+long ReferenceDecode(const char* uri, size_t len, char* out) {
+    long outLen = 0;
+    for (size_t i = 0; i != len; ++outLen) {
+        if (uri[i] != '%') {
+            out[outLen] = uri[i++];
+            continue;
+        }
+        if (len - i < 3 || HexValue(uri[i + 1]) < 0 || HexValue(uri[i + 2]) < 0) return -1;
+        out[outLen] = static_cast<char>(HexValue(uri[i + 1]) * 16 + HexValue(uri[i + 2]));
+        i += 3;
+    }
+    return outLen;
+}
+
+template <bool Vectorized>
+long Decode(const char* uri, size_t len, char* out) {
+    // copy the URI to the end of an exact-size buffer
+    char* const copy = static_cast<char*>(malloc(len ? len : 1));
+    memcpy(copy, uri, len);
+    const char* const end = TryUriDecode<Vectorized>(copy, copy + len, out);
+    free(copy);
+    return end ? end - out : -1;
+}
+
+unsigned failures;
+
+void Check(const char* uri, size_t len) {
+    char* const expected = static_cast<char*>(malloc(len + 1));
+    char* const scalar = static_cast<char*>(malloc(len + 1));
+    char* const vectorized = static_cast<char*>(malloc(len + 1));
+    const long expectedLen = ReferenceDecode(uri, len, expected);
+    const long scalarLen = Decode<false>(uri, len, scalar);
+    const long vectorizedLen = Decode<true>(uri, len, vectorized);
+    const bool scalarOk = scalarLen == expectedLen &&
+                          (expectedLen < 0 || !memcmp(scalar, expected, expectedLen));
+    const bool vectorizedOk = vectorizedLen == expectedLen &&
+                              (expectedLen < 0 || !memcmp(vectorized, expected, expectedLen));
+    if (!scalarOk || !vectorizedOk) {
+        if (++failures <= 10) {
+            printf("FAIL: \"%.*s\" (%u chars): expected %ld, scalar %ld, vectorized %ld\n",
+                   static_cast<int>(len),
+                   uri,
+                   static_cast<unsigned>(len),
+                   expectedLen,
+                   scalarLen,
+                   vectorizedLen);
+        }
+    }
+    free(vectorized);
+    free(scalar);
+    free(expected);
+}
+
+void Check(const char* uri) {
+    Check(uri, strlen(uri));
+}
+
+unsigned rng_state = 12345;
+
+unsigned Random(unsigned bound) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state % bound;
+}
+
+// Appends a random piece of a URI, mostly valid escapes so that runs of them cross the 16-char
+// loads of the fast path at every offset.
+size_t AppendPiece(char* out) {
+    static const char HEX[] = "0123456789ABCDEFabcdef";
+    static const char INVALID[] = "gG/%-z\x80";
+    switch (Random(16)) {
+        case 0:
+            out[0] = static_cast<char>('a' + Random(26));
+            return 1;
+        case 1:
+            out[0] = '\0';
+            return 1;
+        case 2:  // a lone '%'
+            out[0] = '%';
+            return 1;
+        case 3:  // an escape with an invalid first or second digit
+            out[0] = '%';
+            out[1] = HEX[Random(sizeof(HEX) - 1)];
+            out[2] = HEX[Random(sizeof(HEX) - 1)];
+            out[1 + Random(2)] = INVALID[Random(sizeof(INVALID) - 1)];
+            return 3;
+        case 4:  // an escaped NUL
+            memcpy(out, "%00", 3);
+            return 3;
+        default:
+            out[0] = '%';
+            out[1] = HEX[Random(sizeof(HEX) - 1)];
+            out[2] = HEX[Random(sizeof(HEX) - 1)];
+            return 3;
+    }
+}
+
+}  // namespace
+
+int main() {
+    Check("");
+    Check("/home/user/file.txt");
+    Check("/home/user/my%20file.txt");
+    Check("%E4%B8%AD%E6%96%87%E6%96%87%E4%BB%B6%E5%A4%B9");
+    Check("%e4%b8%ad%e6%96%87%e6%96%87%e4%bb%b6%e5%a4%b9");
+    Check("%");
+    Check("%4");
+    Check("abc%");
+    Check("abc%4");
+    Check("%E4%B8%AD%E6%96%");
+    Check("%E4%B8%AD%E6%96%8");
+    Check("%E4%B8%AD%E6%96%87%");
+    Check("%G0%B8%AD%E6%96%87");
+    Check("%E4%B8%AD%E6%96%8G");
+    Check("%E4%B8%AD%E6%96%87%E");
+    Check("%00%00%00%00%00%00");
+    Check("a\0b%00c", 7);
+    Check("%E4%B8%AD%E6%96\0%87", 19);
+
+    // every length and offset of escape runs around the 16-char loads
+    char uri[256];
+    for (size_t prefix = 0; prefix != 20; ++prefix) {
+        for (size_t escapes = 0; escapes != 12; ++escapes) {
+            for (size_t suffix = 0; suffix != 4; ++suffix) {
+                char* out = uri;
+                for (size_t i = 0; i != prefix; ++i) *out++ = 'x';
+                for (size_t i = 0; i != escapes; ++i) {
+                    memcpy(out, "%c3", 3);
+                    out += 3;
+                }
+                for (size_t i = 0; i != suffix; ++i) *out++ = 'y';
+                const size_t len = static_cast<size_t>(out - uri);
+                Check(uri, len);
+                // the same, truncated at every char
+                for (size_t end = 0; end != len; ++end) Check(uri, end);
+            }
+        }
+    }
+
+    for (unsigned round = 0; round != 200000; ++round) {
+        size_t len = 0;
+        const unsigned pieces = Random(24);
+        for (unsigned i = 0; i != pieces; ++i) {
+            char piece[3];
+            const size_t pieceLen = AppendPiece(piece);
+            memcpy(uri + len, piece, pieceLen);
+            len += pieceLen;
+        }
+        Check(uri, len);
+    }
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}